@@ -7,16 +7,36 @@
 #define _COMMS_H
 
 #if defined(HW_RVL) || defined(HW_DOL)
-#define ntohl(x) (x)
-#define htonl(x) (x)
-/* SI channel to look for the GBA on, 0-indexed */
+/* a GBA on every SI channel, 0-indexed */
+#define C_MAX_GBAS (4)
+
+/* the one the GBA always used to go on, it gets the extras (ARAM) that don't go round */
 #define GBA_CHAN (1)
 
 extern void C_Process(void);
+extern u32 C_OfferedFeatures;
+extern bool C_DemandPaging;
+extern u32 C_ZeroReplies; /* reads answered with a zero run (FEAT_ZERO) */
+
+/* C_Stats[] is in stats.h, one per channel */
+extern void C_DumpStats(void);
+
+/* write the protocol trace ring out (trace.h), for sim/tracedump.c to read */
+#define C_TRACE_PATH "/apps/gba-linux-loader/trace.bin"
+extern bool C_DumpTrace(const char *path);
+#endif /* HW_RVL || HW_DOL */
+
+/*
+ * Guest memory and the CRCs over it are big endian.  Go by the compiler
+ * rather than the platform, so the link simulator gets it right on x86 too.
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ntohl(x) (x)
+#define htonl(x) (x)
 #else
 #define htonl(x) (__builtin_bswap32(x))
 #define ntohl(x) (__builtin_bswap32(x))
-#endif /* HW_AGB */
+#endif
 
 #if 0
 /* even parity in bit 0 */
@@ -37,6 +57,7 @@ static inline u32 parity(u32 msg) {
 #define MKCLASS(x)      ((x << CLASS_SHIFT) & PKT_CLASS)
 #define CLASS_SYS       MKCLASS(0)
 #define CLASS_MEM       MKCLASS(1)
+#define CLASS_BLK       MKCLASS(2)
 
 /* subcmd stuff in bits 3-5 */
 #define SUBCMD_SHIFT    (3)
@@ -45,16 +66,24 @@ static inline u32 parity(u32 msg) {
 
 #define SYS_ACK         MKSUBCMD(1) /* SYS stuff starts at subcmd 1 to avoid confusion with class=0 subcmd=0 */
 #define SYS_MW_TX_DONE  MKSUBCMD(2)
-#define SYS_PING        MKSUBCMD(3)
+#define SYS_PING        MKSUBCMD(3) /* handshake, and link stats after it, see below */
 #define SYS_PING_REPLY  MKSUBCMD(4)
 #define SYS_KERNEL_LOAD MKSUBCMD(5)
+#define SYS_FEATURES    MKSUBCMD(6) /* data = feature bits, GBA echoes back the ones it accepts */
+#define SYS_LOADER      MKSUBCMD(7) /* second boot stage, see below */
 
 #define MEM_READ        MKSUBCMD(0)
 #define MEM_WRITE       MKSUBCMD(1)
+#define MEM_PUSH        MKSUBCMD(2) /* read-ahead, see below */
+#define MEM_DATA        MKSUBCMD(3) /* tagged MEM_WRITE data block */
+
+#define BLK_READ        MKSUBCMD(0) /* virtual disk, see below */
+#define BLK_WRITE       MKSUBCMD(1)
 
 /* cmd id stuff in bits 6-7 */
 #define CMD_ID_SHIFT    (6)
 #define PKT_CMD_ID      (3 << CMD_ID_SHIFT)
+#define MAX_INFLIGHT    (4) /* one per cmd id */
 
 #if 0
 /* fmt stuff in bit 8 */
@@ -72,63 +101,414 @@ static inline u32 parity(u32 msg) {
 #define CRC8_SHIFT      (24)
 #define PKT_CRC8        (255 << CRC8_SHIFT)
 
-/* Tableless CRC-8 (polynomial 0x07), initial 0x00 */
+/* feature bits, negotiated via SYS_FEATURES after the ping handshake */
+#define FEAT_BURST      (1 << 0) /* MEM_READ data is streamed in CRC'd blocks */
+#define FEAT_PUSH       (1 << 1) /* host pushes the MEM_READs it expects next */
+#define FEAT_TAGGED     (1 << 2) /* up to MAX_INFLIGHT requests at once, needs FEAT_BURST */
+#define FEAT_LZ77       (1 << 3) /* MEM_READ data may come back compressed, needs FEAT_BURST */
+#define FEAT_PACE       (1 << 4) /* host times paced MEM_READs to what the link can take, without FEAT_BURST */
+#define FEAT_SACK       (1 << 5) /* only failed burst blocks of a reply get sent again, needs FEAT_BURST */
+#define FEAT_FEC        (1 << 6) /* burst blocks to the GBA carry check words it can fix bit errors with, needs FEAT_BURST */
+#define FEAT_ZERO       (1 << 7) /* MEM_READs of memory that's never been written come back as no data at all */
+
+/*
+ * burst mode framing, per block:
+ *   CLASS_MEM | MEM_READ | id | (block << DATA_SHIFT)   header
+ *   up to BURST_BLOCK_WORDS data words
+ *   CLASS_SYS | SYS_MW_TX_DONE | id | (crc16 << DATA_SHIFT)   trailer
+ *
+ * The GBA answers every block with a cumulative SYS_ACK carrying the next
+ * block it wants.  If a block fails, it sets BURST_ACK_RETRY and bumps the
+ * sequence number so the host can tell a fresh retry request from a stale one.
+ * The host never has more than BURST_WINDOW blocks in flight.
+ *
+ * With FEAT_SACK, replies to the GBA (MEM_READ, BLK_READ, and the stats)
+ * go selective instead: the GBA keeps good blocks that arrive after a bad
+ * one, and a BURST_ACK_RETRY names the one block it's missing, the first
+ * one it doesn't have, which the host sends again on its own before it
+ * carries on where it was.  The GBA keeps repeating that retry, the same
+ * sequence number and all, in every ACK until the block turns up, so it
+ * doesn't matter which of them the host happens to see.  A block whose
+ * resend fails too gets a new sequence number.
+ *
+ * With FEAT_FEC, blocks to the GBA have FEC_WORDS check words between the
+ * data and the trailer, and the trailer's CRC is still of the data alone.
+ * Each bit position across a block is its own Hamming code: data word i
+ * goes into check word k for every bit k set in i + 1, and into the last
+ * check word regardless.  That lets the GBA put right one flipped bit in
+ * each bit position of a block, which is most of what a noisy cable does,
+ * without a round trip; the CRC catches anything it gets wrong.
+ */
+#define BURST_BLOCK_WORDS (32)
+#define BURST_WINDOW      (4)
+
+#define BURST_ACK_BLK     (0x0fff)
+/* so no reply, tagged or not, can be longer than this, or its last blocks could never be ACKed */
+#define BURST_MAX_WORDS   (BURST_ACK_BLK * BURST_BLOCK_WORDS)
+#define BURST_ACK_SEQ_SHIFT (12)
+#define BURST_ACK_SEQ     (3 << BURST_ACK_SEQ_SHIFT)
+#define BURST_ACK_RETRY   (0x8000)
+#define BURST_ACK_BAD     (0x4000) /* tagged mode: request refused */
+
+#define FEC_WORDS         (7) /* enough for i + 1 up to BURST_BLOCK_WORDS, and the overall parity */
+
+/* add data word i of a block, as it goes over the wire, to its check words */
+static inline void fec_add(u32 *fec, u32 i, u32 word) {
+	u32 k;
+
+	i++;
+	for (k = 0; k < FEC_WORDS - 1; k++) {
+		if (i & (1 << k))
+			fec[k] ^= word;
+	}
+	fec[FEC_WORDS - 1] ^= word;
+}
+
+/*
+ * tagged mode, every packet carries the request's id in PKT_CMD_ID:
+ *   GBA: MEM_READ or MEM_WRITE | id | (2 << DATA_SHIFT), addr, length in
+ *        words, SYS_MW_TX_DONE | id | crc16 of both
+ *   host: SYS_ACK | id, data 0 to go ahead, BURST_ACK_RETRY to send the
+ *         request again, or BURST_ACK_BAD if it's outside guest memory
+ *
+ * Read data then comes back in burst mode blocks, tagged with the id, and
+ * the GBA ACKs it per id just like burst mode.  Write data goes the other
+ * way in the same sort of blocks, with CLASS_MEM | MEM_DATA | id | block
+ * for a header, and the host ACKs those.  Blocks and requests never get
+ * split up on the wire, but blocks of different requests interleave, and
+ * requests finish in whatever order they finish.
+ */
+
+/*
+ * LZ77 replies.  A MEM_READ with READ_LZ_OK in its data field says the GBA
+ * has room to take this one compressed.  If the host finds it worth doing,
+ * the ACK that accepts the request (the second one without FEAT_TAGGED)
+ * carries READ_ACK_LZ plus the compressed length in words instead of 0, and
+ * that many words come back in burst blocks in place of the data:
+ *   crc16 of the data as it would have been sent raw
+ *   the data, in the format the BIOS LZ77UnCompWram SWI takes
+ *
+ * The block CRCs cover what's on the wire; the first word lets the GBA
+ * check what it unpacked.  Anything that doesn't get smaller, or doesn't
+ * fit in LZ_MAX_WORDS, goes raw as usual.
+ */
+#define READ_LZ_OK        (0x8000)
+#define READ_ACK_LZ       (0x2000)
+#define READ_ACK_LZ_WORDS (0x1fff)
+#define LZ_MAX_WORDS      (1024)
+
+/*
+ * Zero runs (FEAT_ZERO).  When nothing's ever been written to any of what a
+ * MEM_READ or BLK_READ asks for, the ACK that accepts it carries
+ * READ_ACK_ZERO instead of 0, and that's the whole reply: no data, blocks
+ * or trailer follow, and the GBA fills the buffer with zeroes itself.  The
+ * host only keeps track of that a page at a time, so it's mostly the
+ * kernel's BSS and memory it's only just got round to using.
+ */
+#define READ_ACK_ZERO     (0x1000)
+
+/*
+ * Two-stage boot.  The host multiboots a small stub through the BIOS, and
+ * the stub takes the real loader over the link:
+ *   host: CLASS_SYS | SYS_LOADER | 0 << DATA_SHIFT
+ *         stub ACKs
+ *   host: size in bytes unpacked, words to follow, SYS_MW_TX_DONE | crc16
+ *         of both
+ *         stub ACKs with 0, or BURST_ACK_RETRY to start over
+ *   host: the words, laid out like an LZ77 reply, in burst mode blocks
+ *         stub ACKs with 0 as it jumps to the loader, BURST_ACK_RETRY if
+ *         it won't unpack to the promised size, or BURST_ACK_BAD if it
+ *         unpacked but failed its CRC, in which case the GBA has to be
+ *         power cycled
+ *
+ * The words get put at the top of EWRAM, clear of the stub, which then
+ * unpacks them to the start of EWRAM and jumps in at 0x020000C0 the same
+ * way the BIOS would have.  So the host has to make sure the stub and what
+ * it sends fit in LOADER_MAX_BYTES together, and that the unpacked loader
+ * doesn't run into the data it's unpacked from.  A loader that doesn't
+ * compress is better off going through the BIOS on its own.
+ */
+#define LOADER_MAX_BYTES  (256 * 1024)
+
+/*
+ * Kernel entry point and disk.  The host sends
+ *   CLASS_SYS | SYS_KERNEL_LOAD | (KERNEL_LOAD_* flags << DATA_SHIFT)
+ *   physical entry point, for KERNEL_LOAD_ENTRY
+ *   size of the disk in sectors, for KERNEL_LOAD_DISK
+ *   core state, for KERNEL_LOAD_RESUME (see PING_SAVE)
+ *   session id, for KERNEL_LOAD_SESSION (see PING_SESSION)
+ *   CLASS_SYS | SYS_MW_TX_DONE | (crc16 of those words << DATA_SHIFT)
+ * and the GBA ACKs with 0, or BURST_ACK_RETRY to have it sent again.  A
+ * plain SYS_KERNEL_LOAD is a raw image, entered at its first byte, and no
+ * disk.  Either way, guest memory starts at GUEST_RAM_BASE in the guest's
+ * physical map.
+ */
+#define KERNEL_LOAD_ENTRY (1 << 0) /* an ELF kernel, entered somewhere else */
+#define KERNEL_LOAD_DISK  (1 << 1) /* there's a disk to go with it */
+#define KERNEL_LOAD_RESUME (1 << 2) /* guest memory's from a checkpoint, and here's the core to go with it */
+#define KERNEL_LOAD_SESSION (1 << 3) /* the session id, see PING_SESSION */
+#define GUEST_RAM_BASE    (0x80000000)
+
+/*
+ * Virtual disk.  BLK_READ and BLK_WRITE go exactly like MEM_READ and
+ * MEM_WRITE in whatever mode was negotiated, tagged, compressed and all,
+ * just with CLASS_BLK and the first sector and number of sectors in place
+ * of addr and length.  Data comes back (or goes out) in words the same as
+ * guest memory would, BLK_SECTOR_WORDS per sector, and the host refuses
+ * anything past the end of the disk, or more than BLK_MAX_SECTORS at once:
+ * BURST_ACK_BAD when tagged, WRITE_ACK_BAD for a write, and READ_ACK_BAD
+ * in place of the second ACK for a read, the same as for a MEM_READ outside
+ * guest memory.  There's no read-ahead for it.
+ */
+#define BLK_SECTOR_SIZE   (512)
+#define BLK_SECTOR_WORDS  (BLK_SECTOR_SIZE / 4)
+#define BLK_MAX_SECTORS   (8)
+#define READ_ACK_BAD      (0x4000)
+
+/*
+ * Link stats.  Once the kernel's loaded, with nothing else going on, the GBA
+ * can send
+ *   CLASS_SYS | SYS_PING | (PING_STATS << DATA_SHIFT)
+ * and the host answers with
+ *   CLASS_SYS | SYS_PING_REPLY | (STATS_WORDS << DATA_SHIFT)
+ * then its struct linkStats (stats.h) a u32 at a time, in burst mode blocks
+ * with FEAT_BURST, or followed by SYS_MW_TX_DONE | crc16 like a paced
+ * MEM_READ without.  A plain SYS_PING just gets a plain SYS_PING_REPLY.
+ */
+#define PING_STATS        (1)
+
+/*
+ * Paced transfers (FEAT_PACE).  Without FEAT_BURST, nothing tells the host
+ * the GBA has picked up a word before it sends the next, so it has to leave
+ * a gap between them, and a word sent too soon overwrites the last one.
+ * Rather than guess at the gap, once features are agreed the host sends
+ * probes at whatever gap it wants to try:
+ *   CLASS_SYS | SYS_PING | ((PING_PROBE | seq << 8) << DATA_SHIFT)
+ *   PROBE_WORDS words, none of which pass crcValid()
+ *   CLASS_SYS | SYS_MW_TX_DONE | (crc16 of them << DATA_SHIFT)
+ * and the GBA answers with SYS_ACK and seq, plus BURST_ACK_RETRY unless it
+ * got every word exactly once.  The host settles on the shortest gap that
+ * works, and from then on backs off whenever a MEM_READ comes in with
+ * READ_RETRY (the GBA's last go at it lost or mangled the data), creeping
+ * back down while they keep coming in clean.
+ */
+#define PING_PROBE        (2)
+#define PROBE_WORDS       (64)
+#define READ_RETRY        (0x4000)
+
+/*
+ * Checkpoints.  Once the kernel's running, the GBA can have the host save
+ * guest memory to the SD card, along with its core's state (registers and
+ * CSRs, laid out however the core likes), so the next boot can pick up
+ * from there:
+ *   CLASS_SYS | SYS_PING | ((PING_SAVE | words << 8) << DATA_SHIFT)
+ *                                                   host ACKs with 0
+ *   words words of core state, no more than SAVE_MAX_WORDS
+ *   CLASS_SYS | SYS_MW_TX_DONE | (crc16 of them << DATA_SHIFT)
+ * going a word at a time like MEM_WRITE data, and the host ACKs with one
+ * of the WRITE_ACK_* codes once it's saved it, or hasn't.  The GBA has to
+ * have written back anything it's holding on to, and have nothing in
+ * flight, first.
+ *
+ * When there's a checkpoint for the kernel it's about to load, the host
+ * puts it back before SYS_KERNEL_LOAD, which then has KERNEL_LOAD_RESUME
+ * set, and after the other words the number of words of core state, then
+ * the words themselves, all in the CRC.  The core carries on with those
+ * instead of booting the kernel.
+ */
+#define PING_SAVE         (3)
+#define SAVE_MAX_WORDS    (128)
+
+/*
+ * Sessions.  SYS_KERNEL_LOAD hands the GBA a session id, with
+ * KERNEL_LOAD_SESSION, and from then on the GBA keeps JSTAT_SESSION set in
+ * its JOY status, so the host can tell a GBA that's still running the
+ * loader from one the BIOS is waiting to multiboot.
+ *
+ * If the cable comes out, the host drops whatever the GBA had in flight
+ * and waits for it to come back, keeping its guest memory.  When it does,
+ * the host looks at its status before doing anything else, and if the
+ * flag's up, waits for the GBA to rejoin rather than multibooting it.  The
+ * GBA, once the host's said nothing at all for long enough while it was
+ * waiting on it, sends
+ *   CLASS_SYS | SYS_PING | (PING_SESSION << DATA_SHIFT)    host ACKs with 0
+ *   its session id
+ *   CLASS_SYS | SYS_MW_TX_DONE | (crc16 of it << DATA_SHIFT)
+ * and the host ACKs with WRITE_ACK_OK if it still has guest memory for
+ * that session, WRITE_ACK_BAD if it doesn't (it was restarted, or it's
+ * somebody else's GBA), or WRITE_ACK_RETRY for a bad CRC.  After an OK,
+ * nothing is in flight on either side, and the GBA sends again whatever
+ * it was waiting on.  It can do this any time the host goes quiet on it,
+ * whether or not the host noticed anything was wrong.
+ */
+#define PING_SESSION      (4)
+#define JSTAT_SESSION     (0x20) /* a general purpose flag; the BIOS uses the other one */
+
+/*
+ * MEM_WRITE framing, GBA -> host:
+ *   CLASS_MEM | MEM_WRITE | id | (2 << DATA_SHIFT)              host ACKs
+ *   addr, length in words, SYS_MW_TX_DONE with crc16 of both    host ACKs
+ *   length data words
+ *   CLASS_SYS | SYS_MW_TX_DONE | id | (crc16 << DATA_SHIFT)     host ACKs
+ *
+ * The GBA waits for the host to pick up each word before writing the next,
+ * and the host goes by the JOY status to tell new words from ones it already
+ * read, so nothing is lost or doubled and there's no need for pacing.  The
+ * data is staged on the host and only lands in guest memory once the CRC
+ * checks out.  The second and third ACKs carry one of the WRITE_ACK_* codes.
+ */
+#define WRITE_MAX_WORDS   (1024)
+
+#define WRITE_ACK_OK      (0)
+#define WRITE_ACK_RETRY   (1) /* CRC mismatch, send it again */
+#define WRITE_ACK_BAD     (2) /* outside guest memory or too long, don't bother */
+
+/*
+ * read-ahead pushes, host -> GBA, whenever the link would otherwise be idle:
+ *   CLASS_MEM | MEM_PUSH | id | (words << DATA_SHIFT)
+ *   addr
+ *   words data words
+ *   CLASS_SYS | SYS_MW_TX_DONE | id | (crc16 of addr and data << DATA_SHIFT)
+ *
+ * The host only sends each word once the GBA has read the last one, and
+ * drops the push as soon as the GBA has something to say, so the GBA can
+ * pick them up whenever it gets around to it.  The GBA talks back with
+ * CLASS_MEM | MEM_PUSH too: either PUSH_CANCEL plus the most words it can
+ * take, to stop the push in progress, or how many pushes it has used since
+ * it last said.  PUSH_WAIT on the latter means the GBA is now sitting there
+ * waiting for the rest of the current push, so it can go out back to back.
+ */
+#define PUSH_CANCEL       (0x8000)
+#define PUSH_WAIT         (0x4000)
+#define PUSH_COUNT        (0x3fff)
+
+/*
+ * CRC lookup tables, generated at compile time.
+ *
+ * Both CRCs are linear, so a table entry is the XOR of the entries for each
+ * of its set bits.  Those 8 single-bit entries per table come from running
+ * the bitwise algorithm in an enum, where each constant builds on the last
+ * one by name rather than having the preprocessor re-expand it.
+ */
+#define CRC16_POLY      (0x1021)
+#define CRC16_INIT      (0xffff)
+#define CRC16_STEP(c)   ((((c) << 1) ^ (((c) & 0x8000) ? CRC16_POLY : 0)) & 0xffff)
+#define CRC16_STEP4(c)  CRC16_STEP(CRC16_STEP(CRC16_STEP(CRC16_STEP(c))))
+#define CRC16_STEP8(c)  CRC16_STEP4(CRC16_STEP4(c))
+
+#define CRC8_POLY       (0x07)
+#define CRC8_STEP(c)    ((((c) << 1) ^ (((c) & 0x80) ? CRC8_POLY : 0)) & 0xff)
+#define CRC8_STEP4(c)   CRC8_STEP(CRC8_STEP(CRC8_STEP(CRC8_STEP(c))))
+#define CRC8_STEP8(c)   CRC8_STEP4(CRC8_STEP4(c))
+
+/* CRC16_Bn_k: byte (1 << k) followed by n zero bytes, from a zero CRC */
+#define CRC16_BASIS(k) \
+	CRC16_B0_##k = CRC16_STEP8((1 << (k)) << 8), \
+	CRC16_B1_##k = CRC16_STEP8(CRC16_B0_##k), \
+	CRC16_B2_##k = CRC16_STEP8(CRC16_B1_##k), \
+	CRC16_B3_##k = CRC16_STEP8(CRC16_B2_##k)
+#define CRC8_BASIS(k) \
+	CRC8_B_##k = CRC8_STEP8(1 << (k))
+
+enum {
+	CRC16_BASIS(0), CRC16_BASIS(1), CRC16_BASIS(2), CRC16_BASIS(3),
+	CRC16_BASIS(4), CRC16_BASIS(5), CRC16_BASIS(6), CRC16_BASIS(7),
+	CRC8_BASIS(0),  CRC8_BASIS(1),  CRC8_BASIS(2),  CRC8_BASIS(3),
+	CRC8_BASIS(4),  CRC8_BASIS(5),  CRC8_BASIS(6),  CRC8_BASIS(7)
+};
+
+#define CRC_BIT(i, k, b) (((i) & (1 << (k))) ? (b) : 0)
+#define CRC16_ENTRY(n, i) ( \
+	CRC_BIT(i, 0, CRC16_B##n##_0) ^ CRC_BIT(i, 1, CRC16_B##n##_1) ^ \
+	CRC_BIT(i, 2, CRC16_B##n##_2) ^ CRC_BIT(i, 3, CRC16_B##n##_3) ^ \
+	CRC_BIT(i, 4, CRC16_B##n##_4) ^ CRC_BIT(i, 5, CRC16_B##n##_5) ^ \
+	CRC_BIT(i, 6, CRC16_B##n##_6) ^ CRC_BIT(i, 7, CRC16_B##n##_7))
+#define CRC8_ENTRY(n, i) ( \
+	CRC_BIT(i, 0, CRC8_B_0) ^ CRC_BIT(i, 1, CRC8_B_1) ^ \
+	CRC_BIT(i, 2, CRC8_B_2) ^ CRC_BIT(i, 3, CRC8_B_3) ^ \
+	CRC_BIT(i, 4, CRC8_B_4) ^ CRC_BIT(i, 5, CRC8_B_5) ^ \
+	CRC_BIT(i, 6, CRC8_B_6) ^ CRC_BIT(i, 7, CRC8_B_7))
+
+#define CRC_ROW4(f, n, i)   f(n, (i)), f(n, (i) + 1), f(n, (i) + 2), f(n, (i) + 3)
+#define CRC_ROW16(f, n, i)  CRC_ROW4(f, n, (i)),  CRC_ROW4(f, n, (i) + 4), \
+			    CRC_ROW4(f, n, (i) + 8),  CRC_ROW4(f, n, (i) + 12)
+#define CRC_ROW64(f, n, i)  CRC_ROW16(f, n, (i)), CRC_ROW16(f, n, (i) + 16), \
+			    CRC_ROW16(f, n, (i) + 32), CRC_ROW16(f, n, (i) + 48)
+#define CRC_ROW256(f, n, i) CRC_ROW64(f, n, (i)), CRC_ROW64(f, n, (i) + 64), \
+			    CRC_ROW64(f, n, (i) + 128), CRC_ROW64(f, n, (i) + 192)
+
+/* [0] is the plain byte-wise table, [1]-[3] are for slice-by-4 */
+static const u16 crc16_table[4][256] = {
+	{ CRC_ROW256(CRC16_ENTRY, 0, 0) },
+	{ CRC_ROW256(CRC16_ENTRY, 1, 0) },
+	{ CRC_ROW256(CRC16_ENTRY, 2, 0) },
+	{ CRC_ROW256(CRC16_ENTRY, 3, 0) }
+};
+
+static const u8 crc8_table[256] = {
+	CRC_ROW256(CRC8_ENTRY, 0, 0)
+};
+
+/* CRC-8 (polynomial 0x07), initial 0x00 */
 static inline u8 calc_crc8(const u8 *data, int len) {
-	int i, j;
 	u8 crc = 0;
-	for (i = 0; i < len; ++i) {
-		crc ^= data[i];
-		for (j = 0; j < 8; ++j) {
-			crc = (crc & 0x80) ?
-				(u8)((crc << 1) ^ 0x07) :
-				(u8)(crc << 1);
-		}
-	}
+	while (len--)
+		crc = crc8_table[crc ^ *data++];
 	return crc;
 }
 
+/* CRC-16 CCITT (polynomial 0x1021), one byte */
+static inline u16 crc16_byte(u16 crc, u8 byte) {
+	return (crc << 8) ^ crc16_table[0][(crc >> 8) ^ byte];
+}
+
+/*
+ * CRC-16 CCITT, one word as it goes over the wire (most significant byte
+ * first, same as guest memory), slice-by-4.  Start from CRC16_INIT.
+ */
+static inline u16 crc16_update(u16 crc, u32 word) {
+	crc ^= word >> 16;
+	return crc16_table[3][crc >> 8]            ^
+	       crc16_table[2][crc & 0xff]          ^
+	       crc16_table[1][(word >> 8) & 0xff] ^
+	       crc16_table[0][word & 0xff];
+}
+
 /* CRC-16 CCITT (polynomial 0x1021), initial 0xffff */
 static inline u16 calc_crc16(const u8 *data, int len) {
-	u16 crc = 0xffff, a;
-	int i;
-	while (len--) {
-		a = ((u16)*data++) << 8;
-		//printf("crc16ing: 0x%04x (len = %d)\n", a, len);
-		crc ^= a;
-		for (i = 0; i < 8; ++i) {
-			if (crc & 0x8000)
-				crc = (crc << 1) ^ 0x1021;
-			else
-				crc <<= 1;
-		}
+	u16 crc = CRC16_INIT;
+
+	/* whole words at a time when we can */
+	if (!((unsigned long)data & 3)) {
+		for (; len >= 4; len -= 4, data += 4)
+			crc = crc16_update(crc, ntohl(*(const u32 *)data));
 	}
+
+	for (; len > 0; len--)
+		crc = crc16_byte(crc, *data++);
 	return crc;
 }
 
-static inline u32 crc(u32 msg) {
-	u8 crc;
-	u32 tmpMsg;
-
-	tmpMsg = msg & ~PKT_CRC8;
-	/* enforce BE order so that calc_crc8 doesn't explode */
-	tmpMsg = htonl(tmpMsg);
-
-	crc = calc_crc8((u8 *)&tmpMsg, 3); /* CRC-8 over the first 24 bits */
-	msg |= (crc << CRC8_SHIFT);
+/*
+ * CRC-8 of a packet header, without going through memory.  This covers the
+ * same bytes as calc_crc8() over the first 3 bytes of the BE packet always
+ * has: the (zeroed) CRC byte, then data bits 15-8 and 7-0.
+ */
+static inline u8 crc8_hdr(u32 msg) {
+	/* leading zero byte leaves the CRC at 0 */
+	return crc8_table[crc8_table[(msg >> 16) & 0xff] ^ ((msg >> 8) & 0xff)];
+}
 
-	return msg;
+static inline u32 crc(u32 msg) {
+	msg &= ~PKT_CRC8;
+	return msg | (crc8_hdr(msg) << CRC8_SHIFT);
 }
 
 static inline bool crcValid(u32 msg) {
 	u8 calcCrc, readCrc;
-	u32 tmpMsg;
 
 	readCrc = (msg & PKT_CRC8) >> CRC8_SHIFT;
-	tmpMsg = msg & ~PKT_CRC8; /* mask out the read CRC, just in case */
-	/* enforce BE order so that calc_crc8 doesn't explode */
-	tmpMsg = htonl(tmpMsg);
-
-	calcCrc = calc_crc8((u8 *)&tmpMsg, 3); /* CRC-8 over the first 24 bits */
+	calcCrc = crc8_hdr(msg & ~PKT_CRC8); /* mask out the read CRC, just in case */
 
 #if 0
 	if (calcCrc != readCrc)
@@ -137,6 +517,4 @@ static inline bool crcValid(u32 msg) {
 	return calcCrc == readCrc;
 }
 
-
-
 #endif /* _COMMS_H */
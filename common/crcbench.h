@@ -0,0 +1,84 @@
+/*
+ * GBA Linux Loader - Common - CRC microbenchmark
+ *
+ * Build either loader with CRC_BENCH=1 to run this at startup.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+#ifndef _CRCBENCH_H
+#define _CRCBENCH_H
+
+#include "comms.h"
+
+#define CRC_BENCH_BYTES (4096)
+
+/* what calc_crc16() used to be, to compare against */
+static u16 crc16_bitwise(const u8 *data, int len) {
+	u16 crc = CRC16_INIT;
+	int i;
+	while (len--) {
+		crc ^= ((u16)*data++) << 8;
+		for (i = 0; i < 8; ++i) {
+			if (crc & 0x8000)
+				crc = (crc << 1) ^ CRC16_POLY;
+			else
+				crc <<= 1;
+		}
+	}
+	return crc;
+}
+
+static u16 crc16_bytewise(const u8 *data, int len) {
+	u16 crc = CRC16_INIT;
+	while (len--)
+		crc = crc16_byte(crc, *data++);
+	return crc;
+}
+
+/* the way the link loops use it, one wire word at a time */
+static u16 crc16_words(const u32 *data, int len) {
+	u16 crc = CRC16_INIT;
+	for (; len >= 4; len -= 4)
+		crc = crc16_update(crc, ntohl(*data++));
+	return crc;
+}
+
+/*
+ * Time each CRC-16 engine over the same buffer.  `cycles' returns a running
+ * CPU cycle count, it only has to be good for differences.
+ */
+static void crc_bench(u32 (*cycles)(void)) {
+	static u32 buf[CRC_BENCH_BYTES / sizeof(u32)];
+	static const char *names[] = { "bitwise", "byte table", "slice-by-4", "word update" };
+	u32 i, start, took, base = 0;
+	u16 res = 0;
+	int eng;
+
+	for (i = 0; i < CRC_BENCH_BYTES / sizeof(u32); i++)
+		buf[i] = i * 0x9e3779b9;
+
+	printf("CRC-16 over %d bytes:\n", CRC_BENCH_BYTES);
+	for (eng = 0; eng < 4; eng++) {
+		start = cycles();
+		switch (eng) {
+		case 0: res = crc16_bitwise((u8 *)buf, CRC_BENCH_BYTES); break;
+		case 1: res = crc16_bytewise((u8 *)buf, CRC_BENCH_BYTES); break;
+		case 2: res = calc_crc16((u8 *)buf, CRC_BENCH_BYTES); break;
+		case 3: res = crc16_words(buf, CRC_BENCH_BYTES); break;
+		}
+		took = cycles() - start;
+		if (!took)
+			took = 1;
+		if (!eng)
+			base = took;
+
+		/* bytes per 1000 cycles, and speedup over bitwise in hundredths */
+		printf("  %-11s %8lu cycles, %5lu B/kcycle, %3lu.%02lux (0x%04x)\n",
+		       names[eng], (unsigned long)took,
+		       (unsigned long)((CRC_BENCH_BYTES * 1000ULL) / took),
+		       (unsigned long)(base / took),
+		       (unsigned long)(((base * 100ULL) / took) % 100), res);
+	}
+}
+
+#endif /* _CRCBENCH_H */
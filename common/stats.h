@@ -0,0 +1,97 @@
+/*
+ * GBA Linux Loader - Common - Link statistics
+ *
+ * Both sides keep one of these: the GBA counts what it asks for and how
+ * long it waits, the host what it gets and how long it takes.  The GBA can
+ * ask for the host's with SYS_PING (see comms.h), and the host prints its
+ * own on a button press.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include "comms.h"
+
+/* latency histograms, one per kind of request */
+enum {
+	LAT_MEM_READ,
+	LAT_MEM_WRITE,
+	LAT_BLK_READ,
+	LAT_BLK_WRITE,
+	LAT_KINDS
+};
+
+/* bucket n is [2^n, 2^(n+1)) microseconds, the last one goes on forever */
+#define LAT_BUCKETS (20)
+
+struct linkStats {
+	u32 reqs[8][8];   /* requests by class and subcmd, retries and all */
+	u32 bytesRead;    /* MEM_READ and BLK_READ data that made it, unpacked */
+	u32 bytesWritten; /* same for writes */
+	u32 crcFails;     /* packets, blocks and requests that didn't check out */
+	u32 retries;      /* times something had to go again */
+	u32 lat[LAT_KINDS][LAT_BUCKETS];
+};
+
+#define STATS_WORDS (sizeof(struct linkStats) / sizeof(u32))
+
+#if defined(HW_RVL) || defined(HW_DOL)
+/* the host's, for the GBA on each SI channel */
+extern struct linkStats C_Stats[C_MAX_GBAS];
+#endif
+
+static inline void stats_req(struct linkStats *s, u32 cmd) {
+	s->reqs[(cmd & PKT_CLASS) >> CLASS_SHIFT][(cmd & PKT_SUBCMD) >> SUBCMD_SHIFT]++;
+}
+
+static inline int stats_kind(u32 cls, bool write) {
+	return ((cls == CLASS_BLK) ? LAT_BLK_READ : LAT_MEM_READ) + (write ? 1 : 0);
+}
+
+static inline void stats_latency(struct linkStats *s, int kind, u32 us) {
+	int n = 0;
+
+	while (us > 1 && n < LAT_BUCKETS - 1) {
+		us >>= 1;
+		n++;
+	}
+	s->lat[kind][n]++;
+}
+
+/* one more request through, `bytes' of it and `us' from start to finish */
+static inline void stats_done(struct linkStats *s, u32 cls, bool write, u32 bytes, u32 us) {
+	if (write)
+		s->bytesWritten += bytes;
+	else
+		s->bytesRead += bytes;
+	stats_latency(s, stats_kind(cls, write), us);
+}
+
+/* everything that isn't zero */
+static inline void stats_dump(const struct linkStats *s, const char *who) {
+	static const char *classes[8] = { "SYS", "MEM", "BLK" };
+	static const char *kinds[LAT_KINDS] = { "MEM_READ", "MEM_WRITE", "BLK_READ", "BLK_WRITE" };
+	int c, n, k;
+
+	printf("%s link stats: %lu bytes read, %lu written, %lu CRC failures, %lu retries\n", who,
+	       (unsigned long)s->bytesRead, (unsigned long)s->bytesWritten,
+	       (unsigned long)s->crcFails, (unsigned long)s->retries);
+
+	for (c = 0; c < 8; c++) {
+		for (n = 0; n < 8; n++) {
+			if (s->reqs[c][n])
+				printf("  %s %d: %lu requests\n", classes[c] ? classes[c] : "?", n, (unsigned long)s->reqs[c][n]);
+		}
+	}
+
+	for (k = 0; k < LAT_KINDS; k++) {
+		for (n = 0; n < LAT_BUCKETS; n++) {
+			if (s->lat[k][n])
+				printf("  %-9s %7luus+: %lu\n", kinds[k], n ? 1UL << n : 0UL, (unsigned long)s->lat[k][n]);
+		}
+	}
+}
+
+#endif /* _STATS_H */
@@ -0,0 +1,88 @@
+/*
+ * GBA Linux Loader - Common - Protocol tracing
+ *
+ * Instead of printing every step of every request, both sides drop a
+ * 16-byte record into a ring: a timestamp, what happened, which packet it
+ * was about, and two words of whatever else.  That's a handful of stores,
+ * where a line on the GBA's console costs more than some transfers do.
+ *
+ * The ring is plain memory behind a small header, so it can be pulled out of
+ * a memory dump as well as written out to a file.  sim/tracedump.c turns it
+ * (from either end, in either byte order) back into a timeline.
+ *
+ * TRACE_LEVEL picks what gets recorded at build time, anything above it
+ * compiles away:
+ *   0  nothing
+ *   1  things going wrong: bad packets, retries, refusals
+ *   2  and every request coming and going (the default)
+ *   3  and each step along the way
+ *
+ * Copyright (C) 2025 Techflash
+ */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "comms.h"
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL (2)
+#endif
+
+#define TR_ERR  (1)
+#define TR_REQ  (2)
+#define TR_STEP (3)
+
+/*
+ * What happened.  `pkt' is the low byte of the packet it's about (class,
+ * subcmd and id), and a and b are as below.
+ */
+enum {
+	TR_NONE,
+	TR_SEND,    /* we asked for it;   a: addr or sector, b: words or sectors */
+	TR_RECV,    /* they asked for it; a: addr or sector, b: words or sectors */
+	TR_ACK,     /* a: the ACK's data */
+	TR_DATA,    /* data on its way;   a: words, b: compressed words, or 0 */
+	TR_DONE,    /* a: bytes, b: microseconds from start to finish */
+	TR_REFUSED, /* a: addr or sector, b: words or sectors */
+	TR_BAD,     /* a packet or CRC that didn't check out; a: what we got, b: what we wanted */
+	TR_RETRY,   /* going again; a: from this block, or 0 */
+	TR_FETCH,   /* going to the host for it; a: addr, b: bytes */
+	TR_STORE,   /* a: addr, b: bytes */
+	TR_PUSH,    /* read-ahead;        a: addr, b: words */
+	TR_PING,    /* a: the ping's data */
+	TR_PACE,    /* paced word gap changed; a: new gap in us, b: the calibrated one */
+	TR_EVENTS
+};
+
+struct traceRec {
+	u32 time;   /* in the ring's ticks */
+	u16 event;
+	u16 pkt;
+	u32 a, b;
+};
+
+#define TRACE_MAGIC (0x54524331) /* "TRC1" */
+#define TRACE_HOST  (0)
+#define TRACE_GBA   (1)
+
+/* in front of the records, in the writer's byte order */
+struct traceHdr {
+	u32 magic;
+	u32 side;
+	u32 tickHz;
+	u32 size; /* records, a power of two */
+	u32 head; /* records ever written, the next one goes at head % size */
+};
+
+static inline void trace_put(struct traceHdr *h, struct traceRec *rec, u32 mask,
+                             u32 time, u32 event, u32 pkt, u32 a, u32 b) {
+	struct traceRec *r = &rec[h->head++ & mask];
+
+	r->time = time;
+	r->event = event;
+	r->pkt = pkt & 0xff;
+	r->a = a;
+	r->b = b;
+}
+
+#endif /* _TRACE_H */
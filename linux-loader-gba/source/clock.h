@@ -0,0 +1,54 @@
+/*
+ * GBA Linux Loader - GBA Side - Clock
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include <gba_types.h>
+
+#ifdef HW_SIM
+/* provided by the link simulator, which counts in microseconds */
+#define K_TICK_HZ (1000000)
+static inline void K_Init(void) { }
+extern u32 K_Micros(void);
+static inline u32 K_Ticks(void) { return K_Micros(); }
+#else
+#include <gba_timers.h>
+
+/*
+ * Timers 0+1 cascaded, at the CPU clock / 64: 2^18 ticks a second, so it
+ * only wraps every few hours.  (2 and 3 are CRC_BENCH's.)
+ */
+static inline void K_Init(void) {
+	REG_TM0CNT_H = 0;
+	REG_TM1CNT_H = 0;
+	REG_TM0CNT_L = 0;
+	REG_TM1CNT_L = 0;
+	REG_TM1CNT_H = TIMER_START | TIMER_COUNT;
+	REG_TM0CNT_H = TIMER_START | 1 /* CPU clock / 64 */;
+}
+
+#define K_TICK_HZ (1 << 18)
+
+/* ticks since K_Init(), for when a few cycles matter more than the units */
+static inline u32 K_Ticks(void) {
+	u16 hi, lo;
+
+	do {
+		hi = REG_TM1CNT_L;
+		lo = REG_TM0CNT_L;
+	} while (hi != REG_TM1CNT_L);
+
+	return (hi << 16) | lo;
+}
+
+/* microseconds since K_Init(), only good for differences; wraps every 71 minutes or so */
+static inline u32 K_Micros(void) {
+	return (u64)K_Ticks() * 15625 / 4096;
+}
+#endif /* HW_SIM */
+
+#endif /* _CLOCK_H */
@@ -0,0 +1 @@
+../../common/crcbench.h
\ No newline at end of file
@@ -7,131 +7,998 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <gba_sio.h>
 #include <gba_types.h>
+#include <gba_systemcalls.h>
 #include "comms.h"
+#include "joy.h"
+#include "host.h"
+#include "pagecache.h"
+#include "readahead.h"
 
-void H_ReadMemBuf(void *buf, u32 addr, int len) {
-	u32 tmp[2], rx;
+/* features negotiated with the host during the handshake */
+u32 H_Features = 0;
+
+/* raw images start at their first byte */
+u32 H_KernelEntry = GUEST_RAM_BASE;
+
+/* no disk unless the host says so */
+u32 H_DiskSectors = 0;
+
+/* a fresh boot unless the host put a checkpoint back */
+u32 H_ResumeWords = 0;
+u32 H_ResumeCore[SAVE_MAX_WORDS];
+
+/* none until the host hands us one */
+u32 H_Session = 0;
+
+/* ours, the host keeps its own */
+struct linkStats H_Stats;
+
+struct _hTrace H_Trace EWRAM_BSS;
+
+void H_InitTrace(void) {
+	H_Trace.hdr.magic = TRACE_MAGIC;
+	H_Trace.hdr.side = TRACE_GBA;
+	H_Trace.hdr.tickHz = K_TICK_HZ;
+	H_Trace.hdr.size = H_TRACE_RECS;
+	H_Trace.hdr.head = 0;
+}
+
+/*
+ * How long a paced reply can go quiet before we give up on it.  A word the
+ * host sent too soon after the last one takes that one's place, and then
+ * we'd sit there waiting on a word that's never coming.
+ */
+#define H_PACED_TIMEOUT_US (50000)
+
+/*
+ * And how long a command's ACK or reply can take to get past whatever the
+ * host pushed at us before it saw the command, all of which the serial IRQ
+ * has queued up ahead of it.
+ */
+#define H_REPLY_TIMEOUT_US (4 * H_PACED_TIMEOUT_US)
+
+/* J_Recv() for paced replies and command ACKs, false if the host went quiet on us */
+static bool recvPaced(u32 *rx) {
+	u32 start = K_Micros();
+
+	while (!J_RxReady()) {
+		if (K_Micros() - start > H_PACED_TIMEOUT_US)
+			return false;
+	}
+	*rx = J_Read();
+	return true;
+}
+
+/* compressed replies land here before they're unpacked */
+u32 H_LzBuf[LZ_MAX_WORDS] EWRAM_BSS;
+
+/* unpack H_LzBuf into the `words' words at buf, false if it doesn't check out */
+bool H_Unpack(void *buf, u32 words) {
+	u32 *buf32 = buf, i;
+	u16 crcVal = CRC16_INIT;
+
+	/* it had better unpack to exactly what we asked for */
+	if (H_LzBuf[1] != (0x10 | ((words * 4) << 8)))
+		return false;
+
+	LZ77UnCompWram(&H_LzBuf[1], buf);
+
+	for (i = 0; i < words; i++)
+		crcVal = crc16_update(crcVal, __builtin_bswap32(buf32[i]));
+	return crcVal == (__builtin_bswap32(H_LzBuf[0]) & 0xffff);
+}
+
+void H_SackReset(struct _hSack *s) {
+	memset(s, 0, sizeof(*s));
+}
+
+bool H_SackWant(const struct _hSack *s, u32 blk) {
+	return blk >= s->acked && blk - s->acked < H_SACK_BLOCKS && !(s->have & (1 << (blk - s->acked)));
+}
+
+void H_SackGot(struct _hSack *s, u32 blk, bool good, u32 pkt) {
+	u32 bit;
+
+	if (blk < s->acked || blk - s->acked >= H_SACK_BLOCKS)
+		return;
+
+	bit = 1 << (blk - s->acked);
+	if (good) {
+		s->have |= bit;
+		s->bad &= ~bit;
+	}
+	else {
+		s->bad |= bit;
+		/* the resend of the one we asked for didn't make it either, ask again */
+		if (blk == s->acked)
+			s->nacked = false;
+	}
+
+	while (s->have & 1) {
+		s->have >>= 1;
+		s->bad >>= 1;
+		s->acked++;
+		s->nacked = false;
+	}
+
+	/* the first one we're missing went bad, or something after it came in without it */
+	if (!s->nacked && (s->have || (s->bad & 1))) {
+		H_Stats.retries++;
+		H_TRACE(TR_ERR, TR_RETRY, pkt, s->acked, 0);
+		s->seq = (s->seq + 1) & 3;
+		s->nacked = true;
+	}
+}
+
+u32 H_SackAck(const struct _hSack *s) {
+	if (s->nacked)
+		return BURST_ACK_RETRY | (s->seq << BURST_ACK_SEQ_SHIFT) | s->acked;
+	return s->acked;
+}
+
+u32 H_FecFixed;
+
+u16 H_FecFix(u32 *buf32, u32 n, const u32 *syn, u16 crcVal) {
+	u32 cols = syn[FEC_WORDS - 1], bit, j, k, i;
+	bool fixed = false;
+
+	/* a bit position with an odd number of flips in it, most likely just the one */
+	while (cols) {
+		bit = cols & -cols;
+		cols &= ~bit;
+
+		for (j = 0, k = 0; k < FEC_WORDS - 1; k++) {
+			if (syn[k] & bit)
+				j |= 1 << k;
+		}
+
+		/* 0 is the overall check word itself, past the end means it wasn't just the one */
+		if (j == 0 || j > n)
+			continue;
+		buf32[j - 1] ^= __builtin_bswap32(bit);
+		H_FecFixed++;
+		fixed = true;
+	}
+
+	if (!fixed)
+		return crcVal;
+
+	crcVal = CRC16_INIT;
+	for (i = 0; i < n; i++)
+		crcVal = crc16_update(crcVal, __builtin_bswap32(buf32[i]));
+	return crcVal;
+}
+
+/* a block's FEAT_FEC check words, after its data; fixes what it can if it's being kept */
+static u16 recvFec(u32 *buf32, u32 n, u32 *syn, u16 crcVal, bool keep) {
+	u32 i;
+
+	for (i = 0; i < FEC_WORDS; i++)
+		syn[i] ^= J_Recv();
+	return keep ? H_FecFix(buf32, n, syn, crcVal) : crcVal;
+}
+
+/*
+ * A burst mode reply with FEAT_SACK: blocks go wherever their number says,
+ * whatever order they come in, and only the ones that didn't make it get
+ * sent again.
+ */
+static void recvSack(u32 *buf32, u32 words) {
+	struct _hSack s;
+	u32 rx, blk, nblk, i, n, syn[FEC_WORDS];
+	u16 crcVal;
+	bool want, fec = (H_Features & FEAT_FEC) != 0;
+
+	nblk = (words + BURST_BLOCK_WORDS - 1) / BURST_BLOCK_WORDS;
+	H_SackReset(&s);
+
+	while (s.acked < nblk) {
+		/* block header */
+		rx = J_Recv();
+		blk = (rx & PKT_DATA) >> DATA_SHIFT;
+
+		if (!crcValid(rx)                         ||
+		   (rx & PKT_CLASS)  != CLASS_MEM         ||
+		   (rx & PKT_SUBCMD) != MEM_READ          ||
+		   (rx & PKT_CMD_ID) != 0                 ||
+		   blk >= nblk) {
+			/* no telling which block it was, most likely the next one we want */
+			H_SackGot(&s, s.acked, false, CLASS_MEM | MEM_READ);
+			J_SendLatest(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | (H_SackAck(&s) << DATA_SHIFT)));
+			continue;
+		}
+
+		/* one we already have still has to be read past */
+		want = H_SackWant(&s, blk);
+		n = words - (blk * BURST_BLOCK_WORDS);
+		if (n > BURST_BLOCK_WORDS)
+			n = BURST_BLOCK_WORDS;
+
+		crcVal = CRC16_INIT;
+		memset(syn, 0, sizeof(syn));
+		for (i = 0; i < n; i++) {
+			rx = J_Recv();
+			if (want)
+				buf32[(blk * BURST_BLOCK_WORDS) + i] = __builtin_bswap32(rx);
+			crcVal = crc16_update(crcVal, rx);
+			if (fec)
+				fec_add(syn, i, rx);
+		}
+		if (fec)
+			crcVal = recvFec(&buf32[blk * BURST_BLOCK_WORDS], n, syn, crcVal, want);
+
+		/* block trailer */
+		rx = J_Recv();
+
+		if (!crcValid(rx)                         ||
+		   (rx & PKT_CLASS)  != CLASS_SYS         ||
+		   (rx & PKT_SUBCMD) != SYS_MW_TX_DONE    ||
+		   (rx & PKT_CMD_ID) != 0                 ||
+		   ((rx & PKT_DATA) >> DATA_SHIFT) != crcVal) {
+			H_Stats.crcFails++;
+			H_TRACE(TR_ERR, TR_BAD, CLASS_MEM | MEM_READ, rx, crcVal);
+			if (want)
+				H_SackGot(&s, blk, false, CLASS_MEM | MEM_READ);
+		}
+		else if (want)
+			H_SackGot(&s, blk, true, CLASS_MEM | MEM_READ);
+
+		/* no need to wait, the host only wants the latest one */
+		J_SendLatest(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | (H_SackAck(&s) << DATA_SHIFT)));
+	}
+
+	/* make sure the host saw the final ACK, then idle the line */
+	J_Flush();
+	J_Send(0);
+}
+
+/*
+ * Receive a burst mode reply of `words' words into buf.
+ * Blocks that fail their CRC, or arrive out of order, get re-requested
+ * from the host; we never have to restart the whole read.
+ */
+static void recvBurst(u32 *buf32, u32 words) {
+	u32 rx, blk, nblk, i, n, seq, syn[FEC_WORDS];
+	u16 crcVal;
+	bool hunting, fec = (H_Features & FEAT_FEC) != 0;
+
+	if (H_Features & FEAT_SACK) {
+		recvSack(buf32, words);
+		return;
+	}
+
+	nblk = (words + BURST_BLOCK_WORDS - 1) / BURST_BLOCK_WORDS;
+	blk = 0;
+	seq = 0;
+	hunting = false;
+
+	while (blk < nblk) {
+		/* block header */
+		rx = J_Recv();
+
+		if (!crcValid(rx)                         ||
+		   (rx & PKT_CLASS)  != CLASS_MEM         ||
+		   (rx & PKT_SUBCMD) != MEM_READ          ||
+		   (rx & PKT_CMD_ID) != 0                 ||
+		   ((rx & PKT_DATA) >> DATA_SHIFT) != blk) {
+			/* only ask once, then keep quiet until the host rewinds */
+			if (!hunting) {
+				H_Stats.retries++;
+				H_TRACE(TR_ERR, TR_RETRY, CLASS_MEM | MEM_READ, blk, 0);
+				seq = (seq + 1) & 3;
+				/* in place of any ACK, or the last reply's idle word, the host hasn't picked up yet */
+				J_SendLatest(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | ((BURST_ACK_RETRY | (seq << BURST_ACK_SEQ_SHIFT) | blk) << DATA_SHIFT)));
+				hunting = true;
+			}
+			continue;
+		}
+		hunting = false;
+
+		n = words - (blk * BURST_BLOCK_WORDS);
+		if (n > BURST_BLOCK_WORDS)
+			n = BURST_BLOCK_WORDS;
+
+		crcVal = CRC16_INIT;
+		memset(syn, 0, sizeof(syn));
+		for (i = 0; i < n; i++) {
+			rx = J_Recv();
+			buf32[(blk * BURST_BLOCK_WORDS) + i] = __builtin_bswap32(rx);
+			crcVal = crc16_update(crcVal, rx);
+			if (fec)
+				fec_add(syn, i, rx);
+		}
+		if (fec)
+			crcVal = recvFec(&buf32[blk * BURST_BLOCK_WORDS], n, syn, crcVal, true);
+
+		/* block trailer */
+		rx = J_Recv();
+
+		if (!crcValid(rx)                         ||
+		   (rx & PKT_CLASS)  != CLASS_SYS         ||
+		   (rx & PKT_SUBCMD) != SYS_MW_TX_DONE    ||
+		   (rx & PKT_CMD_ID) != 0                 ||
+		   ((rx & PKT_DATA) >> DATA_SHIFT) != crcVal) {
+			H_Stats.crcFails++;
+			H_Stats.retries++;
+			H_TRACE(TR_ERR, TR_BAD, CLASS_MEM | MEM_READ, rx, crcVal);
+			seq = (seq + 1) & 3;
+			J_SendLatest(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | ((BURST_ACK_RETRY | (seq << BURST_ACK_SEQ_SHIFT) | blk) << DATA_SHIFT)));
+			hunting = true;
+			continue;
+		}
+
+		/* good block, ACK it; no need to wait, the host only wants the latest one */
+		blk++;
+		J_SendLatest(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | (blk << DATA_SHIFT)));
+	}
+
+	/* make sure the host saw the final ACK, then idle the line */
+	J_Flush();
+	J_Send(0);
+}
+
+/* is rx the host's SYS_ACK?  hand back its data if so */
+static bool isAck(u32 rx, u32 *data) {
+	if (!crcValid(rx)                ||
+	   (rx & PKT_CLASS)  != CLASS_SYS ||
+	   (rx & PKT_SUBCMD) != SYS_ACK   ||
+	   (rx & PKT_CMD_ID) != 0)
+		return false;
+
+	*data = (rx & PKT_DATA) >> DATA_SHIFT;
+	return true;
+}
+
+/* wait for the host's SYS_ACK and hand back its data, false if we got something else */
+static bool recvAck(u32 *data) {
+	return isAck(J_Recv(), data);
+}
+
+/*
+ * Wait for the ACK to a command we just sent.  With read-ahead on, whatever
+ * the host pushed before it noticed the command is queued up ahead of it;
+ * it stops pushing once it does, so skip anything that isn't an ACK.
+ * Don't wait forever, though: if the host read the command while finishing
+ * a burst we'd given up on, it took it for an ACK it didn't understand, and
+ * it's only going to hear us if we ask again.
+ */
+static bool recvCmdAck(void) {
+	u32 rx, ack, start = K_Micros();
+
+	while (K_Micros() - start < H_REPLY_TIMEOUT_US) {
+		if (!recvPaced(&rx))
+			return false;
+		if (isAck(rx, &ack))
+			return ack == 0;
+	}
+	return false;
+}
+
+/*
+ * One untagged MEM_READ of `words' words at addr, or BLK_READ of `count'
+ * sectors (that many words' worth) from sector `where'; cls says which.
+ * False if the host refused it.
+ */
+static bool fetch(u32 cls, void *buf, u32 where, u32 count, u32 words) {
+	u32 tmp[2], rx, data, lzWords, flags, start = K_Micros();
 	u16 crcVal, calcCrcVal;
+	bool lz, zero, lzBad = false, again = false, desync = false;
 	int i;
-	printf("Reading %dB from 0x%08lx\n", len, addr);
 tryStart:
+	if (again) {
+		H_Stats.retries++;
+		H_TRACE(TR_ERR, TR_RETRY, cls | MEM_READ, 0, 0);
+		if (H_Quiet())
+			H_Rejoin();
+	}
+	else
+		H_Heard();
+	again = true;
 
-	/* start read */
-	while (REG_JSTAT & 0xa); /* drain buffers */
-	puts("Sending MEM_READ");
-	REG_JOYTR = crc(CLASS_MEM | MEM_READ | 0 /* id */ | (2 << DATA_SHIFT) /* 2x u32 to describe goal */);
-
+	/* start read, the host drops any read-ahead it was in the middle of */
+	R_Abort();
+	J_Drain();
 	/* set up our read */
-	tmp[0] = __builtin_bswap32(addr);
-	tmp[1] = __builtin_bswap32((len + 3) / 4);
-	crcVal = calc_crc16((u8 *)tmp, 2 * sizeof(u32));
-	tmp[0] = addr;
-	tmp[1] = (len + 3) / 4;
+	tmp[0] = where;
+	tmp[1] = count;
+	lz = (H_Features & FEAT_LZ77) && words >= H_LZ_MIN_WORDS && !lzBad;
 
-	/* wait for host to read our command */
-	while (REG_JSTAT & 0x8);
+	/* let the host know if it went too fast for us last time */
+	flags = (lz ? READ_LZ_OK : 0) | ((desync && (H_Features & FEAT_PACE)) ? READ_RETRY : 0);
+	desync = false;
 
-	puts("waiting for ACK 1");
-	/* wait for incoming ACK */
-	while (1) {
-		while (!(REG_JSTAT & 0x2));
-		rx = REG_JOYRE;
+	H_TRACE(TR_REQ, TR_SEND, cls | MEM_READ, where, count);
+	J_Send(crc(cls | MEM_READ | 0 /* id */ | ((2 /* 2x u32 to describe goal */ | flags) << DATA_SHIFT)));
+	stats_req(&H_Stats, cls | MEM_READ);
 
-		if (!crcValid(rx)) {
-			puts("invalid CRC (ACK 1)");
-			goto tryStart;
-		}
+	crcVal = crc16_update(crc16_update(CRC16_INIT, tmp[0]), tmp[1]);
 
-		if ((rx & PKT_CLASS) != CLASS_SYS ||
-		   (rx & PKT_SUBCMD) != SYS_ACK   ||
-		   (rx & PKT_CMD_ID) != 0         ||
-		   (rx & PKT_DATA)   != 0) {
-			puts("invalid data (ACK 1)");
-			goto tryStart;
-		}
+	/* wait for host to read our command */
+	J_Flush();
 
-		break;
+	if (!recvCmdAck()) {
+		puts("invalid ACK 1");
+		goto tryStart;
 	}
 
 	/* write addr, len, and CRC */
-	puts("Sending address, len, CRC");
-	while (REG_JSTAT & 0x8);
-	REG_JOYTR = tmp[0]; /* addr */
-	while (REG_JSTAT & 0x8);
-	REG_JOYTR = tmp[1]; /* len */
-	while (REG_JSTAT & 0x8);
-	REG_JOYTR = crc(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT));
-	while (REG_JSTAT & 0x8);
+	J_Flush();
+	J_Send(tmp[0]); /* addr */
+	J_Flush();
+	J_Send(tmp[1]); /* len */
+	J_Flush();
+	J_Send(crc(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT)));
+	J_Flush();
 
-	puts("waiting for ACK 2");
+	/* paced, from here on a bad word most likely means the host sent the next one too soon */
+	desync = true;
 
 	/* wait for incoming ACK */
 	while (1) {
-		while (!(REG_JSTAT & 0x2));
-		rx = REG_JOYRE;
+		rx = J_Recv();
 
 		if (!crcValid(rx)) {
 			puts("invalid CRC (ACK 2)");
+			H_Stats.crcFails++;
+			H_TRACE(TR_ERR, TR_BAD, cls | MEM_READ, rx, 0);
 			goto tryStart;
 		}
 
+		/* the host may say it's coming compressed, if we said it could, or that it's all zeroes */
+		data = (rx & PKT_DATA) >> DATA_SHIFT;
+		lzWords = (lz && (data & READ_ACK_LZ)) ? data & READ_ACK_LZ_WORDS : 0;
+		zero = (H_Features & FEAT_ZERO) && data == READ_ACK_ZERO;
+
+		/* or not at all, if it's off the end of the disk or our window */
+		if (data == READ_ACK_BAD &&
+		   (rx & PKT_CLASS) == CLASS_SYS && (rx & PKT_SUBCMD) == SYS_ACK) {
+			if (cls == CLASS_BLK)
+				printf("Host refused read of %lu sectors at %lu\n", count, where);
+			else
+				printf("Host refused read of %luB at 0x%08lx\n", count * 4, where);
+			H_TRACE(TR_ERR, TR_REFUSED, cls | MEM_READ, where, count);
+			J_Send(0);
+			return false;
+		}
+
 		if ((rx & PKT_CLASS) != CLASS_SYS ||
 		   (rx & PKT_SUBCMD) != SYS_ACK   ||
 		   (rx & PKT_CMD_ID) != 0         ||
-		   (rx & PKT_DATA)   != 0) {
+		   (data && !lzWords && !zero)    ||
+		   lzWords > LZ_MAX_WORDS) {
 			puts("invalid data (ACK 2)");
 			goto tryStart;
 		}
 
 		break;
 	}
-	puts("Got ACK!  Reading data...");
+	H_TRACE(TR_STEP, TR_ACK, cls | MEM_READ, data, 0);
+
+	/* the host already read our MW_TX_DONE, don't let it see it again while idle */
+	J_Send(0);
+
+	/* and that's all the host has to say about it */
+	if (zero) {
+		memset(buf, 0, words * 4);
+		goto done;
+	}
 
-	/* we got an ACK, we now have tmp[1] + 1 words incoming */
-	for (i = 0; i < tmp[1]; i++) {
+	if (lzWords) {
+		recvBurst(H_LzBuf, lzWords);
+		if (!H_Unpack(buf, words)) {
+			puts("bad LZ77 reply, retrying raw");
+			lzBad = true;
+			goto tryStart;
+		}
+		goto done;
+	}
+
+	if (H_Features & FEAT_BURST) {
+		recvBurst((u32 *)buf, words);
+		goto done;
+	}
+
+	/* we got an ACK, we now have words + 1 words incoming, as long as none got lost */
+	calcCrcVal = CRC16_INIT;
+	for (i = 0; i < words; i++) {
 		u32 *buf32 = (u32 *)buf;
 
 		//printf("Waiting for word %d/%d\n", i, tmp[1]);
-		while (!(REG_JSTAT & 0x2));
-		buf32[i] = __builtin_bswap32(REG_JOYRE); /* put it back into BE temporarily for the CRC */
+		if (!recvPaced(&rx)) {
+			puts("host went quiet partway through");
+			H_TRACE(TR_ERR, TR_BAD, cls | MEM_READ, i, words);
+			goto tryStart;
+		}
+		buf32[i] = __builtin_bswap32(rx); /* keep it BE, byte-identical to guest memory */
+		calcCrcVal = crc16_update(calcCrcVal, rx);
 	}
 
-	while (!(REG_JSTAT & 0x2));
-	rx = REG_JOYRE;
+	if (!recvPaced(&rx)) {
+		puts("host went quiet before MW_TX_DONE");
+		H_TRACE(TR_ERR, TR_BAD, cls | MEM_READ, words, words);
+		goto tryStart;
+	}
 
 	if ((rx & PKT_CLASS) != CLASS_SYS      ||
 	   (rx & PKT_SUBCMD) != SYS_MW_TX_DONE ||
 	   (rx & PKT_CMD_ID) != 0) {
 		puts("invalid data (MW_TX_DONE)");
+		H_Stats.crcFails++;
+		H_TRACE(TR_ERR, TR_BAD, cls | MEM_READ, rx, calcCrcVal);
 		//while(1);
 		goto tryStart;
 	}
 
 	crcVal = (rx & PKT_DATA) >> DATA_SHIFT;
-	calcCrcVal = calc_crc16(buf, tmp[1] * sizeof(u32));
 
 	if (crcVal != calcCrcVal) {
 		printf("invalid CRC on data (0x%08x != 0x%08x)\n", crcVal, calcCrcVal);
+		H_Stats.crcFails++;
+		H_TRACE(TR_ERR, TR_BAD, cls | MEM_READ, crcVal, calcCrcVal);
 		//while(1);
 		goto tryStart;
 	}
 
 	/* we actually do want to keep it in BE, we care about it being byte-identical, not word-interpretation-identical */
 #if 0
-	for (i = 0; i < tmp[1]; i++) {
+	for (i = 0; i < words; i++) {
 		u32 *buf32 = (u32 *)buf;
 		buf32[i] = __builtin_bswap32(buf32[i]); /* put it back into LE so we can use it */
 	}
 #endif
 
 	/* success! */
-	puts("memory read done!!");
-	return;
+done:
+	stats_done(&H_Stats, cls, false, words * 4, K_Micros() - start);
+	H_TRACE(TR_REQ, TR_DONE, cls | MEM_READ, words * 4, K_Micros() - start);
+	return true;
 }
 
+void H_FetchMemBuf(void *buf, u32 addr, int len) {
+	/* did the host see this one coming? */
+	if (H_Features & FEAT_PUSH) {
+		R_Wait(addr);
+		if (R_Take(buf, addr, len))
+			return;
+	}
+
+	H_TRACE(TR_REQ, TR_FETCH, 0, addr, len);
+	if (H_Features & FEAT_TAGGED) {
+		H_Wait(H_SubmitRead(buf, addr, len));
+		return;
+	}
+
+	fetch(CLASS_MEM, buf, addr, (len + 3) / 4, (len + 3) / 4);
+}
+
+
+/*
+ * One MEM_WRITE of at most WRITE_MAX_WORDS, or BLK_WRITE of `count'
+ * sectors (`words' words) at sector `where'; same as fetch().
+ */
+static bool storeChunk(u32 cls, const u8 *buf, u32 where, u32 count, u32 words) {
+	const u8 *p;
+	u32 i, word, ack, start = K_Micros();
+	u16 crcVal;
+	bool again = false;
+
+	/* anything the host pushed for here is out of date now */
+	if (cls == CLASS_MEM)
+		R_Drop(where, words * 4);
+tryStart:
+	if (again) {
+		H_Stats.retries++;
+		H_TRACE(TR_ERR, TR_RETRY, cls | MEM_WRITE, 0, 0);
+		if (H_Quiet())
+			H_Rejoin();
+	}
+	else
+		H_Heard();
+	again = true;
+
+	/* start write, the host drops any read-ahead it was in the middle of */
+	R_Abort();
+	J_Drain();
+	J_Send(crc(cls | MEM_WRITE | 0 /* id */ | (2 << DATA_SHIFT) /* 2x u32 to describe goal */));
+	stats_req(&H_Stats, cls | MEM_WRITE);
+	H_TRACE(TR_REQ, TR_SEND, cls | MEM_WRITE, where, count);
+	J_Flush();
+
+	if (!recvCmdAck()) {
+		puts("invalid ACK 1 (write)");
+		goto tryStart;
+	}
+
+	/* addr, len, and CRC */
+	crcVal = crc16_update(crc16_update(CRC16_INIT, where), count);
+	J_Send(where);
+	J_Flush();
+	J_Send(count);
+	J_Flush();
+	J_Send(crc(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT)));
+	J_Flush();
+
+	if (!recvAck(&ack)) {
+		puts("invalid ACK 2 (write)");
+		goto tryStart;
+	}
+
+	if (ack == WRITE_ACK_BAD) {
+		printf("Host refused write of %luB to 0x%08lx\n", words * 4, where);
+		H_TRACE(TR_ERR, TR_REFUSED, cls | MEM_WRITE, where, count);
+		J_Send(0);
+		return false;
+	}
+
+	/* the host tells our words apart by the JOY status, so just wait for each to be read */
+	crcVal = CRC16_INIT;
+	for (i = 0; i < words; i++) {
+		p = &buf[i * 4];
+		word = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; /* guest memory is BE */
+
+		J_Flush();
+		J_Send(word);
+		crcVal = crc16_update(crcVal, word);
+	}
+
+	J_Flush();
+	J_Send(crc(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT)));
+
+	/* don't let the host see the trailer again while idle */
+	J_Flush();
+	J_Send(0);
+
+	if (!recvAck(&ack) || ack != WRITE_ACK_OK) {
+		puts("write not accepted, retrying");
+		goto tryStart;
+	}
+
+	stats_done(&H_Stats, cls, true, words * 4, K_Micros() - start);
+	H_TRACE(TR_REQ, TR_DONE, cls | MEM_WRITE, words * 4, K_Micros() - start);
+	return true;
+}
+
+void H_StoreMemBuf(const void *buf, u32 addr, int len) {
+	const u8 *src = buf;
+	int ids[MAX_INFLIGHT], n = 0, i;
+	u32 words, word;
+
+	H_TRACE(TR_REQ, TR_STORE, 0, addr, len);
+
+	while (len >= 4) {
+		words = len / 4;
+		if (words > WRITE_MAX_WORDS)
+			words = WRITE_MAX_WORDS;
+
+		if (H_Features & FEAT_TAGGED) {
+			/* keep them all on the wire, only wait once we're out of ids */
+			if (n == MAX_INFLIGHT) {
+				for (i = 0; i < n; i++)
+					H_Wait(ids[i]);
+				n = 0;
+			}
+			ids[n++] = H_SubmitWrite(src, addr, words * 4);
+		}
+		else
+			storeChunk(CLASS_MEM, src, addr, words, words);
+		src += words * 4;
+		addr += words * 4;
+		len -= words * 4;
+	}
+
+	for (i = 0; i < n; i++)
+		H_Wait(ids[i]);
+
+	/* a last partial word, merged with what's already there like H_WriteMemBuf() does */
+	if (len > 0) {
+		H_FetchMemBuf(&word, addr, 4);
+		memcpy(&word, src, len);
+		H_StoreMemBuf(&word, addr, 4);
+	}
+}
+
+void H_Poll(void) {
+	if (H_Features & FEAT_TAGGED)
+		H_PollTagged();
+	else if (H_Features & FEAT_PUSH)
+		R_Poll();
+}
+
+void H_ReadMemBuf(void *buf, u32 addr, int len) {
+	H_Poll();
+	if (P_Enabled())
+		P_Read(buf, addr, len);
+	else
+		H_FetchMemBuf(buf, addr, len);
+}
+
+void H_PrefetchMemBuf(u32 addr, int len) {
+	H_Poll();
+	P_Prefetch(addr, len);
+}
+
+bool H_ReadReady(u32 addr, int len) {
+	H_Poll();
+	return P_Ready(addr, len);
+}
 
 void H_WriteMemBuf(void *buf, u32 addr, int len) {
-	printf("Writing %dB to 0x%08lx\n", len, addr);
+	u8 *src = buf;
+	u32 word;
+	int off, n;
+
+	H_Poll();
+	if (P_Enabled()) {
+		P_Write(buf, addr, len);
+		return;
+	}
+
+	while (len > 0) {
+		off = addr & 3;
+		if (!off && len >= 4) {
+			n = len & ~3;
+			H_StoreMemBuf(src, addr, n);
+		}
+		else {
+			/* partial word, merge it with what's already there */
+			n = 4 - off;
+			if (n > len)
+				n = len;
+
+			H_FetchMemBuf(&word, addr - off, 4);
+			memcpy((u8 *)&word + off, src, n);
+			H_StoreMemBuf(&word, addr - off, 4);
+		}
+
+		src += n;
+		addr += n;
+		len -= n;
+	}
+}
+
+void H_SyncMemBuf(void) {
+	if (P_Enabled())
+		P_Flush();
+}
+
+/* same shape as H_StoreMemBuf(): BLK_MAX_SECTORS at a time, and tagged ones all on the wire at once */
+static bool blocks(bool write, u8 *buf, u32 sector, u32 count) {
+	int ids[MAX_INFLIGHT], n = 0, i;
+	bool ok = true;
+	u32 chunk;
+
+	/* these want every id there is, and prefetched lines hang on to theirs until they're used */
+	P_Settle();
+
+	while (count && ok) {
+		chunk = (count > BLK_MAX_SECTORS) ? BLK_MAX_SECTORS : count;
+
+		if (H_Features & FEAT_TAGGED) {
+			if (n == MAX_INFLIGHT) {
+				for (i = 0; i < n; i++)
+					ok &= H_Wait(ids[i]);
+				n = 0;
+			}
+			ids[n++] = H_SubmitBlocks(write, buf, sector, chunk);
+		}
+		else if (write)
+			ok = storeChunk(CLASS_BLK, buf, sector, chunk, chunk * BLK_SECTOR_WORDS);
+		else
+			ok = fetch(CLASS_BLK, buf, sector, chunk, chunk * BLK_SECTOR_WORDS);
+		buf += chunk * BLK_SECTOR_SIZE;
+		sector += chunk;
+		count -= chunk;
+	}
+
+	for (i = 0; i < n; i++)
+		ok &= H_Wait(ids[i]);
+	return ok;
+}
+
+bool H_ReadBlocks(void *buf, u32 sector, u32 count) {
+	H_Poll();
+	return blocks(false, buf, sector, count);
+}
+
+bool H_WriteBlocks(const void *buf, u32 sector, u32 count) {
+	H_Poll();
+	return blocks(true, (u8 *)buf, sector, count);
+}
+
+bool H_HostStats(struct linkStats *out) {
+	u32 *buf32 = (u32 *)out, rx, i, start;
+	u16 crcVal;
+
+	/* it's not a tagged request, so nothing else can be going on */
+	if (H_Features & FEAT_TAGGED)
+		H_Settle();
+	R_Abort();
+	J_Drain();
+
+	J_Send(crc(CLASS_SYS | SYS_PING | 0 /* id */ | (PING_STATS << DATA_SHIFT)));
+	stats_req(&H_Stats, CLASS_SYS | SYS_PING);
+	H_TRACE(TR_REQ, TR_PING, CLASS_SYS | SYS_PING, PING_STATS, 0);
+	J_Flush();
+
+	/* same as recvCmdAck(), there may be pushed words in the way */
+	start = K_Micros();
+	while (1) {
+		if (K_Micros() - start >= H_REPLY_TIMEOUT_US || !recvPaced(&rx)) {
+			puts("no reply to stats ping");
+			return false;
+		}
+		if (crcValid(rx) && (rx & PKT_CLASS) == CLASS_SYS && (rx & PKT_SUBCMD) == SYS_PING_REPLY)
+			break;
+	}
+
+	/* a host that keeps different stats from us is no use */
+	if (((rx & PKT_DATA) >> DATA_SHIFT) != STATS_WORDS) {
+		printf("host has %lu words of stats, we want %lu\n",
+		       (unsigned long)((rx & PKT_DATA) >> DATA_SHIFT), (unsigned long)STATS_WORDS);
+		return false;
+	}
+	J_Send(0);
+
+	if (H_Features & FEAT_BURST) {
+		recvBurst(buf32, STATS_WORDS);
+		for (i = 0; i < STATS_WORDS; i++)
+			buf32[i] = __builtin_bswap32(buf32[i]);
+		return true;
+	}
+
+	crcVal = CRC16_INIT;
+	for (i = 0; i < STATS_WORDS; i++) {
+		if (!recvPaced(&buf32[i])) {
+			puts("host stats stopped short");
+			return false;
+		}
+		crcVal = crc16_update(crcVal, buf32[i]);
+	}
+
+	if (!recvPaced(&rx)                    ||
+	   !crcValid(rx)                       ||
+	   (rx & PKT_CLASS)  != CLASS_SYS      ||
+	   (rx & PKT_SUBCMD) != SYS_MW_TX_DONE ||
+	   ((rx & PKT_DATA) >> DATA_SHIFT) != crcVal) {
+		puts("bad CRC on host stats");
+		H_Stats.crcFails++;
+		return false;
+	}
+	return true;
+}
+
+bool H_Checkpoint(const u32 *core, u32 words) {
+	u32 i, ack;
+	u16 crcVal;
+	bool again = false;
+
+	if (words > SAVE_MAX_WORDS)
+		return false;
+
+	/* the host saves what it has, so it had better have all of it */
+	H_SyncMemBuf();
+	if (H_Features & FEAT_TAGGED)
+		H_Settle();
+
+tryStart:
+	if (again) {
+		H_Stats.retries++;
+		H_TRACE(TR_ERR, TR_RETRY, CLASS_SYS | SYS_PING, 0, 0);
+		if (H_Quiet())
+			H_Rejoin();
+	}
+	else
+		H_Heard();
+	again = true;
+
+	R_Abort();
+	J_Drain();
+	J_Send(crc(CLASS_SYS | SYS_PING | 0 /* id */ | ((PING_SAVE | (words << 8)) << DATA_SHIFT)));
+	stats_req(&H_Stats, CLASS_SYS | SYS_PING);
+	H_TRACE(TR_REQ, TR_PING, CLASS_SYS | SYS_PING, PING_SAVE, words);
+	J_Flush();
+
+	if (!recvCmdAck()) {
+		puts("invalid ACK 1 (checkpoint)");
+		goto tryStart;
+	}
+
+	/* same as MEM_WRITE data, one word at a time as the host picks them up */
+	crcVal = CRC16_INIT;
+	for (i = 0; i < words; i++) {
+		J_Flush();
+		J_Send(core[i]);
+		crcVal = crc16_update(crcVal, core[i]);
+	}
+
+	J_Flush();
+	J_Send(crc(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT)));
+	J_Flush();
+	J_Send(0);
+
+	/* the host has the whole of guest memory to write out before it answers */
+	if (!recvAck(&ack) || ack == WRITE_ACK_RETRY) {
+		puts("checkpoint not taken, retrying");
+		goto tryStart;
+	}
+
+	if (ack != WRITE_ACK_OK) {
+		puts("Host couldn't save the checkpoint");
+		return false;
+	}
+	return true;
+}
+
+/* how many words the host had sent us, and when, last we looked */
+static u32 heardWords, heardAt;
+
+void H_Heard(void) {
+	heardWords = J_RxWords;
+	heardAt = K_Micros();
+}
+
+bool H_Quiet(void) {
+	if (J_RxWords != heardWords) {
+		H_Heard();
+		return false;
+	}
+	return K_Micros() - heardAt > H_LOST_US;
+}
+
+void H_Rejoin(void) {
+	u32 ack;
+
+	puts("Host went quiet, seeing if it still has us...");
+	H_TRACE(TR_ERR, TR_PING, CLASS_SYS | SYS_PING, PING_SESSION, H_Session);
+
+	/* with the cable out, this sits here until it's back in and the host reads what we left it */
+	while (1) {
+		R_Abort();
+		J_Drain();
+		J_Send(crc(CLASS_SYS | SYS_PING | 0 /* id */ | (PING_SESSION << DATA_SHIFT)));
+		stats_req(&H_Stats, CLASS_SYS | SYS_PING);
+		J_Flush();
+
+		if (!recvCmdAck())
+			continue;
+
+		J_Send(H_Session);
+		J_Flush();
+		J_Send(crc(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crc16_update(CRC16_INIT, H_Session) << DATA_SHIFT)));
+		J_Flush();
+		J_Send(0);
+
+		if (!recvAck(&ack) || ack == WRITE_ACK_RETRY)
+			continue;
+		if (ack == WRITE_ACK_OK)
+			break;
+
+		/* our guest memory's gone with it, there's nothing to go back to */
+		puts("Host doesn't have our session, power cycle the GBA");
+		while (1)
+			J_HwIdle();
+	}
+
+	puts("Host took us back");
+	H_Heard();
+}
+
+void H_Probe(u32 seq) {
+	u32 rx, n = 0;
+	u16 crcVal = CRC16_INIT;
+	bool ok;
+
+	/* the words never pass for a packet, so the first one that does is the trailer */
+	while (recvPaced(&rx) && !crcValid(rx)) {
+		crcVal = crc16_update(crcVal, rx);
+		n++;
+	}
+
+	ok = n == PROBE_WORDS                   &&
+	     crcValid(rx)                       &&
+	     (rx & PKT_CLASS)  == CLASS_SYS      &&
+	     (rx & PKT_SUBCMD) == SYS_MW_TX_DONE &&
+	     ((rx & PKT_DATA) >> DATA_SHIFT) == crcVal;
+	J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | ((seq | (ok ? 0 : BURST_ACK_RETRY)) << DATA_SHIFT)));
 }
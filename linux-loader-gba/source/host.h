@@ -8,8 +8,173 @@
 #define _HOST_H
 
 #include <gba_types.h>
+#include "comms.h"
+#include "clock.h"
+#include "stats.h"
+#include "trace.h"
 
+/* everything this build of the loader knows how to speak */
+#define H_SUPPORTED_FEATURES (FEAT_BURST | FEAT_PUSH | FEAT_TAGGED | FEAT_LZ77 | FEAT_PACE | FEAT_SACK | FEAT_FEC | FEAT_ZERO)
+
+extern u32 H_Features;
+
+/* guest physical address the core should start the kernel at, from SYS_KERNEL_LOAD */
+extern u32 H_KernelEntry;
+
+/* size of the host's virtual disk in BLK_SECTOR_SIZE sectors, also from SYS_KERNEL_LOAD; 0 for none */
+extern u32 H_DiskSectors;
+
+/*
+ * Checkpoints (see PING_SAVE).  If the host put one back, guest memory is
+ * as it was when it was saved, and the core should take its state from
+ * H_ResumeCore rather than start the kernel at H_KernelEntry; otherwise
+ * H_ResumeWords is 0.
+ */
+extern u32 H_ResumeWords;
+extern u32 H_ResumeCore[SAVE_MAX_WORDS];
+
+/*
+ * Have the host save guest memory, along with `words' words of core state,
+ * for next time.  Writes back the page cache and waits for anything tagged
+ * first.  False if the host couldn't save it.
+ */
+extern bool H_Checkpoint(const u32 *core, u32 words);
+
+/* what the host calls this run of ours, from SYS_KERNEL_LOAD (see PING_SESSION) */
+extern u32 H_Session;
+
+/*
+ * Losing the link.  Call H_Heard() when starting to wait on the host, and
+ * H_Quiet() while still waiting: true once the host hasn't sent a word
+ * for H_LOST_US, in which case the cable may have come out, and the host
+ * may have dropped whatever we had going.  H_Rejoin() then waits for it
+ * to take us back (it never returns if it won't), after which nothing's
+ * in flight and anything we were waiting on has to be asked for again.
+ */
+#define H_LOST_US (1000000)
+extern void H_Heard(void);
+extern bool H_Quiet(void);
+extern void H_Rejoin(void);
+
+/* what's been going over the link, from our end */
+extern struct linkStats H_Stats;
+
+/*
+ * Ask the host for its end of it, false if that didn't work out.  Waits for
+ * anything tagged to finish first.
+ */
+extern bool H_HostStats(struct linkStats *out);
+
+/* take one of the host's paced timing probes (see comms.h) and say how it went */
+extern void H_Probe(u32 seq);
+
+/* what happened when, for an emulator or debugger to pull out of EWRAM (trace.h) */
+#define H_TRACE_RECS (256)
+struct _hTrace {
+	struct traceHdr hdr;
+	struct traceRec rec[H_TRACE_RECS];
+};
+extern struct _hTrace H_Trace;
+extern void H_InitTrace(void);
+
+#define H_TRACE(lvl, ev, pkt, a, b) do { \
+	if (TRACE_LEVEL >= (lvl)) \
+		trace_put(&H_Trace.hdr, H_Trace.rec, H_TRACE_RECS - 1, K_Ticks(), (ev), (pkt), (a), (b)); \
+} while (0)
+
+/* goes through the page cache when it's on */
 extern void H_ReadMemBuf(void *buf, u32 addr, int len);
+/* always goes over the link */
+extern void H_FetchMemBuf(void *buf, u32 addr, int len);
+/* also goes through the page cache, which holds on to it until it's evicted or synced */
 extern void H_WriteMemBuf(void *buf, u32 addr, int len);
+/* always goes over the link; addr must be a whole word, a partial last one is merged with what's there */
+extern void H_StoreMemBuf(const void *buf, u32 addr, int len);
+/* push any cached writes out to the host */
+extern void H_SyncMemBuf(void);
+/* pick up read-ahead from the host; the Read/Write calls do this for you */
+extern void H_Poll(void);
+
+/*
+ * The same reads, split in two so the guest can keep running out of the
+ * page cache meanwhile.  H_PrefetchMemBuf() starts bringing the lines in
+ * and returns straight away; H_ReadReady() says whether H_ReadMemBuf() of
+ * it would now return without waiting on the link.  Call either often
+ * enough and the transfers finish in the background.  Prefetching needs
+ * the page cache and FEAT_TAGGED, without them it does nothing.
+ */
+extern void H_PrefetchMemBuf(u32 addr, int len);
+extern bool H_ReadReady(u32 addr, int len);
+
+/*
+ * The virtual disk, always over the link; the host keeps its own cache of
+ * it.  buf has to be word aligned.  False if any of it was past the end of
+ * the disk, in which case whatever's in buf for a read is garbage.
+ */
+extern bool H_ReadBlocks(void *buf, u32 sector, u32 count);
+extern bool H_WriteBlocks(const void *buf, u32 sector, u32 count);
+
+/*
+ * Tagged requests (hostq.c).  These hand back an id right away and leave the
+ * transfer running; buf has to stay put (and be word aligned for reads) until
+ * H_Wait() on that id returns.  Without FEAT_TAGGED they do the whole thing
+ * there and then and return H_NO_ID, which is always done.
+ */
+#define H_NO_ID (-1)
+extern int  H_SubmitRead(void *buf, u32 addr, int len);
+/* len must be whole words, and no more than WRITE_MAX_WORDS of them */
+extern int  H_SubmitWrite(const void *buf, u32 addr, int len);
+/* the same for the disk, no more than BLK_MAX_SECTORS; only with FEAT_TAGGED, H_ReadBlocks() and H_WriteBlocks() sort that out */
+extern int  H_SubmitBlocks(bool write, void *buf, u32 sector, u32 count);
+extern bool H_Done(int id);
+/* ids nobody's using, that a submit could have right now */
+extern u32  H_FreeIds(void);
+/* false if the host refused it; frees the id either way */
+extern bool H_Wait(int id);
+/* H_Poll() for FEAT_TAGGED */
+extern void H_PollTagged(void);
+/* keep polling until nothing's in flight and the host has all our ACKs */
+extern void H_Settle(void);
+
+/*
+ * Which blocks of a burst mode reply we have, for FEAT_SACK.  Blocks more
+ * than H_SACK_BLOCKS past the first missing one get ignored; the host never
+ * gets that far ahead anyway.
+ */
+#define H_SACK_BLOCKS (32)
+struct _hSack {
+	u32 acked;   /* every block before this one is in */
+	u32 have;    /* bit n: block acked + n is in */
+	u32 bad;     /* bit n: block acked + n failed its CRC */
+	u32 seq;     /* of the last retry we asked for */
+	bool nacked; /* already asked for block acked, as of seq */
+};
+extern void H_SackReset(struct _hSack *s);
+/* a block worth taking, one we don't have yet */
+extern bool H_SackWant(const struct _hSack *s, u32 blk);
+/* a block came in, good or bad; a bad header counts as a bad acked block */
+extern void H_SackGot(struct _hSack *s, u32 blk, bool good, u32 pkt);
+/* what goes in the next ACK */
+extern u32  H_SackAck(const struct _hSack *s);
+
+/*
+ * FEAT_FEC.  syn is a block's check words XORed with what the words that
+ * came in add up to (fec_add()); flip back the bits that points at in the
+ * n words at buf32, kept big endian, and return the block's CRC, which is
+ * crcVal if there was nothing to fix.
+ */
+extern u16 H_FecFix(u32 *buf32, u32 n, const u32 *syn, u16 crcVal);
+/* bits it's flipped back */
+extern u32 H_FecFixed;
+
+/*
+ * LZ77 replies (FEAT_LZ77).  Only reads at least this long ask for one,
+ * anything shorter isn't worth unpacking.  The compressed data lands in
+ * H_LzBuf, so one read at a time can use it; H_Unpack() puts it where it
+ * belongs and checks it.
+ */
+#define H_LZ_MIN_WORDS (16)
+extern u32 H_LzBuf[LZ_MAX_WORDS];
+extern bool H_Unpack(void *buf, u32 words);
 
 #endif /* _HOST_H */
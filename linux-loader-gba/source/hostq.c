@@ -0,0 +1,640 @@
+/*
+ * GBA Linux Loader - GBA Side - Tagged host requests
+ *
+ * With FEAT_TAGGED, up to MAX_INFLIGHT reads and writes can be on the wire
+ * at once, each under its own PKT_CMD_ID.  Nothing here blocks except
+ * H_Wait(): H_PollTagged() feeds whatever the host sent to the request it
+ * belongs to, and sends the next word of whatever we owe the host.  Requests
+ * finish in whatever order the host gets them done.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <gba_types.h>
+#include "comms.h"
+#include "joy.h"
+#include "host.h"
+#include "readahead.h"
+
+/* give up on hearing back about a write block after this many polls, and resend */
+#define H_STALL_POLLS (50000)
+
+static struct {
+	enum {
+		Q_FREE,      /* nothing */
+		Q_SUBMIT,    /* waiting to send the request */
+		Q_SUBMITTED, /* sent it, waiting for the host's ACK */
+		Q_ACTIVE,    /* data on the move */
+		Q_DONE,      /* all there, waiting for H_Wait() */
+		Q_FAILED     /* host refused it, waiting for H_Wait() */
+	} state;
+	bool write;
+	bool disk;        /* BLK_READ or BLK_WRITE, addr is the first sector */
+	u8 *buf;
+	u32 addr, words, nblk;
+	u32 blk;          /* reads: next block we want, writes: next block to send */
+	u32 acked;        /* writes: host's cumulative ACK */
+	u32 seq, lastSeq; /* retry request numbering, ours and the host's */
+	bool hunting;     /* reads: already asked for a resend, keep quiet */
+	struct _hSack sack; /* reads: which blocks are in, with FEAT_SACK */
+	u32 idle;         /* writes: polls without the host ACKing anything */
+	bool ackPending;  /* reads: ackData needs to go out */
+	u32 ackData;
+	u32 lzWords;      /* reads: compressed reply coming into H_LzBuf, 0 for raw */
+	bool lzBad;       /* reads: the last compressed reply didn't check out, ask for raw */
+	u32 start;        /* K_Micros() when it was submitted */
+} q[MAX_INFLIGHT];
+
+/* which read has H_LzBuf, if any */
+static int lzOwner = -1;
+
+/* what we're sending; a request or a block goes out whole before anything else */
+static struct {
+	enum { TX_NONE, TX_SUBMIT, TX_BLOCK } kind;
+	u32 id, blk, pos, n;
+	u16 crc;
+} tx;
+static u32 txNext;
+
+/* what the host is sending */
+static struct {
+	enum { RX_IDLE, RX_DATA, RX_FEC, RX_TRAILER, RX_SKIP } state;
+	u32 id, blk, pos, n;
+	u32 fec[FEC_WORDS]; /* FEAT_FEC: check words, less what the data adds up to */
+	u16 crc;
+	bool keep; /* FEAT_SACK: not a block we already have */
+} rx;
+
+static inline u32 blockWords(u32 words, u32 blk) {
+	u32 n = words - (blk * BURST_BLOCK_WORDS);
+
+	return (n > BURST_BLOCK_WORDS) ? BURST_BLOCK_WORDS : n;
+}
+
+/* what's actually coming over the wire for a read */
+static inline u32 wireWords(u32 id) {
+	return q[id].lzWords ? q[id].lzWords : q[id].words;
+}
+
+/* and where it goes */
+static inline u32 *wireBuf(u32 id) {
+	return q[id].lzWords ? H_LzBuf : (u32 *)q[id].buf;
+}
+
+/* FEAT_FEC check words after each block's data */
+static inline u32 fecWords(void) {
+	return (H_Features & FEAT_FEC) ? FEC_WORDS : 0;
+}
+
+static inline bool inFlight(u32 id) {
+	return q[id].state >= Q_SUBMIT && q[id].state <= Q_ACTIVE;
+}
+
+/* what goes in the request's length word: words, or sectors for the disk */
+static inline u32 reqLength(u32 id) {
+	return q[id].disk ? q[id].words / BLK_SECTOR_WORDS : q[id].words;
+}
+
+static void queueAck(u32 id, u32 data) {
+	q[id].ackPending = true;
+	q[id].ackData = data;
+}
+
+/* the request packet, less the flags, for the trace */
+static inline u32 reqPkt(u32 id) {
+	return (q[id].disk ? CLASS_BLK : CLASS_MEM) | (q[id].write ? MEM_WRITE : MEM_READ) | (id << CMD_ID_SHIFT);
+}
+
+/* all there */
+static void finished(u32 id) {
+	u32 us = K_Micros() - q[id].start;
+
+	q[id].state = Q_DONE;
+	stats_done(&H_Stats, q[id].disk ? CLASS_BLK : CLASS_MEM, q[id].write, q[id].words * 4, us);
+	H_TRACE(TR_REQ, TR_DONE, reqPkt(id), q[id].words * 4, us);
+}
+
+/* ask for a read block again; see recvBurst() */
+static void retry(u32 id) {
+	H_Stats.retries++;
+	H_TRACE(TR_ERR, TR_RETRY, reqPkt(id), q[id].blk, 0);
+	q[id].seq = (q[id].seq + 1) & 3;
+	queueAck(id, BURST_ACK_RETRY | (q[id].seq << BURST_ACK_SEQ_SHIFT) | q[id].blk);
+	q[id].hunting = true;
+}
+
+static void gotAck(u32 id, u32 data) {
+	u32 seq;
+
+	switch (q[id].state) {
+	case Q_SUBMITTED: {
+		H_TRACE(TR_STEP, TR_ACK, reqPkt(id), data, 0);
+		if (lzOwner == id)
+			lzOwner = -1;
+
+		if (data & BURST_ACK_BAD)
+			q[id].state = Q_FAILED;
+		else if (data & BURST_ACK_RETRY) {
+			H_Stats.retries++;
+			H_TRACE(TR_ERR, TR_RETRY, reqPkt(id), 0, 0);
+			q[id].state = Q_SUBMIT;
+		}
+		else if (!q[id].write && (H_Features & FEAT_ZERO) && data == READ_ACK_ZERO) {
+			/* never been written, nothing more's coming */
+			memset(q[id].buf, 0, q[id].words * 4);
+			finished(id);
+		}
+		else {
+			/* coming compressed? then it keeps H_LzBuf until it's unpacked */
+			if (!q[id].write && (data & READ_ACK_LZ)) {
+				q[id].lzWords = data & READ_ACK_LZ_WORDS;
+				if (!q[id].lzWords || q[id].lzWords > LZ_MAX_WORDS || lzOwner >= 0) {
+					/* not what we asked for; ask again, raw this time */
+					H_Stats.retries++;
+					q[id].lzWords = 0;
+					q[id].lzBad = true;
+					q[id].state = Q_SUBMIT;
+					break;
+				}
+				lzOwner = id;
+				q[id].nblk = (q[id].lzWords + BURST_BLOCK_WORDS - 1) / BURST_BLOCK_WORDS;
+			}
+			q[id].state = Q_ACTIVE;
+			q[id].idle = 0;
+		}
+		break;
+	}
+	case Q_ACTIVE: {
+		if (!q[id].write)
+			break;
+
+		/* same as sendBurst() on the host, from this end */
+		seq = (data & BURST_ACK_SEQ) >> BURST_ACK_SEQ_SHIFT;
+		if (data & BURST_ACK_RETRY) {
+			if (seq != q[id].lastSeq) {
+				q[id].lastSeq = seq;
+				q[id].blk = data & BURST_ACK_BLK;
+				if (q[id].blk < q[id].acked)
+					q[id].blk = q[id].acked;
+				q[id].idle = 0;
+				H_Stats.retries++;
+				H_TRACE(TR_ERR, TR_RETRY, reqPkt(id), q[id].blk, 0);
+			}
+		}
+		else if ((data & BURST_ACK_BLK) > q[id].acked) {
+			q[id].acked = data & BURST_ACK_BLK;
+			q[id].idle = 0;
+			if (q[id].acked >= q[id].nblk)
+				finished(id);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static void blockHeader(u32 id, u32 blk) {
+	if (q[id].write)
+		return;
+
+	/* we've got all of it, so the host must have missed our last ACK */
+	if (q[id].state == Q_DONE || q[id].state == Q_FREE) {
+		queueAck(id, (q[id].state == Q_DONE) ? q[id].nblk : blk + 1);
+		return;
+	}
+
+	/*
+	 * the host ACKs a request before sending anything for it, so until we've
+	 * seen that, this is left over from whatever last had the id
+	 */
+	if (q[id].state != Q_ACTIVE)
+		return;
+
+	/* any block we don't have yet will do, see recvSack() */
+	if (H_Features & FEAT_SACK) {
+		if (blk >= q[id].nblk) {
+			H_SackGot(&q[id].sack, q[id].sack.acked, false, reqPkt(id));
+			queueAck(id, H_SackAck(&q[id].sack));
+			return;
+		}
+		rx.keep = H_SackWant(&q[id].sack, blk);
+		goto take;
+	}
+
+	if (blk != q[id].blk) {
+		/* only ask once, then keep quiet until the host rewinds */
+		if (!q[id].hunting)
+			retry(id);
+
+		/* don't go looking for packets in its data */
+		if (blk < q[id].nblk) {
+			rx.state = RX_SKIP;
+			rx.n = blockWords(wireWords(id), blk) + fecWords() + 1;
+		}
+		return;
+	}
+
+	q[id].hunting = false;
+	rx.keep = true;
+take:
+	rx.state = RX_DATA;
+	rx.id = id;
+	rx.blk = blk;
+	rx.pos = 0;
+	rx.n = blockWords(wireWords(id), blk);
+	rx.crc = CRC16_INIT;
+	memset(rx.fec, 0, sizeof(rx.fec));
+}
+
+static void rxWord(u32 w) {
+	u32 id;
+
+	switch (rx.state) {
+	case RX_DATA: {
+		if (rx.keep)
+			wireBuf(rx.id)[(rx.blk * BURST_BLOCK_WORDS) + rx.pos] = __builtin_bswap32(w); /* keep it BE */
+		rx.crc = crc16_update(rx.crc, w);
+		if (H_Features & FEAT_FEC)
+			fec_add(rx.fec, rx.pos, w);
+		if (++rx.pos == rx.n)
+			rx.state = (H_Features & FEAT_FEC) ? RX_FEC : RX_TRAILER;
+		return;
+	}
+	case RX_FEC: {
+		rx.fec[rx.pos - rx.n] ^= w;
+		if (++rx.pos < rx.n + FEC_WORDS)
+			return;
+
+		if (rx.keep)
+			rx.crc = H_FecFix(&wireBuf(rx.id)[rx.blk * BURST_BLOCK_WORDS], rx.n, rx.fec, rx.crc);
+		rx.state = RX_TRAILER;
+		return;
+	}
+	case RX_TRAILER: {
+		rx.state = RX_IDLE;
+		if (!crcValid(w)                                            ||
+		   (w & PKT_CLASS)  != CLASS_SYS                            ||
+		   (w & PKT_SUBCMD) != SYS_MW_TX_DONE                       ||
+		   ((w & PKT_CMD_ID) >> CMD_ID_SHIFT) != rx.id              ||
+		   ((w & PKT_DATA) >> DATA_SHIFT) != rx.crc) {
+			H_Stats.crcFails++;
+			H_TRACE(TR_ERR, TR_BAD, reqPkt(rx.id), w, rx.crc);
+			if (!(H_Features & FEAT_SACK))
+				retry(rx.id);
+			else if (rx.keep) {
+				H_SackGot(&q[rx.id].sack, rx.blk, false, reqPkt(rx.id));
+				queueAck(rx.id, H_SackAck(&q[rx.id].sack));
+			}
+			return;
+		}
+
+		/* good block; the host only wants the latest ACK */
+		if (H_Features & FEAT_SACK) {
+			if (rx.keep)
+				H_SackGot(&q[rx.id].sack, rx.blk, true, reqPkt(rx.id));
+			q[rx.id].blk = q[rx.id].sack.acked;
+			queueAck(rx.id, H_SackAck(&q[rx.id].sack));
+		}
+		else {
+			q[rx.id].blk++;
+			queueAck(rx.id, q[rx.id].blk);
+		}
+		if (q[rx.id].blk < q[rx.id].nblk)
+			return;
+
+		if (q[rx.id].lzWords) {
+			lzOwner = -1;
+			q[rx.id].lzWords = 0;
+			q[rx.id].blk = 0;
+			H_SackReset(&q[rx.id].sack);
+			q[rx.id].nblk = (q[rx.id].words + BURST_BLOCK_WORDS - 1) / BURST_BLOCK_WORDS;
+			if (!H_Unpack(q[rx.id].buf, q[rx.id].words)) {
+				/* the host has all its ACKs, so this goes in as a new request */
+				printf("bad LZ77 reply for 0x%08lx, retrying raw\n", q[rx.id].addr);
+				H_Stats.retries++;
+				q[rx.id].lzBad = true;
+				q[rx.id].state = Q_SUBMIT;
+				return;
+			}
+		}
+		finished(rx.id);
+		return;
+	}
+	case RX_SKIP: {
+		if (--rx.n == 0)
+			rx.state = RX_IDLE;
+		return;
+	}
+	case RX_IDLE:
+		break;
+	}
+
+	/* read-ahead gets first look, it may be partway through a push */
+	if (R_Feed(w))
+		return;
+
+	if (!crcValid(w))
+		return;
+
+	id = (w & PKT_CMD_ID) >> CMD_ID_SHIFT;
+	if ((w & PKT_CLASS) == CLASS_SYS && (w & PKT_SUBCMD) == SYS_ACK)
+		gotAck(id, (w & PKT_DATA) >> DATA_SHIFT);
+	else if ((w & PKT_CLASS) == CLASS_MEM && (w & PKT_SUBCMD) == MEM_READ)
+		blockHeader(id, (w & PKT_DATA) >> DATA_SHIFT);
+}
+
+static void txWord(void) {
+	const u8 *p;
+	u32 i, id, msg, word, flags;
+	u16 crcVal;
+
+	switch (tx.kind) {
+	case TX_SUBMIT: {
+		id = tx.id;
+		if (tx.pos == 0)
+			J_Send(q[id].addr);
+		else if (tx.pos == 1)
+			J_Send(reqLength(id));
+		else {
+			crcVal = crc16_update(crc16_update(CRC16_INIT, q[id].addr), reqLength(id));
+			J_Send(crc(CLASS_SYS | SYS_MW_TX_DONE | (id << CMD_ID_SHIFT) | (crcVal << DATA_SHIFT)));
+			q[id].state = Q_SUBMITTED;
+			q[id].idle = 0;
+			tx.kind = TX_NONE;
+		}
+		tx.pos++;
+		return;
+	}
+	case TX_BLOCK: {
+		id = tx.id;
+		if (tx.pos < tx.n) {
+			p = &q[id].buf[((tx.blk * BURST_BLOCK_WORDS) + tx.pos) * 4];
+			word = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; /* guest memory is BE */
+			J_Send(word);
+			tx.crc = crc16_update(tx.crc, word);
+			tx.pos++;
+			return;
+		}
+
+		J_Send(crc(CLASS_SYS | SYS_MW_TX_DONE | (id << CMD_ID_SHIFT) | (tx.crc << DATA_SHIFT)));
+		tx.kind = TX_NONE;
+		return;
+	}
+	case TX_NONE:
+		break;
+	}
+
+	/* in between: read-ahead chatter and ACKs first, they're short and someone's waiting on them */
+	if ((msg = R_Feedback())) {
+		J_Send(msg);
+		return;
+	}
+
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		if (q[id].ackPending) {
+			q[id].ackPending = false;
+			J_Send(crc(CLASS_SYS | SYS_ACK | (id << CMD_ID_SHIFT) | (q[id].ackData << DATA_SHIFT)));
+			return;
+		}
+	}
+
+	/* then new requests; the host drops any read-ahead it was partway through when it sees one */
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		if (q[id].state == Q_SUBMIT) {
+			/* only one read at a time can take a compressed reply */
+			flags = 0;
+			if (!q[id].write && !q[id].lzBad && q[id].words >= H_LZ_MIN_WORDS &&
+			    (H_Features & FEAT_LZ77) && (lzOwner < 0 || lzOwner == id)) {
+				lzOwner = id;
+				flags = READ_LZ_OK;
+			}
+
+			R_Abort();
+			if (q[id].disk)
+				msg = CLASS_BLK | (q[id].write ? BLK_WRITE : BLK_READ);
+			else
+				msg = CLASS_MEM | (q[id].write ? MEM_WRITE : MEM_READ);
+			J_Send(crc(msg | (id << CMD_ID_SHIFT) | ((2 | flags) << DATA_SHIFT)));
+			stats_req(&H_Stats, msg);
+			H_TRACE(TR_REQ, TR_SEND, msg | (id << CMD_ID_SHIFT), q[id].addr, reqLength(id));
+			tx.kind = TX_SUBMIT;
+			tx.id = id;
+			tx.pos = 0;
+			return;
+		}
+	}
+
+	/* the host never answered a request, ask again */
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		if (q[id].state == Q_SUBMITTED && ++q[id].idle > H_STALL_POLLS) {
+			H_Stats.retries++;
+			H_TRACE(TR_ERR, TR_RETRY, reqPkt(id), 0, 0);
+			q[id].state = Q_SUBMIT;
+		}
+	}
+
+	/* then write data, taking turns */
+	for (i = 1; i <= MAX_INFLIGHT; i++) {
+		id = (txNext + i) % MAX_INFLIGHT;
+		if (!q[id].write || q[id].state != Q_ACTIVE)
+			continue;
+
+		/* lost an ACK somewhere, go back to the last one we got */
+		if (++q[id].idle > H_STALL_POLLS) {
+			H_Stats.retries++;
+			H_TRACE(TR_ERR, TR_RETRY, reqPkt(id), q[id].acked, 0);
+			q[id].blk = q[id].acked;
+			q[id].idle = 0;
+		}
+
+		if (q[id].blk >= q[id].nblk || q[id].blk - q[id].acked >= BURST_WINDOW)
+			continue;
+
+		tx.kind = TX_BLOCK;
+		tx.id = id;
+		tx.blk = q[id].blk++;
+		tx.pos = 0;
+		tx.n = blockWords(q[id].words, tx.blk);
+		tx.crc = CRC16_INIT;
+		J_Send(crc(CLASS_MEM | MEM_DATA | (id << CMD_ID_SHIFT) | (tx.blk << DATA_SHIFT)));
+		txNext = id;
+		return;
+	}
+}
+
+/* the host took us back after losing the link, and has forgotten everything that was going; so do we, and ask again */
+static void restart(void) {
+	u32 id;
+
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		q[id].ackPending = false;
+		if (!inFlight(id))
+			continue;
+
+		q[id].blk = 0;
+		q[id].acked = 0;
+		q[id].seq = 0;
+		q[id].lastSeq = 0;
+		q[id].hunting = false;
+		H_SackReset(&q[id].sack);
+		q[id].idle = 0;
+		q[id].lzWords = 0;
+		q[id].nblk = (q[id].words + BURST_BLOCK_WORDS - 1) / BURST_BLOCK_WORDS;
+		q[id].state = Q_SUBMIT;
+	}
+	lzOwner = -1;
+	rx.state = RX_IDLE;
+}
+
+static bool busy(void) {
+	u32 id;
+
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		if (inFlight(id))
+			return true;
+	}
+	return false;
+}
+
+void H_PollTagged(void) {
+	while (J_RxReady())
+		rxWord(J_Read());
+
+	/* the host's been quiet a long time with things in flight; it may not know about them any more */
+	if (!busy())
+		H_Heard();
+	else if (tx.kind == TX_NONE && H_Quiet()) {
+		H_Rejoin();
+		restart();
+	}
+
+	if (!J_TxPending())
+		txWord();
+
+	/* the rest of a request or block can queue up, the serial IRQ feeds it to the host as it goes */
+	while (tx.kind != TX_NONE && J_TxRoom())
+		txWord();
+}
+
+/* a request mustn't overtake an earlier one that touches the same memory (or sectors) */
+static void waitOverlap(bool disk, u32 addr, int len) {
+	u32 id, start;
+
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		while (inFlight(id) && q[id].disk == disk) {
+			start = disk ? q[id].addr * BLK_SECTOR_SIZE : q[id].addr;
+			if (!(start < addr + len && addr < start + (q[id].words * 4)))
+				break;
+			H_PollTagged();
+		}
+	}
+}
+
+static int submit(bool write, bool disk, void *buf, u32 addr, int len) {
+	u32 id;
+
+	waitOverlap(disk, disk ? addr * BLK_SECTOR_SIZE : addr, len);
+	while (1) {
+		for (id = 0; id < MAX_INFLIGHT; id++) {
+			if (q[id].state == Q_FREE && !q[id].ackPending)
+				goto found;
+		}
+		H_PollTagged();
+	}
+
+found:
+	q[id].write = write;
+	q[id].disk = disk;
+	q[id].buf = buf;
+	q[id].addr = addr;
+	q[id].words = (len + 3) / 4;
+	q[id].nblk = (q[id].words + BURST_BLOCK_WORDS - 1) / BURST_BLOCK_WORDS;
+	q[id].blk = 0;
+	q[id].acked = 0;
+	q[id].seq = 0;
+	q[id].lastSeq = 0;
+	q[id].hunting = false;
+	H_SackReset(&q[id].sack);
+	q[id].idle = 0;
+	q[id].lzWords = 0;
+	q[id].lzBad = false;
+	q[id].start = K_Micros();
+	q[id].state = Q_SUBMIT;
+	return id;
+}
+
+int H_SubmitRead(void *buf, u32 addr, int len) {
+	if (!(H_Features & FEAT_TAGGED)) {
+		H_FetchMemBuf(buf, addr, len);
+		return H_NO_ID;
+	}
+
+	return submit(false, false, buf, addr, len);
+}
+
+int H_SubmitWrite(const void *buf, u32 addr, int len) {
+	if (!(H_Features & FEAT_TAGGED)) {
+		H_StoreMemBuf(buf, addr, len);
+		return H_NO_ID;
+	}
+
+	/* anything the host pushed for here is out of date now */
+	R_Drop(addr, len);
+	return submit(true, false, (void *)buf, addr, len);
+}
+
+int H_SubmitBlocks(bool write, void *buf, u32 sector, u32 count) {
+	return submit(write, true, buf, sector, count * BLK_SECTOR_SIZE);
+}
+
+void H_Settle(void) {
+	u32 id;
+
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		while (inFlight(id) || q[id].ackPending || tx.kind != TX_NONE)
+			H_PollTagged();
+	}
+}
+
+u32 H_FreeIds(void) {
+	u32 id, n = 0;
+
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		if (q[id].state == Q_FREE && !q[id].ackPending)
+			n++;
+	}
+	return n;
+}
+
+bool H_Done(int id) {
+	return id == H_NO_ID || q[id].state == Q_DONE || q[id].state == Q_FAILED;
+}
+
+bool H_Wait(int id) {
+	bool ok;
+
+	if (id == H_NO_ID)
+		return true;
+
+	while (!H_Done(id))
+		H_PollTagged();
+
+	/* make sure the host hears we're done before we go off and do something else */
+	while (q[id].ackPending)
+		H_PollTagged();
+
+	if (lzOwner == id)
+		lzOwner = -1;
+
+	ok = q[id].state == Q_DONE;
+	if (!ok && q[id].disk)
+		printf("Host refused %s of %lu sectors at %lu\n", q[id].write ? "write" : "read", reqLength(id), q[id].addr);
+	else if (!ok)
+		printf("Host refused %s of %luB at 0x%08lx\n", q[id].write ? "write" : "read", q[id].words * 4, q[id].addr);
+
+	q[id].state = Q_FREE;
+	return ok;
+}
@@ -0,0 +1,124 @@
+/*
+ * GBA Linux Loader - GBA Side - Interrupt driven JOY bus link
+ *
+ * The serial IRQ fires whenever the host writes us a word or reads the one
+ * we left it.  The handler moves the new word into the receive ring, and the
+ * next one from the transmit ring into the register, so the link keeps going
+ * while we're off running the guest.
+ *
+ * Both rings have one producer and one consumer, the handler on one end and
+ * everything else on the other, so all they need is for each side's data to
+ * be in place before it moves its index.  The one exception is getting the
+ * first word of a send going, which either side can do, so that's done with
+ * the IRQ held off.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <gba_types.h>
+#include "joy.h"
+
+#ifdef HW_SIM
+/* the simulator's "IRQ" is another thread */
+#define J_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define J_BARRIER() __asm__ volatile("" ::: "memory")
+#endif
+
+/* free running; head is where the next word goes in, tail where the next one comes out */
+static u32 rxRing[J_RX_RING], txRing[J_TX_RING];
+static volatile u32 rxHead, rxTail, txHead, txTail;
+
+u32 J_RxDropped;
+volatile u32 J_RxWords;
+
+/* the next queued word into the register, if the host has taken the last one; IRQ off */
+static void txKick(void) {
+	if (txTail == txHead || J_HwTxPending())
+		return;
+
+	J_HwSend(txRing[txTail & (J_TX_RING - 1)]);
+	J_BARRIER();
+	txTail++;
+}
+
+void J_Irq(void) {
+	u32 w;
+
+	J_HwAck();
+	if (J_HwRxReady()) {
+		w = J_HwRead();
+		J_RxWords++;
+		if (rxHead - rxTail < J_RX_RING) {
+			rxRing[rxHead & (J_RX_RING - 1)] = w;
+			J_BARRIER();
+			rxHead++;
+		}
+		else
+			J_RxDropped++;
+	}
+
+	txKick();
+}
+
+void J_Init(void) {
+	J_HwIrqInit(J_Irq);
+}
+
+bool J_RxReady(void) {
+	if (rxTail != rxHead)
+		return true;
+
+	J_HwIdle();
+	return rxTail != rxHead;
+}
+
+u32 J_Read(void) {
+	u32 w = rxRing[rxTail & (J_RX_RING - 1)];
+
+	J_BARRIER();
+	rxTail++;
+	return w;
+}
+
+void J_Send(u32 msg) {
+	u32 old;
+
+	while (txHead - txTail >= J_TX_RING)
+		J_HwIdle();
+
+	txRing[txHead & (J_TX_RING - 1)] = msg;
+	J_BARRIER();
+	txHead++;
+
+	old = J_HwIrqOff();
+	txKick();
+	J_HwIrqOn(old);
+}
+
+void J_SendLatest(u32 msg) {
+	u32 old = J_HwIrqOff();
+
+	if (txTail != txHead)
+		txRing[(txHead - 1) & (J_TX_RING - 1)] = msg;
+	else if (J_HwTxPending())
+		J_HwSend(msg);
+	else {
+		J_HwIrqOn(old);
+		J_Send(msg);
+		return;
+	}
+	J_HwIrqOn(old);
+}
+
+bool J_TxPending(void) {
+	if (txTail == txHead && !J_HwTxPending())
+		return false;
+
+	J_HwIdle();
+	return true;
+}
+
+u32 J_TxRoom(void) {
+	return J_TX_RING - (txHead - txTail);
+}
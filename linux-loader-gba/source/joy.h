@@ -0,0 +1,164 @@
+/*
+ * GBA Linux Loader - GBA Side - JOY bus link
+ *
+ * Two layers.  The J_Hw* calls are the registers themselves: one word each
+ * way, and a flag saying whether the other side has picked it up yet.  On
+ * top of those, J_RxReady/J_Read/J_Send and friends are what everything else
+ * uses.  The stub polls the registers directly; the loader, built with
+ * JOY_IRQ, has the serial IRQ move words between the registers and a pair of
+ * rings (joy.c), so nothing is lost while it's busy elsewhere and a whole
+ * block can be queued up to go without waiting on the host for each word.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _JOY_H
+#define _JOY_H
+
+#include <gba_types.h>
+
+#ifdef HW_SIM
+/* provided by the link simulator, which also stands in for the serial IRQ */
+extern bool J_HwRxReady(void);
+extern bool J_HwTxPending(void);
+extern u32  J_HwRead(void);
+extern void J_HwSend(u32 msg);
+extern void J_HwIrqInit(void (*handler)(void));
+extern u32  J_HwIrqOff(void);
+extern void J_HwIrqOn(u32 old);
+extern void J_HwIdle(void);
+extern void J_HwFlag(u16 flags);
+
+static inline void J_HwAck(void) {
+}
+#else
+#include <gba_interrupt.h>
+#include <gba_sio.h>
+
+/* host wrote a word that we haven't read yet */
+static inline bool J_HwRxReady(void) {
+	return REG_JSTAT & 0x2;
+}
+
+/* we wrote a word that the host hasn't read yet */
+static inline bool J_HwTxPending(void) {
+	return REG_JSTAT & 0x8;
+}
+
+/* read whatever the host last wrote, without waiting */
+static inline u32 J_HwRead(void) {
+	return REG_JOYRE;
+}
+
+/* hand a word to the host, without waiting */
+static inline void J_HwSend(u32 msg) {
+	REG_JOYTR = msg;
+}
+
+/* an IRQ for every word that comes in or goes out */
+static inline void J_HwIrqInit(IntFn handler) {
+	irqSet(IRQ_SERIAL, handler);
+	irqEnable(IRQ_SERIAL);
+	REG_SIOCNT |= SIO_IRQ;
+}
+
+/* the receive and send complete flags are cleared by writing them back */
+static inline void J_HwAck(void) {
+	REG_JOYCNT = REG_JOYCNT;
+}
+
+static inline u32 J_HwIrqOff(void) {
+	u32 old = REG_IME;
+
+	REG_IME = 0;
+	return old;
+}
+
+static inline void J_HwIrqOn(u32 old) {
+	REG_IME = old;
+}
+
+/* called while spinning on the link, nothing to do on hardware */
+static inline void J_HwIdle(void) {
+}
+
+/* raise general purpose flags in our JOY status, for the host to see */
+static inline void J_HwFlag(u16 flags) {
+	REG_JSTAT |= flags;
+}
+#endif /* HW_SIM */
+
+#ifdef JOY_IRQ
+#define J_RX_RING (512) /* words, a power of two; room for a whole push and then some */
+#define J_TX_RING (64)  /* words, a power of two */
+
+/* words the host sent while the receive ring was full */
+extern u32 J_RxDropped;
+/* every word the host has sent, kept or not; only ever goes up */
+extern volatile u32 J_RxWords;
+
+/* install the serial IRQ handler, before anything goes over the link */
+extern void J_Init(void);
+extern void J_Irq(void);
+
+/* host sent a word that we haven't read yet */
+extern bool J_RxReady(void);
+/* the next word from the host, only once J_RxReady() says there is one */
+extern u32  J_Read(void);
+/* queue a word for the host, waiting only if the ring is full */
+extern void J_Send(u32 msg);
+/* replace whatever we queued that the host hasn't picked up yet, for ACKs where only the latest one matters */
+extern void J_SendLatest(u32 msg);
+/* something we sent that the host hasn't read yet */
+extern bool J_TxPending(void);
+/* how many more words J_Send() can queue without waiting */
+extern u32  J_TxRoom(void);
+#else
+static inline bool J_RxReady(void) {
+	if (J_HwRxReady())
+		return true;
+	J_HwIdle();
+	return false;
+}
+
+static inline u32 J_Read(void) {
+	return J_HwRead();
+}
+
+/* overwrites a word the host hasn't read yet */
+static inline void J_Send(u32 msg) {
+	J_HwSend(msg);
+}
+
+static inline void J_SendLatest(u32 msg) {
+	J_HwSend(msg);
+}
+
+static inline bool J_TxPending(void) {
+	if (!J_HwTxPending())
+		return false;
+	J_HwIdle();
+	return true;
+}
+#endif /* JOY_IRQ */
+
+/* wait for, and read, the next word from the host */
+static inline u32 J_Recv(void) {
+	while (!J_RxReady());
+	return J_Read();
+}
+
+/* wait for the host to pick up the last word we sent */
+static inline void J_Flush(void) {
+	while (J_TxPending());
+}
+
+/* throw away anything the host sent us, and wait for it to read our last word */
+static inline void J_Drain(void) {
+	while (J_RxReady() || J_TxPending()) {
+		if (J_RxReady())
+			(void)J_Read();
+	}
+}
+
+#endif /* _JOY_H */
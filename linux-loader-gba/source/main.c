@@ -9,15 +9,39 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include "comms.h"
+#include "joy.h"
+#include "clock.h"
+#include "host.h"
+#include "pagecache.h"
+#ifdef CRC_BENCH
+#include "crcbench.h"
+#endif
 
 /* uc-rv32ima-gba entry */
 extern void app_main(void);
 
+#ifdef CRC_BENCH
+/* timers 2+3 cascaded, counting at the CPU clock */
+static u32 cycles(void) {
+	u16 hi, lo;
+
+	do {
+		hi = REG_TM3CNT_L;
+		lo = REG_TM2CNT_L;
+	} while (hi != REG_TM3CNT_L);
+
+	return (hi << 16) | lo;
+}
+#endif
+
 int main(void) {
-	u32 rx;
+	u32 rx, flags, entry = 0, sectors = 0, words = 0, session = 0, i;
+	u16 crcVal;
 
 	irqInit();
-	irqEnable(IRQ_SERIAL);
+	J_Init();
+	K_Init();
+	H_InitTrace();
 
 	consoleInit(	0,	// charbase
 			4,	// mapbase
@@ -36,10 +60,17 @@ int main(void) {
 
 	iprintf("Hello World!\n");
 
+#ifdef CRC_BENCH
+	REG_TM2CNT_L = 0;
+	REG_TM3CNT_L = 0;
+	REG_TM3CNT_H = TIMER_START | TIMER_COUNT;
+	REG_TM2CNT_H = TIMER_START;
+	crc_bench(cycles);
+#endif
+
 	/* handle incoming ping */
 	while (1) {
-		while (!(REG_JSTAT & 0x2));
-		rx = REG_JOYRE;
+		rx = J_Recv();
 
 		if (!crcValid(rx))
 			continue;
@@ -55,27 +86,32 @@ int main(void) {
 	puts("Got ping");
 
 	/* send ACK */
-	REG_JOYTR = crc(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
+	J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */));
 	puts("Sent ACK");
 
 	/* wait for host to read it */
-	while (REG_JSTAT & 0x8);
+	J_Flush();
 
 	/* send ping reply */
-	REG_JOYTR = crc(CLASS_SYS | SYS_PING_REPLY | 0 /* id */ | (0x4849 << DATA_SHIFT));
+	J_Send(crc(CLASS_SYS | SYS_PING_REPLY | 0 /* id */ | (0x4849 << DATA_SHIFT)));
 	puts("Sent ping reply");
 
 	/* wait for host to read it */
-	while (REG_JSTAT & 0x8);
+	J_Flush();
 
 	/* wait for incoming ping reply ACK */
 	while (1) {
-		while (!(REG_JSTAT & 0x2));
-		rx = REG_JOYRE;
+		rx = J_Recv();
 
 		if (!crcValid(rx))
 			continue;
 
+		/* the host can be on to negotiating before we see the ACK; it asks again if we miss that */
+		if ((rx & PKT_CLASS)  == CLASS_SYS    &&
+		    (rx & PKT_SUBCMD) == SYS_FEATURES &&
+		    (rx & PKT_CMD_ID) == 0)
+			break;
+
 		if ((rx & PKT_CLASS) != CLASS_SYS ||
 		   (rx & PKT_SUBCMD) != SYS_ACK   ||
 		   (rx & PKT_CMD_ID) != 0         ||
@@ -86,32 +122,118 @@ int main(void) {
 	}
 	puts("Got ping reply ACK");
 
-	/* wait to be told to load the kernel */
+	/* wait to be told to load the kernel, negotiating features along the way */
 	while (1) {
-		while (!(REG_JSTAT & 0x2));
-		rx = REG_JOYRE;
+		rx = J_Recv();
 
 		if (!crcValid(rx)) {
 			puts("invalid crc");
 			continue;
 		}
 
+		if ((rx & PKT_CLASS)  == CLASS_SYS    &&
+		    (rx & PKT_SUBCMD) == SYS_FEATURES &&
+		    (rx & PKT_CMD_ID) == 0) {
+			/* may arrive more than once if the host missed our reply */
+			H_Features = ((rx & PKT_DATA) >> DATA_SHIFT) & H_SUPPORTED_FEATURES;
+			/* tagged data moves in burst blocks, and nothing's paced with them */
+			if (!(H_Features & FEAT_BURST))
+				H_Features &= ~(FEAT_TAGGED | FEAT_SACK | FEAT_FEC);
+			else
+				H_Features &= ~FEAT_PACE;
+			J_Send(crc(CLASS_SYS | SYS_FEATURES | 0 /* id */ | (H_Features << DATA_SHIFT)));
+			printf("Features: 0x%04lx\n", H_Features);
+			continue;
+		}
+
+		/* the host timing how fast it can send us paced words */
+		if ((rx & PKT_CLASS)  == CLASS_SYS &&
+		    (rx & PKT_SUBCMD) == SYS_PING  &&
+		    (rx & PKT_CMD_ID) == 0         &&
+		    (((rx & PKT_DATA) >> DATA_SHIFT) & 0xff) == PING_PROBE) {
+			H_Probe((rx & PKT_DATA) >> (DATA_SHIFT + 8));
+			continue;
+		}
+
 		if ((rx & PKT_CLASS) != CLASS_SYS       ||
 		   (rx & PKT_SUBCMD) != SYS_KERNEL_LOAD ||
-		   (rx & PKT_CMD_ID) != 0               ||
-		   (rx & PKT_DATA)   != 0) {
+		   (rx & PKT_CMD_ID) != 0) {
 			printf("BS packet: 0x%08lX\n", rx);
 			continue;
 		}
 
+		flags = (rx & PKT_DATA) >> DATA_SHIFT;
+		if (flags == 0)
+			break;
+
+		if (flags & ~(KERNEL_LOAD_ENTRY | KERNEL_LOAD_DISK | KERNEL_LOAD_RESUME | KERNEL_LOAD_SESSION)) {
+			printf("BS packet: 0x%08lX\n", rx);
+			continue;
+		}
+
+		/* whichever of the entry point, disk size, core state and session the flags say are coming, and a CRC of them to follow */
+		crcVal = CRC16_INIT;
+		if (flags & KERNEL_LOAD_ENTRY) {
+			entry = J_Recv();
+			crcVal = crc16_update(crcVal, entry);
+		}
+		if (flags & KERNEL_LOAD_DISK) {
+			sectors = J_Recv();
+			crcVal = crc16_update(crcVal, sectors);
+		}
+		if (flags & KERNEL_LOAD_RESUME) {
+			/* more than there's room for can't be right, the CRC won't match what's left */
+			words = J_Recv();
+			crcVal = crc16_update(crcVal, words);
+			for (i = 0; i < words && i < SAVE_MAX_WORDS; i++) {
+				H_ResumeCore[i] = J_Recv();
+				crcVal = crc16_update(crcVal, H_ResumeCore[i]);
+			}
+		}
+		if (flags & KERNEL_LOAD_SESSION) {
+			session = J_Recv();
+			crcVal = crc16_update(crcVal, session);
+		}
+		rx = J_Recv();
+		if (!crcValid(rx)                       ||
+		   (rx & PKT_CLASS)  != CLASS_SYS       ||
+		   (rx & PKT_SUBCMD) != SYS_MW_TX_DONE  ||
+		   (rx & PKT_CMD_ID) != 0               ||
+		   ((rx & PKT_DATA) >> DATA_SHIFT) != crcVal ||
+		   words > SAVE_MAX_WORDS) {
+			J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | (BURST_ACK_RETRY << DATA_SHIFT)));
+			continue;
+		}
+
+		if (flags & KERNEL_LOAD_ENTRY) {
+			H_KernelEntry = entry;
+			printf("Kernel entry: 0x%08lx\n", H_KernelEntry);
+		}
+		if (flags & KERNEL_LOAD_DISK) {
+			H_DiskSectors = sectors;
+			printf("Disk: %lu sectors\n", H_DiskSectors);
+		}
+		if (flags & KERNEL_LOAD_RESUME) {
+			H_ResumeWords = words;
+			printf("Resuming, %lu words of core state\n", H_ResumeWords);
+		}
+		if (flags & KERNEL_LOAD_SESSION) {
+			/* from here on, the host can tell we're still going if it loses us */
+			H_Session = session;
+			J_HwFlag(JSTAT_SESSION);
+			printf("Session %08lx\n", H_Session);
+		}
 		break;
 	}
 
 	/* ACK it */
-	REG_JOYTR = crc(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
+	J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */));
 	puts("All is well. Booting kernel...");
 	sleep(1);
-	REG_JOYTR = 0;
+	J_Send(0);
+
+	if (!P_Init(P_DEFAULT_LINE_SHIFT, P_DEFAULT_WAYS, P_DEFAULT_POLICY))
+		puts("Page cache off, running uncached");
 
 	/* uc-rv32ima-gba entry */
 	app_main();
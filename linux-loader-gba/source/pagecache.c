@@ -0,0 +1,397 @@
+/*
+ * GBA Linux Loader - GBA Side - Guest page cache
+ *
+ * Set-associative, write-back cache of guest memory, in front of the link.
+ * Line size, associativity and replacement policy are picked at P_Init()
+ * time, the storage is a fixed P_CACHE_BYTES.  Sets are a power of two, so
+ * the set index is just the low bits of the line number.
+ *
+ * Each line remembers the word-aligned range of it that's been written.
+ * When a dirty line goes out, any dirty lines that carry on straight after
+ * it go out in the same MEM_WRITE.
+ *
+ * With tagged requests, P_Prefetch() can start filling lines and leave them
+ * coming in while the guest runs out of what's already here.  A line that's
+ * still filling is in the cache as far as find() is concerned; whoever uses
+ * it first waits for the rest of it.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <string.h>
+#include <gba_types.h>
+#include "comms.h"
+#include "host.h"
+#include "pagecache.h"
+
+#define TAG_INVALID (0xffffffff)
+
+struct _pcStats P_Stats;
+
+static u8 lineData[P_CACHE_BYTES] EWRAM_BSS __attribute__((aligned(4)));
+static u32 lineTag[P_MAX_LINES] EWRAM_BSS;  /* guest line number, or TAG_INVALID */
+static u32 lineUse[P_MAX_LINES] EWRAM_BSS;  /* LRU: last use stamp, CLOCK: referenced bit */
+static u16 dirtyLo[P_MAX_LINES] EWRAM_BSS;  /* dirty byte range in the line, empty if lo == hi */
+static u16 dirtyHi[P_MAX_LINES] EWRAM_BSS;
+static u8 clockHand[P_MAX_LINES] EWRAM_BSS; /* per set, CLOCK only */
+
+/*
+ * write-back runs get gathered here, one MEM_WRITE's worth each; with tagged
+ * requests one can be on the wire while we fill the other
+ */
+static u8 wbBuf[2][WRITE_MAX_WORDS * 4] EWRAM_BSS __attribute__((aligned(4)));
+static int wbId[2] = { H_NO_ID, H_NO_ID };
+static int wbCur;
+
+/* lines still filling in the background, oldest first */
+static struct {
+	int id;
+	u32 idx;
+} fill[MAX_INFLIGHT];
+static u32 fills;
+
+static u32 lineShift, lineMask, ways, setMask, stamp;
+static int policy;
+
+/* wait for fill i to land, and take it off the list */
+static void finishFill(u32 i) {
+	u32 idx = fill[i].idx;
+	bool ok = H_Wait(fill[i].id);
+
+	fills--;
+	memmove(&fill[i], &fill[i + 1], (fills - i) * sizeof(fill[0]));
+
+	/* the host refused it, so what's there is garbage */
+	if (!ok)
+		lineTag[idx] = TAG_INVALID;
+}
+
+/* if line idx is still filling, wait for it */
+static void waitFill(u32 idx) {
+	u32 i;
+
+	for (i = 0; i < fills; i++) {
+		if (fill[i].idx == idx) {
+			finishFill(i);
+			return;
+		}
+	}
+}
+
+/* a request of ours can't get an id while fills nobody's waited on hold them all */
+static void makeRoom(void) {
+	while (fills && !H_FreeIds())
+		finishFill(0);
+}
+
+void P_Settle(void) {
+	while (fills)
+		finishFill(0);
+}
+
+void P_Invalidate(void) {
+	u32 i;
+
+	P_Settle();
+	for (i = 0; i < P_MAX_LINES; i++) {
+		lineTag[i] = TAG_INVALID;
+		lineUse[i] = 0;
+		dirtyLo[i] = dirtyHi[i] = 0;
+		clockHand[i] = 0;
+	}
+	stamp = 0;
+}
+
+bool P_Init(u32 shift, u32 nways, int pol) {
+	u32 sets;
+
+	lineShift = 0;
+	if (shift < P_MIN_LINE_SHIFT || shift > P_MAX_LINE_SHIFT)
+		return false;
+
+	/* need a power of two number of ways that leaves at least one set */
+	if (!nways || (nways & (nways - 1)) || (nways << shift) > P_CACHE_BYTES)
+		return false;
+
+	if (pol != P_LRU && pol != P_CLOCK)
+		return false;
+
+	sets = P_CACHE_BYTES / (nways << shift);
+	setMask = sets - 1;
+	ways = nways;
+	policy = pol;
+	lineMask = (1 << shift) - 1;
+
+	P_Invalidate();
+	memset(&P_Stats, 0, sizeof(P_Stats));
+
+	lineShift = shift;
+	return true;
+}
+
+bool P_Enabled(void) {
+	return lineShift != 0;
+}
+
+/* where guest line number `tag' is cached, or -1 */
+static int find(u32 tag) {
+	u32 base, i;
+
+	base = (tag & setMask) * ways;
+	for (i = 0; i < ways; i++) {
+		if (lineTag[base + i] == tag)
+			return base + i;
+	}
+	return -1;
+}
+
+bool P_Cached(u32 addr) {
+	return P_Enabled() && find(addr >> lineShift) >= 0;
+}
+
+static inline bool isDirty(u32 idx) {
+	return dirtyLo[idx] != dirtyHi[idx];
+}
+
+/*
+ * Write back the dirty range of line idx, along with the lines after it
+ * for as long as each dirty range runs into the next, up to one MEM_WRITE.
+ */
+static void writeBack(u32 idx) {
+	u32 addr, tag, lo, hi, n = 0;
+	u8 *buf;
+	int next;
+
+	/* still going out from last time? */
+	wbCur ^= 1;
+	H_Wait(wbId[wbCur]);
+	buf = wbBuf[wbCur];
+
+	tag = lineTag[idx];
+	addr = (tag << lineShift) + dirtyLo[idx];
+	while (1) {
+		lo = dirtyLo[idx];
+		hi = dirtyHi[idx];
+		memcpy(&buf[n], &lineData[(idx << lineShift) + lo], hi - lo);
+		n += hi - lo;
+		dirtyLo[idx] = dirtyHi[idx] = 0;
+
+		/* does the next line pick up where this one left off? */
+		if (hi != lineMask + 1)
+			break;
+
+		next = find(++tag);
+		if (next < 0 || !isDirty(next) || dirtyLo[next] != 0 ||
+		    n + dirtyHi[next] > sizeof(wbBuf[0]))
+			break;
+
+		idx = next;
+	}
+
+	P_Stats.writeBacks++;
+	makeRoom();
+	wbId[wbCur] = H_SubmitWrite(buf, addr, n);
+}
+
+/* does line idx just carry on a dirty range from the line before it? */
+static bool continuesRun(u32 idx) {
+	int prev;
+
+	if (dirtyLo[idx] != 0 || lineTag[idx] == 0)
+		return false;
+
+	prev = find(lineTag[idx] - 1);
+	return prev >= 0 && dirtyHi[prev] == lineMask + 1;
+}
+
+void P_Flush(void) {
+	bool again;
+	u32 i, lines;
+
+	if (!P_Enabled())
+		return;
+
+	lines = (setMask + 1) * ways;
+	do {
+		/* start every run from its first line; anything left over goes next pass */
+		again = false;
+		for (i = 0; i < lines; i++) {
+			if (!isDirty(i))
+				continue;
+
+			if (continuesRun(i))
+				again = true;
+			else
+				writeBack(i);
+		}
+	} while (again);
+
+	/* synced means the host has it */
+	H_Wait(wbId[0]);
+	H_Wait(wbId[1]);
+	wbId[0] = wbId[1] = H_NO_ID;
+}
+
+/* pick a line in the set to replace, empty ones first */
+static u32 victim(u32 base) {
+	u32 i, best;
+
+	for (i = 0; i < ways; i++) {
+		if (lineTag[base + i] == TAG_INVALID)
+			return base + i;
+	}
+
+	P_Stats.evictions++;
+	if (policy == P_CLOCK) {
+		u8 *hand = &clockHand[base / ways];
+
+		/* second chance: skip and clear referenced lines until we find one that isn't */
+		while (lineUse[base + *hand]) {
+			lineUse[base + *hand] = 0;
+			*hand = (*hand + 1) & (ways - 1);
+		}
+		best = base + *hand;
+		*hand = (*hand + 1) & (ways - 1);
+	}
+	else {
+		best = base;
+		for (i = 1; i < ways; i++) {
+			if (lineUse[base + i] < lineUse[best])
+				best = base + i;
+		}
+	}
+
+	waitFill(best);
+	if (isDirty(best))
+		writeBack(best);
+	return best;
+}
+
+/*
+ * Find the line for guest line number `tag', making room on a miss.
+ * Fetch its contents too, unless the caller is about to overwrite all of it.
+ */
+static u8 *lookup(u32 tag, bool fill) {
+	int idx;
+
+	idx = find(tag);
+	if (idx >= 0)
+		waitFill(idx); /* which throws the line out if the host refused it */
+	if (idx >= 0 && lineTag[idx] == tag) {
+		P_Stats.hits++;
+		goto found;
+	}
+
+	P_Stats.misses++;
+	idx = victim((tag & setMask) * ways);
+	lineTag[idx] = TAG_INVALID; /* in case the fetch gets interrupted */
+	if (fill) {
+		makeRoom();
+		H_FetchMemBuf(&lineData[idx << lineShift], tag << lineShift, 1 << lineShift);
+	}
+	lineTag[idx] = tag;
+
+found:
+	lineUse[idx] = (policy == P_CLOCK) ? 1 : ++stamp;
+	return &lineData[idx << lineShift];
+}
+
+void P_Read(void *buf, u32 addr, int len) {
+	u8 *dst = buf;
+	u32 off, n;
+
+	while (len > 0) {
+		off = addr & lineMask;
+		n = (lineMask + 1) - off;
+		if (n > len)
+			n = len;
+
+		memcpy(dst, lookup(addr >> lineShift, true) + off, n);
+		dst += n;
+		addr += n;
+		len -= n;
+	}
+}
+
+void P_Write(const void *buf, u32 addr, int len) {
+	const u8 *src = buf;
+	u32 off, n, lo, hi, idx;
+	u8 *line;
+
+	while (len > 0) {
+		off = addr & lineMask;
+		n = (lineMask + 1) - off;
+		if (n > len)
+			n = len;
+
+		/* no point fetching a line we're about to overwrite completely */
+		line = lookup(addr >> lineShift, n != lineMask + 1);
+		memcpy(line + off, src, n);
+
+		/* the link moves whole words, and the rest of the line is valid anyway */
+		idx = (line - lineData) >> lineShift;
+		lo = off & ~3;
+		hi = (off + n + 3) & ~3;
+		if (isDirty(idx)) {
+			if (dirtyLo[idx] < lo)
+				lo = dirtyLo[idx];
+			if (dirtyHi[idx] > hi)
+				hi = dirtyHi[idx];
+		}
+		dirtyLo[idx] = lo;
+		dirtyHi[idx] = hi;
+
+		src += n;
+		addr += n;
+		len -= n;
+	}
+}
+
+void P_Prefetch(u32 addr, int len) {
+	u32 tag, last;
+	int idx;
+
+	/* without tags, nothing can be left running */
+	if (!P_Enabled() || !(H_Features & FEAT_TAGGED) || len <= 0)
+		return;
+
+	last = (addr + len - 1) >> lineShift;
+	for (tag = addr >> lineShift; tag <= last; tag++) {
+		if (find(tag) >= 0)
+			continue;
+
+		/* only with an id to spare for whoever needs one next */
+		if (fills == MAX_INFLIGHT - 1 || H_FreeIds() < 2)
+			break;
+
+		P_Stats.prefetches++;
+		idx = victim((tag & setMask) * ways);
+		makeRoom();
+		lineTag[idx] = tag;
+		lineUse[idx] = (policy == P_CLOCK) ? 1 : ++stamp;
+		fill[fills].idx = idx;
+		fill[fills].id = H_SubmitRead(&lineData[idx << lineShift], tag << lineShift, 1 << lineShift);
+		fills++;
+	}
+}
+
+bool P_Ready(u32 addr, int len) {
+	u32 tag, last, i;
+	int idx;
+
+	if (!P_Enabled() || len <= 0)
+		return false;
+
+	last = (addr + len - 1) >> lineShift;
+	for (tag = addr >> lineShift; tag <= last; tag++) {
+		idx = find(tag);
+		if (idx < 0)
+			return false;
+
+		for (i = 0; i < fills; i++) {
+			if (fill[i].idx == idx && !H_Done(fill[i].id))
+				return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,70 @@
+/*
+ * GBA Linux Loader - GBA Side - Guest page cache
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _PAGECACHE_H
+#define _PAGECACHE_H
+
+#include <gba_types.h>
+
+/* total space for cached lines, in EWRAM */
+#define P_CACHE_BYTES    (64 * 1024)
+
+/* allowed line sizes, 64B - 4KB */
+#define P_MIN_LINE_SHIFT (6)
+#define P_MAX_LINE_SHIFT (12)
+#define P_MAX_LINES      (P_CACHE_BYTES >> P_MIN_LINE_SHIFT)
+
+/* replacement policies */
+#define P_LRU            (0)
+#define P_CLOCK          (1)
+
+/* what main.c sets up; build with different ones to experiment */
+#ifndef P_DEFAULT_LINE_SHIFT
+#define P_DEFAULT_LINE_SHIFT (9)
+#endif
+#ifndef P_DEFAULT_WAYS
+#define P_DEFAULT_WAYS       (4)
+#endif
+#ifndef P_DEFAULT_POLICY
+#define P_DEFAULT_POLICY     P_LRU
+#endif
+
+struct _pcStats {
+	u32 hits;      /* line lookups served locally */
+	u32 misses;    /* line lookups that went over the link */
+	u32 evictions; /* valid lines thrown out to make room */
+	u32 writeBacks; /* MEM_WRITEs sent for dirty lines */
+	u32 prefetches; /* lines P_Prefetch() started filling */
+};
+
+extern struct _pcStats P_Stats;
+
+/* returns false, and leaves the cache off, if the geometry doesn't fit */
+extern bool P_Init(u32 lineShift, u32 ways, int policy);
+extern bool P_Enabled(void);
+/* drops everything, including writes that haven't gone out yet */
+extern void P_Invalidate(void);
+
+/* is the line holding addr in the cache? */
+extern bool P_Cached(u32 addr);
+
+extern void P_Read(void *buf, u32 addr, int len);
+extern void P_Write(const void *buf, u32 addr, int len);
+/* write back every dirty line, merging neighbours into as few MEM_WRITEs as we can */
+extern void P_Flush(void);
+
+/*
+ * Start filling whatever lines of [addr, addr + len) aren't cached, without
+ * waiting for them; only with FEAT_TAGGED.  Stops early rather than wait for an
+ * id, so some of it may not be asked for.
+ */
+extern void P_Prefetch(u32 addr, int len);
+/* would P_Read() of [addr, addr + len) be served without waiting on the link? */
+extern bool P_Ready(u32 addr, int len);
+/* wait for every line P_Prefetch() started, so its ids are free */
+extern void P_Settle(void);
+
+#endif /* _PAGECACHE_H */
@@ -0,0 +1,192 @@
+/*
+ * GBA Linux Loader - GBA Side - Host read-ahead
+ *
+ * The host pushes the blocks it thinks we'll MEM_READ next, one word at a
+ * time, whenever the link is idle.  We pick them up between guest memory
+ * accesses (R_Poll(), or R_Feed() from the tagged request code) and park
+ * them in a small ring of slots, where H_FetchMemBuf() looks before going
+ * to the host.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <string.h>
+#include <gba_types.h>
+#include "comms.h"
+#include "joy.h"
+#include "host.h"
+#include "pagecache.h"
+#include "readahead.h"
+
+struct _raStats R_Stats;
+
+static u8 slotData[R_SLOTS][R_SLOT_BYTES] EWRAM_BSS __attribute__((aligned(4)));
+static u32 slotAddr[R_SLOTS];
+static u32 slotLen[R_SLOTS]; /* 0 if empty */
+static u32 nextSlot;
+
+/* push in progress */
+static enum {
+	R_IDLE,   /* waiting for a MEM_PUSH header */
+	R_ADDR,   /* waiting for its address */
+	R_DATA,   /* taking data words */
+	R_TRAILER /* waiting for the CRC */
+} state = R_IDLE;
+static u32 pushAddr, pushWords, pushPos, pushSlot;
+static u16 pushCrc;
+
+/* things to tell the host: used pushes it doesn't know about yet, and the rest */
+static u32 pendingHits;
+static bool cancelPending, waitPending;
+
+static bool have(u32 addr) {
+	int i;
+
+	for (i = 0; i < R_SLOTS; i++) {
+		if (slotLen[i] && slotAddr[i] == addr)
+			return true;
+	}
+	return false;
+}
+
+static void cancel(void) {
+	cancelPending = true;
+	R_Stats.cancels++;
+	state = R_IDLE;
+}
+
+bool R_Feed(u32 rx) {
+	switch (state) {
+	case R_IDLE: {
+		/* anything that isn't the start of a push is someone else's */
+		if (!crcValid(rx)                  ||
+		   (rx & PKT_CLASS)  != CLASS_MEM  ||
+		   (rx & PKT_SUBCMD) != MEM_PUSH)
+			return false;
+
+		pushWords = (rx & PKT_DATA) >> DATA_SHIFT;
+		if (!pushWords || pushWords > R_SLOT_BYTES / 4) {
+			cancel();
+			break;
+		}
+		state = R_ADDR;
+		break;
+	}
+	case R_ADDR: {
+		/* already got it one way or another? */
+		pushAddr = rx;
+		if (have(pushAddr) || P_Cached(pushAddr)) {
+			cancel();
+			break;
+		}
+
+		pushSlot = nextSlot;
+		nextSlot = (nextSlot + 1) % R_SLOTS;
+		slotLen[pushSlot] = 0; /* not usable until the CRC checks out */
+		pushCrc = crc16_update(CRC16_INIT, pushAddr);
+		pushPos = 0;
+		state = R_DATA;
+		break;
+	}
+	case R_DATA: {
+		((u32 *)slotData[pushSlot])[pushPos] = __builtin_bswap32(rx); /* keep it BE, same as H_FetchMemBuf */
+		pushCrc = crc16_update(pushCrc, rx);
+		if (++pushPos == pushWords)
+			state = R_TRAILER;
+		break;
+	}
+	case R_TRAILER: {
+		if (crcValid(rx)                        &&
+		   (rx & PKT_CLASS)  == CLASS_SYS       &&
+		   (rx & PKT_SUBCMD) == SYS_MW_TX_DONE  &&
+		   ((rx & PKT_DATA) >> DATA_SHIFT) == pushCrc) {
+			slotAddr[pushSlot] = pushAddr;
+			slotLen[pushSlot] = pushWords * 4;
+			R_Stats.pushes++;
+		}
+		else
+			R_Stats.bad++;
+
+		state = R_IDLE;
+		break;
+	}
+	}
+	return true;
+}
+
+u32 R_Feedback(void) {
+	u32 n;
+
+	if (cancelPending) {
+		cancelPending = false;
+		return crc(CLASS_MEM | MEM_PUSH | 0 /* id */ | ((PUSH_CANCEL | (R_SLOT_BYTES / 4)) << DATA_SHIFT));
+	}
+
+	if (!pendingHits && !waitPending)
+		return 0;
+
+	n = (pendingHits > PUSH_COUNT) ? PUSH_COUNT : pendingHits;
+	pendingHits -= n;
+	if (waitPending) {
+		waitPending = false;
+		n |= PUSH_WAIT;
+	}
+	return crc(CLASS_MEM | MEM_PUSH | 0 /* id */ | (n << DATA_SHIFT));
+}
+
+void R_Poll(void) {
+	u32 msg;
+
+	while (J_RxReady())
+		R_Feed(J_Read());
+
+	/* let the host know how well it's guessing, once the line is free */
+	if (!J_TxPending() && (msg = R_Feedback()))
+		J_Send(msg);
+}
+
+static bool pushing(u32 addr) {
+	return (state == R_DATA || state == R_TRAILER) && pushAddr == addr;
+}
+
+void R_Wait(u32 addr) {
+	if (!pushing(addr))
+		return;
+
+	/* tell the host we're stuck waiting, so it can stop checking on us before every word */
+	waitPending = true;
+	while (pushing(addr))
+		H_Poll();
+}
+
+bool R_Busy(void) {
+	return state != R_IDLE;
+}
+
+void R_Abort(void) {
+	state = R_IDLE;
+}
+
+bool R_Take(void *buf, u32 addr, int len) {
+	int i;
+
+	for (i = 0; i < R_SLOTS; i++) {
+		if (slotLen[i] && slotAddr[i] == addr && slotLen[i] >= len) {
+			memcpy(buf, slotData[i], len);
+			slotLen[i] = 0;
+			pendingHits++;
+			R_Stats.hits++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void R_Drop(u32 addr, int len) {
+	int i;
+
+	for (i = 0; i < R_SLOTS; i++) {
+		if (slotLen[i] && slotAddr[i] < addr + len && addr < slotAddr[i] + slotLen[i])
+			slotLen[i] = 0;
+	}
+}
@@ -0,0 +1,51 @@
+/*
+ * GBA Linux Loader - GBA Side - Host read-ahead
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _READAHEAD_H
+#define _READAHEAD_H
+
+#include <gba_types.h>
+
+/* pushed blocks we can hold on to, oldest gets replaced first */
+#define R_SLOTS      (8)
+#define R_SLOT_BYTES (1024)
+
+struct _raStats {
+	u32 pushes;  /* blocks that arrived intact */
+	u32 hits;    /* of those, ones we ended up using */
+	u32 cancels; /* pushes we turned down */
+	u32 bad;     /* pushes that failed their CRC */
+};
+
+extern struct _raStats R_Stats;
+
+/* pick up anything the host pushed at us, and tell it what got used */
+extern void R_Poll(void);
+
+/*
+ * Same thing a word at a time, for when someone else owns the link.
+ * R_Feed() returns false if the word isn't part of a push, R_Feedback()
+ * hands back the next word to send the host, or 0.
+ */
+extern bool R_Feed(u32 rx);
+extern u32  R_Feedback(void);
+
+/* partway through a push? */
+extern bool R_Busy(void);
+
+/* if the host is partway through pushing addr, finish taking it */
+extern void R_Wait(u32 addr);
+
+/* forget a push we were partway through, the host has given up on it */
+extern void R_Abort(void);
+
+/* copy out a pushed block for [addr, addr + len), if we have one */
+extern bool R_Take(void *buf, u32 addr, int len);
+
+/* throw away pushed copies of [addr, addr + len), they're stale now */
+extern void R_Drop(u32 addr, int len);
+
+#endif /* _READAHEAD_H */
@@ -0,0 +1 @@
+../../common/stats.h
\ No newline at end of file
@@ -0,0 +1,63 @@
+/*
+ * GBA Linux Loader - Stub - Boot
+ *
+ * Runs from IWRAM: unpacking the loader to the start of EWRAM overwrites
+ * the rest of the stub.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <gba_types.h>
+#include "comms.h"
+#include "joy.h"
+#include "stub.h"
+
+#ifdef HW_SIM
+#include <gba_systemcalls.h>
+#else
+#include <gba_interrupt.h>
+#endif
+
+struct _bootInfo B_Info;
+
+/* libgba's LZ77UnCompWram is in EWRAM along with everything else, go straight to the BIOS */
+static inline void unpack(const void *src, void *dst) {
+#ifdef HW_SIM
+	LZ77UnCompWram(src, dst);
+#else
+	register const void *r0 asm("r0") = src;
+	register void *r1 asm("r1") = dst;
+
+	asm volatile("swi 0x110000" : "+r"(r0), "+r"(r1) : : "r2", "r3", "memory");
+#endif
+}
+
+IWRAM_CODE void B_Boot(void) {
+	const u32 *src = B_Info.src;
+	u16 crcVal = CRC16_INIT, want;
+	u32 i;
+
+	/* word 0 is the CRC, grab it before the loader can grow over it */
+	want = __builtin_bswap32(src[0]) & 0xffff;
+	unpack(&src[1], B_EWRAM);
+
+	for (i = 0; i < B_Info.bytes; i++)
+		crcVal = (crcVal << 8) ^ B_Info.crcTable[(crcVal >> 8) ^ B_EWRAM[i]];
+
+	if (crcVal != want) {
+		/* there's nothing left to go back to */
+		J_Send(B_Info.ackBad);
+		while (1);
+	}
+
+	J_Send(B_Info.ackOk);
+
+#ifdef HW_SIM
+	S_Boot(B_Info.bytes);
+#else
+	/* as the BIOS leaves things: interrupts off, ARM mode */
+	REG_IME = 0;
+	((void (*)(void))B_ENTRY)();
+	__builtin_unreachable();
+#endif
+}
@@ -0,0 +1 @@
+../../common/comms.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../linux-loader-gba/source/joy.h
\ No newline at end of file
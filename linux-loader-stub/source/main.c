@@ -0,0 +1,138 @@
+/*
+ * GBA Linux Loader - Stub - Main
+ *
+ * First stage of a two-stage boot.  The BIOS multiboot protocol is slow, so
+ * all it carries is this; the loader itself comes over the link in burst
+ * mode blocks, LZ77 compressed.  See SYS_LOADER in comms.h.  No console
+ * and nothing from libgba but headers: every byte here goes through the
+ * BIOS.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <gba_types.h>
+#include "comms.h"
+#include "joy.h"
+#include "stub.h"
+
+/* the same as burst mode MEM_READ replies, see recvBurst() in the loader */
+static void recvBurst(u32 *buf32, u32 words) {
+	u32 rx, blk, nblk, i, n, seq;
+	u16 crcVal;
+	bool hunting;
+
+	nblk = (words + BURST_BLOCK_WORDS - 1) / BURST_BLOCK_WORDS;
+	blk = 0;
+	seq = 0;
+	hunting = false;
+
+	while (blk < nblk) {
+		/* block header */
+		rx = J_Recv();
+
+		if (!crcValid(rx)                         ||
+		   (rx & PKT_CLASS)  != CLASS_MEM         ||
+		   (rx & PKT_SUBCMD) != MEM_READ          ||
+		   (rx & PKT_CMD_ID) != 0                 ||
+		   ((rx & PKT_DATA) >> DATA_SHIFT) != blk) {
+			if (!hunting) {
+				seq = (seq + 1) & 3;
+				J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | ((BURST_ACK_RETRY | (seq << BURST_ACK_SEQ_SHIFT) | blk) << DATA_SHIFT)));
+				hunting = true;
+			}
+			continue;
+		}
+		hunting = false;
+
+		n = words - (blk * BURST_BLOCK_WORDS);
+		if (n > BURST_BLOCK_WORDS)
+			n = BURST_BLOCK_WORDS;
+
+		crcVal = CRC16_INIT;
+		for (i = 0; i < n; i++) {
+			rx = J_Recv();
+			buf32[(blk * BURST_BLOCK_WORDS) + i] = __builtin_bswap32(rx);
+			crcVal = crc16_update(crcVal, rx);
+		}
+
+		/* block trailer */
+		rx = J_Recv();
+
+		if (!crcValid(rx)                         ||
+		   (rx & PKT_CLASS)  != CLASS_SYS         ||
+		   (rx & PKT_SUBCMD) != SYS_MW_TX_DONE    ||
+		   (rx & PKT_CMD_ID) != 0                 ||
+		   ((rx & PKT_DATA) >> DATA_SHIFT) != crcVal) {
+			seq = (seq + 1) & 3;
+			J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | ((BURST_ACK_RETRY | (seq << BURST_ACK_SEQ_SHIFT) | blk) << DATA_SHIFT)));
+			hunting = true;
+			continue;
+		}
+
+		blk++;
+		J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | (blk << DATA_SHIFT)));
+	}
+
+	J_Flush();
+	J_Send(0);
+}
+
+int main(void) {
+	u32 rx, size, words, i;
+	u16 crcVal;
+	u32 *buf32;
+
+	while (1) {
+		/* wait to be told what's coming */
+		rx = J_Recv();
+
+		if (!crcValid(rx)                  ||
+		   (rx & PKT_CLASS)  != CLASS_SYS  ||
+		   (rx & PKT_SUBCMD) != SYS_LOADER ||
+		   (rx & PKT_CMD_ID) != 0)
+			continue;
+
+		J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */));
+
+		/* how big it is unpacked, how many words of it to expect, and a CRC of both */
+		size = J_Recv();
+		words = J_Recv();
+		rx = J_Recv();
+
+		crcVal = crc16_update(crc16_update(CRC16_INIT, size), words);
+		if (!crcValid(rx)                             ||
+		   (rx & PKT_CLASS)  != CLASS_SYS             ||
+		   (rx & PKT_SUBCMD) != SYS_MW_TX_DONE        ||
+		   (rx & PKT_CMD_ID) != 0                     ||
+		   ((rx & PKT_DATA) >> DATA_SHIFT) != crcVal ||
+		   !size || size > LOADER_MAX_BYTES           ||
+		   !words || words > LOADER_MAX_BYTES / 4) {
+			J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | (BURST_ACK_RETRY << DATA_SHIFT)));
+			continue;
+		}
+
+		J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */));
+
+		/* at the very top, so it can be unpacked down at the bottom */
+		buf32 = (u32 *)(B_EWRAM + LOADER_MAX_BYTES - (words * 4));
+		recvBurst(buf32, words);
+
+		/* it had better unpack to exactly what we were promised */
+		if (buf32[1] != (0x10 | (size << 8))) {
+			J_Send(crc(CLASS_SYS | SYS_ACK | 0 /* id */ | (BURST_ACK_RETRY << DATA_SHIFT)));
+			continue;
+		}
+
+		break;
+	}
+
+	B_Info.src = buf32;
+	B_Info.bytes = size;
+	B_Info.ackOk = crc(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
+	B_Info.ackBad = crc(CLASS_SYS | SYS_ACK | 0 /* id */ | (BURST_ACK_BAD << DATA_SHIFT));
+	for (i = 0; i < 256; i++)
+		B_Info.crcTable[i] = crc16_table[0][i];
+
+	B_Boot();
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * GBA Linux Loader - Stub - Boot handoff
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _STUB_H
+#define _STUB_H
+
+#include <gba_types.h>
+
+#ifdef HW_SIM
+/* provided by the link simulator, which then runs the loader it got */
+extern u8 S_Ewram[];
+extern void S_Boot(u32 bytes);
+#define B_EWRAM (S_Ewram)
+#else
+#define B_EWRAM ((u8 *)0x02000000)
+#endif
+
+/* the BIOS starts multiboot images here, and so do we */
+#define B_ENTRY (B_EWRAM + 0xC0)
+
+/*
+ * Everything B_Boot needs, in IWRAM.  It overwrites all of EWRAM, tables
+ * included, so the ACKs are CRC'd and the CRC16 table copied ahead of time.
+ */
+struct _bootInfo {
+	const u32 *src;    /* what the host sent, at the top of EWRAM */
+	u32 bytes;         /* size of the loader, unpacked */
+	u32 ackOk, ackBad;
+	u16 crcTable[256];
+};
+extern struct _bootInfo B_Info;
+
+/* unpack the loader into place and jump to it; only comes back under HW_SIM */
+extern IWRAM_CODE void B_Boot(void);
+
+#endif /* _STUB_H */
@@ -0,0 +1,56 @@
+/*
+ * GBA Linux Loader - GCN host side - ARAM as a slow tier
+ *
+ * The GameCube only has MEM1 to give the guest, but it also has 16MB of
+ * ARAM sitting around doing nothing while we run.  We can't point at it,
+ * only DMA pages to and from it, which is all the slow tier needs.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef HW_RVL
+#include <stdio.h>
+#include <gccore.h>
+#include "mem.h"
+#include "aram.h"
+
+static u32 aramBase;
+
+static void dma(u32 dir, void *mem, u32 aram, u32 len) {
+	AR_StartDMA(dir, (u32)mem, aramBase + aram, len);
+	while (AR_GetDMAStatus());
+}
+
+static bool aramRead(u32 offset, void *dst, u32 len) {
+	DCInvalidateRange(dst, len);
+	dma(AR_ARAMTOMRAM, dst, offset, len);
+	return true;
+}
+
+static bool aramWrite(u32 offset, const void *src, u32 len) {
+	DCFlushRange((void *)src, len);
+	dma(AR_MRAMTOARAM, (void *)src, offset, len);
+	return true;
+}
+
+const struct _tierBackend A_Backend = {
+	.name  = "ARAM",
+	.read  = aramRead,
+	.write = aramWrite,
+	.blank = true
+};
+
+u32 A_Init(void) {
+	u32 start, size;
+
+	/* the first bit is the OS's, the rest is ours, nothing else here uses audio */
+	start = AR_Init(NULL, 0);
+	size = (AR_GetSize() - start) & ~(M_PAGE_SIZE - 1);
+	if (!size)
+		return 0;
+
+	aramBase = AR_Alloc(size);
+	printf("aram: 0x%08x, size=%uKB\n", aramBase, size / 1024);
+	return size;
+}
+#endif /* !HW_RVL */
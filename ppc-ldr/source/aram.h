@@ -0,0 +1,18 @@
+/*
+ * GBA Linux Loader - GCN host side - ARAM as a slow tier
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _ARAM_H
+#define _ARAM_H
+
+#include <gccore.h>
+#include "tier.h"
+
+extern const struct _tierBackend A_Backend;
+
+/* grab all the ARAM we can, returns how much that was */
+extern u32 A_Init(void);
+
+#endif /* _ARAM_H */
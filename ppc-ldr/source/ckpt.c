@@ -0,0 +1,198 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - Guest checkpoints
+ *
+ * A checkpoint is a GBA's guest memory and its core's state, so that next
+ * time it can carry on from there rather than boot the kernel all over
+ * again over the link.  Only what the guest changed goes in: a pool page
+ * that never got a frame of its own is still either zero or the kernel's,
+ * and the kernel gets mapped back in the same way before a load, so those
+ * are left out; and a page of zeroes is just its number.
+ *
+ * The file is
+ *   struct ckHeader
+ *   the core state, hdr.words u32s of it
+ *   per page: its number in the window, with CK_ZERO set for a page of
+ *   zeroes, otherwise followed by M_PAGE_SIZE bytes of it
+ *   CK_END
+ * all in our own byte order, nothing else reads it.  It's written next to
+ * the old one and only put in its place once it's all there, so a save
+ * that dies partway leaves at worst no checkpoint, never half of one.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gccore.h>
+#include "comms.h"
+#include "mem.h"
+#include "pager.h"
+#include "ckpt.h"
+
+#define CK_MAGIC   (0x47424b50) /* "GBKP" */
+#define CK_VERSION (1)
+#define CK_ZERO    (0x80000000)
+#define CK_END     (0xffffffff)
+
+struct ckHeader {
+	u32 magic, version;
+	u32 size;   /* of the window */
+	u32 kernel;
+	u32 words;  /* of core state */
+};
+
+struct _ckStats CK_Stats;
+
+static u8 page[M_PAGE_SIZE] __attribute__((aligned(32)));
+
+static bool isZero(const u8 *p) {
+	const u32 *w = (const u32 *)p;
+	u32 i;
+
+	for (i = 0; i < M_PAGE_SIZE / sizeof(u32); i++) {
+		if (w[i])
+			return false;
+	}
+	return true;
+}
+
+bool CK_Save(const char *path, u32 base, u32 size, u32 kernel, const u32 *core, u32 words) {
+	struct ckHeader hdr = { CK_MAGIC, CK_VERSION, size, kernel, words };
+	char tmp[256];
+	u64 start = gettime();
+	u32 addr, rec;
+	bool ok;
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	fp = fopen(tmp, "wb");
+	if (!fp) {
+		printf("Can't open %s for the checkpoint\n", tmp);
+		return false;
+	}
+
+	memset(&CK_Stats, 0, sizeof(CK_Stats));
+	ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+	     (!words || fwrite(core, words * sizeof(u32), 1, fp) == 1);
+	for (addr = 0; ok && addr < size; addr += M_PAGE_SIZE) {
+		/* still zero, or still the kernel's */
+		if (M_InPool(base + addr) && !M_Owned(base + addr)) {
+			CK_Stats.skipped++;
+			continue;
+		}
+
+		/* anything else the pager hasn't got to yet isn't what it will be */
+		D_Fault(base + addr, M_PAGE_SIZE);
+		M_Read(page, base + addr, M_PAGE_SIZE);
+		rec = addr >> M_PAGE_SHIFT;
+		if (isZero(page)) {
+			rec |= CK_ZERO;
+			CK_Stats.zeroes++;
+			ok = fwrite(&rec, sizeof(rec), 1, fp) == 1;
+		}
+		else {
+			CK_Stats.pages++;
+			ok = fwrite(&rec, sizeof(rec), 1, fp) == 1 && fwrite(page, M_PAGE_SIZE, 1, fp) == 1;
+		}
+	}
+
+	rec = CK_END;
+	ok = ok && fwrite(&rec, sizeof(rec), 1, fp) == 1;
+	ok = (fclose(fp) == 0) && ok;
+
+	/* FAT won't rename over a file that's there */
+	if (ok) {
+		remove(path);
+		ok = rename(tmp, path) == 0;
+	}
+	if (!ok) {
+		printf("Couldn't write the checkpoint to %s\n", path);
+		remove(tmp);
+		return false;
+	}
+
+	CK_Stats.ms = diff_msec(start, gettime());
+	return true;
+}
+
+bool CK_Load(const char *path, u32 base, u32 size, u32 kernel, u32 *core, u32 *words) {
+	struct ckHeader hdr;
+	u64 start = gettime();
+	u32 rec, addr, n = 0;
+	bool ok;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+
+	ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+	     hdr.magic == CK_MAGIC && hdr.version == CK_VERSION &&
+	     hdr.size == size && hdr.kernel == kernel && hdr.words <= SAVE_MAX_WORDS &&
+	     (!hdr.words || fread(core, hdr.words * sizeof(u32), 1, fp) == 1);
+	if (!ok) {
+		printf("%s isn't for this kernel or this much memory, booting afresh\n", path);
+		fclose(fp);
+		return false;
+	}
+
+	/* make sure it's all there before touching anything */
+	while (ok) {
+		if (fread(&rec, sizeof(rec), 1, fp) != 1)
+			ok = false;
+		else if (rec == CK_END)
+			break;
+		else if ((rec & ~CK_ZERO) >= (size >> M_PAGE_SHIFT))
+			ok = false;
+		else if (!(rec & CK_ZERO))
+			ok = fseek(fp, M_PAGE_SIZE, SEEK_CUR) == 0;
+		n++;
+	}
+	if (!ok || fseek(fp, sizeof(hdr) + (hdr.words * sizeof(u32)), SEEK_SET)) {
+		printf("%s is cut short or mangled, booting afresh\n", path);
+		fclose(fp);
+		return false;
+	}
+
+	/* every page in it takes a frame, and the other GBAs may have most of them */
+	if (n + D_Missing() > M_Spare()) {
+		printf("Not enough memory left to resume %s, booting afresh\n", path);
+		fclose(fp);
+		return false;
+	}
+
+	memset(&CK_Stats, 0, sizeof(CK_Stats));
+	while (fread(&rec, sizeof(rec), 1, fp) == 1 && rec != CK_END) {
+		addr = base + ((rec & ~CK_ZERO) << M_PAGE_SHIFT);
+
+		/* the kernel's copy has to be in first, or the pager puts it back over ours later */
+		D_Fault(addr, M_PAGE_SIZE);
+		if (rec & CK_ZERO) {
+			/*
+			 * written, not M_Zero()ed: that hands a whole pool page back to
+			 * the zero page, and the next save would take it for the kernel's
+			 */
+			memset(page, 0, M_PAGE_SIZE);
+			M_Write(addr, page, M_PAGE_SIZE);
+			CK_Stats.zeroes++;
+			continue;
+		}
+
+		if (fread(page, M_PAGE_SIZE, 1, fp) != 1) {
+			/* it was all there a moment ago, and guest memory's half done now */
+			printf("FATAL: Lost %s partway through loading it!\n", path);
+			sleep(5);
+			exit(1);
+		}
+		M_Write(addr, page, M_PAGE_SIZE);
+		CK_Stats.pages++;
+	}
+	fclose(fp);
+
+	CK_Stats.skipped = (size >> M_PAGE_SHIFT) - CK_Stats.pages - CK_Stats.zeroes;
+	CK_Stats.ms = diff_msec(start, gettime());
+	*words = hdr.words;
+	return true;
+}
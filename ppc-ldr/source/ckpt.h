@@ -0,0 +1,34 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - Guest checkpoints
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _CKPT_H
+#define _CKPT_H
+
+#include <gccore.h>
+
+struct _ckStats {
+	u32 pages, zeroes, skipped; /* last save or load: pages with data, pages of zeroes, pages left out */
+	u32 ms;
+};
+extern struct _ckStats CK_Stats;
+
+/*
+ * Save the guest memory in [base, base + size) and the GBA's core state
+ * (words u32s of it) to path, against kernel, something that changes
+ * whenever the kernel does.  False if it couldn't, and any checkpoint
+ * that was already there is left as it was.
+ */
+extern bool CK_Save(const char *path, u32 base, u32 size, u32 kernel, const u32 *core, u32 words);
+
+/*
+ * Put a checkpoint back into [base, base + size), which has to have the
+ * kernel mapped in just as it was when it was saved, and hand back the core
+ * state.  False, with guest memory untouched, if there isn't one or it's
+ * not for this kernel and this much memory.
+ */
+extern bool CK_Load(const char *path, u32 base, u32 size, u32 kernel, u32 *core, u32 *words);
+
+#endif /* _CKPT_H */
@@ -16,37 +16,280 @@
 #include <malloc.h>
 #include <gccore.h>
 #include <fat.h>
+#include "console.h"
 #include "mem.h"
 #include "comms.h"
+#include "link.h"
+#include "lz.h"
+#include "elfload.h"
+#include "pager.h"
+#include "vdisk.h"
+#include "stats.h"
+#include "trace.h"
+#include "ckpt.h"
+
+/* the link simulator points this somewhere other than the SD card root */
+#ifndef SD_ROOT
+#define SD_ROOT ""
+#endif
 
+#define LDR_PATH  SD_ROOT "/apps/gba-linux-loader/linux-loader.gba"
+#define KERN_PATH SD_ROOT "/apps/gba-linux-loader/linux.elf"
 
-#define LDR_PATH  "/apps/gba-linux-loader/linux-loader.gba"
-#define KERN_PATH "/apps/gba-linux-loader/linux.elf"
+/* optional; the guest's disk */
+#define DISK_PATH SD_ROOT "/apps/gba-linux-loader/rootfs.img"
 
-/* stupid libogc not exporting functions.... */
-extern u64 gettime(void);
-extern u32 diff_msec(u64 start,u64 end);
+/* optional; if it's there, it gets multibooted and fetches the loader over the fast link */
+#define STUB_PATH SD_ROOT "/apps/gba-linux-loader/linux-loader-stub.gba"
 
-static enum {
-	STATE_READ_LINUX_LOADER, /* reading Linux loader */
-	STATE_WAIT_GBA,          /* waiting for GBA to be connected */
-	STATE_MULTIBOOT_SETUP,   /* setting up multiboot */
-	STATE_MULTIBOOT,         /* doing multiboot */
-	STATE_HANDSHAKE_EMU,     /* handshaking with emulator on GBA */
-	STATE_READ_KERNEL,       /* reading the kernel */
-	STATE_LOAD_KERNEL,       /* uploading the kernel */
-	STATE_READY              /* ready to speak real protocol */
-} curState = STATE_READ_LINUX_LOADER;
+/* optional; where the GBA on each port saved itself last, by port number */
+#define CKPT_PATH SD_ROOT "/apps/gba-linux-loader/checkpoint-%d.bin"
 
-static bool multibootInitialized = false;
 static struct stat statBuf;
-static u8 *resbuf, *cmdbuf;
-static vu32 transval, resval;
 static void (*cmdCallbacks[7])(u32 rx);
 
-#define SI_TRANS_DELAY 50
-static void transcb(s32 chan, u32 ret) {
-	transval = 1;
+/*
+ * The loader, and the stub right after it, if any, get read in once and
+ * go to every GBA that turns up.  mbBuf is whichever of the two goes
+ * through the BIOS.
+ */
+#define STUB_ADDR (LOADER_MAX_BYTES)
+static bool ldrRead;
+static u8 *ldrBuf;
+static u32 ldrSize, stubSize;
+static u8 *mbBuf;
+static u32 mbSize;
+
+/* the loader as the stub gets it, laid out like an LZ77 reply */
+static u32 *ldrPacked;
+static u32 ldrWords;
+
+/*
+ * The kernel gets opened once, the pager has it from there, and every GBA
+ * maps it into its own guest memory; where it starts, and where the
+ * highest part of it ends, relative to that.
+ */
+static FILE *kernFile;
+static u32 kernEntry, kernEnd;
+static bool kernElf;
+static u32 kernStamp; /* changes whenever the kernel does, so a checkpoint can tell it's for this one */
+
+/* everything we know how to speak */
+#define HOST_FEATURES (FEAT_BURST | FEAT_PUSH | FEAT_TAGGED | FEAT_LZ77 | FEAT_PACE | FEAT_SACK | FEAT_FEC | FEAT_ZERO)
+u32 C_OfferedFeatures = HOST_FEATURES & ~FEAT_FEC; /* check words only pay for themselves on a noisy link */
+
+/* page the kernel in off the SD card as the GBAs want it, rather than all up front */
+bool C_DemandPaging = true;
+#define PAGER_IDLE_MS (5) /* how long the GBAs have to be quiet before we go read more of it */
+
+/* reads answered with a zero run (FEAT_ZERO), all GBAs together */
+u32 C_ZeroReplies;
+
+/* how often to make sure a GBA that's up and running is still plugged in, or still running the loader */
+#define PROBE_MS (100)
+
+/* what each GBA asked for and how long it took, see stats.h */
+struct linkStats C_Stats[C_MAX_GBAS];
+
+/* and what happened when, see trace.h */
+#define C_TRACE_RECS (4096)
+static struct {
+	struct traceHdr hdr;
+	struct traceRec rec[C_TRACE_RECS];
+} trace = { .hdr = { TRACE_MAGIC, TRACE_HOST, TB_TIMER_CLOCK * 1000, C_TRACE_RECS, 0 } };
+
+#define TRACE(lvl, ev, pkt, a, b) do { \
+	if (TRACE_LEVEL >= (lvl)) \
+		trace_put(&trace.hdr, trace.rec, C_TRACE_RECS - 1, gettime(), (ev), (pkt), (a), (b)); \
+} while (0)
+
+/* MEM_READ throughput, per transfer mode, all GBAs together */
+#define BENCH_PRINT_INTERVAL 64
+static struct {
+	u64 ticks;
+	u32 words;
+	u32 reads;
+} readBench[2];
+
+/* MEM_WRITE throughput */
+static struct {
+	u64 ticks;
+	u32 words;
+	u32 writes;
+} writeBench;
+
+/*
+ * MEM_WRITE data waits here until its CRC checks out, and compressed
+ * MEM_READ replies go out from here; nothing that uses it gives another
+ * GBA a turn before it's done with it.
+ */
+static u32 writeBuf[WRITE_MAX_WORDS];
+
+/* read-ahead */
+#define PUSH_MAX_DEPTH    (8)
+#define PUSH_ADAPT_WINDOW (16)
+struct readAhead {
+	/* what the GBA has been asking for, in its guest memory */
+	u32 lastAddr, lastWords;
+	s32 stride;
+	bool streaming;
+
+	/* next thing to push, how many pushes the GBA hasn't used yet, how many we'd like */
+	u32 next, ahead, depth;
+	u32 maxWords;
+
+	/* pushes vs. ones the GBA used, for adjusting depth */
+	u32 pushed, hits;
+
+	/* push in progress: 0 = none, 1 = addr next, 2 = data, 3 = trailer */
+	int phase;
+	u32 pos;
+	u16 crc;
+};
+
+/*
+ * Gap between paced words.  It starts out at what it always used to be,
+ * gets calibrated with probes once the GBA agrees to FEAT_PACE, then
+ * doubles every time the GBA has to ask again and comes back down a step
+ * at a time, never below the calibrated gap, while reads keep going clean.
+ */
+#define PACE_START_US (2000)
+#define PACE_MAX_US   (16000)
+#define PACE_STEP_US  (25)   /* also how close calibration gets */
+#define PACE_GOOD_RUN (8)    /* clean reads before trying a step faster */
+struct pacing {
+	u32 gap, floor;
+	u32 good;
+	u32 seq; /* last probe */
+};
+
+/* a tagged request, see doTagged() */
+struct tag {
+	enum { TAG_FREE, TAG_READ, TAG_WRITE } type;
+	bool disk;
+	u32 addr, length, nblk; /* addr is in our map, not the GBA's */
+	u64 start;
+
+	/* reads: next block to send, the GBA's cumulative ACK, last retry we acted on, FEAT_SACK resends owed */
+	u32 blk, acked, lastSeq, redo;
+	u64 ticks;
+
+	/* writes: next block we want, our retry numbering; data waits in buf until it's all here */
+	u32 expected, seq;
+	bool hunting;
+	u32 buf[WRITE_MAX_WORDS];
+	u32 frames; /* pool frames set aside for it to land in (M_Reserve()) */
+
+	/* reads: compressed reply length, it goes out of buf; 0 for raw */
+	u32 lzWords;
+
+	bool ackPending;
+	u32 ackData;
+};
+
+/* what the GBA is sending, tagged */
+struct tagRx {
+	enum { TRX_IDLE, TRX_SUBMIT, TRX_WDATA, TRX_WTRAILER, TRX_SKIP } state;
+	u32 id, type, pos, n, blk, addr, length;
+	bool lzOk, disk; /* disk: BLK_READ or BLK_WRITE, addr and length are sectors */
+	u16 crc;
+};
+
+/* read block we're partway through sending; blocks go out whole */
+struct tagTx {
+	bool busy;
+	u32 id, blk, pos, n;
+	u32 fec[FEC_WORDS]; /* FEAT_FEC check words, after the data */
+	u16 crc;
+};
+
+/* multiboot goes out a queue's worth of words at a time, so GBAs on other ports can go at once */
+enum {
+	MB_WAIT_BIOS, /* resetting it until the BIOS says it's ready */
+	MB_SEND       /* key sent, sending the header and ROM */
+};
+
+/*
+ * Everything about the GBA on one SI channel.  The main loop gives each of
+ * them a turn in order, one step of its state machine each, and `cur' is
+ * whose turn it is; everything below goes through it.
+ */
+static struct gba {
+	s32 chan;
+	enum {
+		STATE_WAIT_GBA,          /* waiting for GBA to be connected */
+		STATE_REJOIN,            /* found it still running the loader, waiting for it to rejoin */
+		STATE_MULTIBOOT_SETUP,   /* setting up multiboot */
+		STATE_MULTIBOOT,         /* doing multiboot */
+		STATE_STAGE2,            /* sending the stub the loader */
+		STATE_HANDSHAKE_EMU,     /* handshaking with emulator on GBA */
+		STATE_NEGOTIATE,         /* agreeing on protocol features */
+		STATE_CALIBRATE,         /* timing paced transfers */
+		STATE_READ_KERNEL,       /* reading the kernel */
+		STATE_LOAD_KERNEL,       /* uploading the kernel */
+		STATE_READY              /* ready to speak real protocol */
+	} state;
+
+	/* its guest memory, a window of ours (see M_AddGuest()); 0 for none, which leaves the port alone */
+	u32 base, size;
+	bool mapped; /* the kernel's been mapped into it */
+
+	/* given to it with SYS_KERNEL_LOAD (see PING_SESSION), 0 before then; while it's set, guest memory is that GBA's */
+	u32 session;
+	u64 probeTicks; /* last looked to see if it's still there */
+
+	/* core state from a checkpoint, to go out with SYS_KERNEL_LOAD; 0 words for a fresh boot */
+	u32 coreWords;
+	u32 core[SAVE_MAX_WORDS];
+
+	/* what the GBA agreed to */
+	u32 features;
+	struct linkStats *stats;
+
+	/* boot timing, and multiboot progress */
+	u64 foundTicks, stageTicks;
+	struct {
+		int phase;
+		u32 pos, key, crc;
+	} mb;
+
+	/* when it last said anything, for the pager */
+	u64 lastHeard;
+
+	struct readAhead ra;
+	struct pacing pace;
+
+	/* tagged requests */
+	struct tag tags[MAX_INFLIGHT];
+	struct tagRx trx;
+	struct tagTx ttx;
+	u32 ttxNext, ttxSent;
+	bool trxBusy; /* the GBA is partway through sending us something */
+
+	/* see lookStatus() */
+	enum { LOOK_NONE, LOOK_STATUS, LOOK_POLL } look;
+} gbas[C_MAX_GBAS], *cur;
+
+/* the virtual disk can't be shared, it goes to whichever GBA gets to the kernel first */
+static struct gba *diskOwner;
+
+/* is [*addr, *addr + len) all in this GBA's guest memory?  if so, make *addr where that is in ours */
+static bool guestAddr(u32 *addr, u32 len) {
+	if (*addr >= cur->size || len > cur->size - *addr)
+		return false;
+
+	*addr += cur->base;
+	return true;
+}
+
+/*
+ * Would writing [addr, addr + len) still leave the pool enough frames for
+ * the pager to load what's left of the kernel?  Every window is as big as
+ * the whole pool, so GBAs that write enough of theirs run it dry; when
+ * they do, they get their writes refused rather than taking the host down.
+ */
+static bool poolRoom(u32 addr, u32 len) {
+	return M_Needed(addr, len) + D_Missing() <= M_Spare();
 }
 
 static u32 docrc(u32 crc, u32 val) {
@@ -64,13 +307,6 @@ static u32 docrc(u32 crc, u32 val) {
 }
 
 
-static inline void waitTransfer() {
-	/* 350 is REALLY pushing it already, cant go further */
-	do {
-		usleep(350);
-	} while(transval == 0);
-}
-
 static u32 calckey(u32 size) {
 	u32 ret = 0;
 	int res1, res2, res3;
@@ -104,51 +340,10 @@ static u32 calckey(u32 size) {
 	return ret;
 }
 
-static void doreset() {
-	cmdbuf[0] = 0xFF; /* reset */
-	transval = 0;
-	SI_Transfer(GBA_CHAN, cmdbuf, 1, resbuf, 3, transcb, SI_TRANS_DELAY);
-	while (transval == 0);
-}
-
-static void getstatus() {
-	cmdbuf[0] = 0; /* status */
-	transval = 0;
-	SI_Transfer(GBA_CHAN, cmdbuf, 1, resbuf, 3, transcb, SI_TRANS_DELAY);
-	while (transval == 0);
-}
-
-static u32 recv() {
-	memset(resbuf, 0, 32);
-	cmdbuf[0] = 0x14; /* read */
-	transval = 0;
-	SI_Transfer(GBA_CHAN, cmdbuf, 1, resbuf, 5, transcb, SI_TRANS_DELAY);
-	while (transval == 0);
-	return *(vu32 *)resbuf;
-}
-
-#define srecv() __builtin_bswap32(recv())
-
-static void send(u32 msg) { 
-	u64 ticks, ticksNew;
-	cmdbuf[0] = 0x15;
-	cmdbuf[1] = (msg >> 0) & 0xFF;
-	cmdbuf[2] = (msg >> 8) & 0xFF;
-	cmdbuf[3] = (msg >> 16) & 0xFF;
-	cmdbuf[4] = (msg >> 24) & 0xFF;
-
-	transval = 0;
-	resbuf[0] = 0;
-	SI_Transfer(GBA_CHAN, cmdbuf, 5, resbuf, 1, transcb, SI_TRANS_DELAY);
-	ticks = gettime();
-	while (transval == 0) {
-		ticksNew = gettime();
-		if (diff_msec(ticks, ticksNew) > 60)
-			break; /* give up */
-	}
-}
-
-
+/* bytes come in LSB first, so the raw word is byteswapped from REG_JOYTR */
+#define recv()    __builtin_bswap32(L_Recv(cur->chan))
+#define srecv()   L_Recv(cur->chan)
+#define send(x)   L_Send(cur->chan, x)
 #define ssend(x)  send(__builtin_bswap32(x))
 #if 0
 #define psend(x)  send(parity(x))
@@ -156,66 +351,90 @@ static void send(u32 msg) {
 #endif
 #define csend(x)  send(crc(x))
 
-static void readLinuxLoader(void) {
+/* read a GBA ROM into dst, returns its size, or 0 if it isn't there and doesn't have to be */
+static u32 readRom(const char *path, u8 *dst, u32 max, bool optional) {
 	FILE *fp;
-	
-	if (!fatInitDefault()) {
-		puts("fatInitDefault() failed, can't read linux-loader.gba!");
-		sleep(5);
-		exit(1);
-	}
 
-	if (stat(LDR_PATH, &statBuf)) {
-		perror("stat() on " LDR_PATH " failed");
+	if (stat(path, &statBuf)) {
+		if (optional)
+			return 0;
+
+		printf("stat() on %s failed", path);
+		perror("");
 		sleep(5);
 		exit(1);
 	}
 
-	if (statBuf.st_size >= 256 * 1024) {
-		puts(LDR_PATH " is larger than 256KB, something is wrong!");
+	/* with room for the zeroes that go after it */
+	if (statBuf.st_size > max - 8) {
+		printf("%s is larger than %uKB, something is wrong!\n", path, max / 1024);
 		sleep(5);
 		exit(1);
 	}
 
-	fp = fopen(LDR_PATH, "rb");
+	fp = fopen(path, "rb");
 	if (!fp) {
-		puts("Failed to open " LDR_PATH "!");
+		printf("Failed to open %s!\n", path);
 		sleep(5);
 		exit(1);
 	}
 
-	if (fread(M_State.blocks[0].ptr.w8, statBuf.st_size, 1, fp) != 1) {
+	if (fread(dst, statBuf.st_size, 1, fp) != 1) {
 		fclose(fp);
-		puts("Failed to read " LDR_PATH "!");
+		printf("Failed to read %s!\n", path);
 		sleep(5);
 		exit(1);
 	}
 
 	fclose(fp);
 
-	printf("Successfully read GBA Linux loader ROM (%llu bytes)\n", statBuf.st_size);
-	curState = STATE_WAIT_GBA;
+	/* it goes out in words, don't send whatever was lying around after it */
+	memset(dst + statBuf.st_size, 0, 8);
+	return statBuf.st_size;
 }
 
-static void checkGBA(void) {
-	u32 type;
-
-	type = SI_GetType(GBA_CHAN);
-	if (type & SI_GBA) {
-		puts("Found a GBA!  Doing multiboot...");
-		curState = STATE_MULTIBOOT_SETUP;
+/*
+ * Compress the loader for the stub.  It lands at the top of EWRAM, clear of
+ * the stub, and has to stay clear of the loader being unpacked below it.
+ * Burst blocks cost a little more per word than multiboot does, so if it
+ * doesn't compress, the stub is only in the way.
+ */
+static void planStage2(void) {
+	u32 rawWords = (ldrSize + 3) / 4, max, n, i;
+	u16 crcVal;
+	u64 ticks = gettime();
+
+	free(ldrPacked);
+	max = rawWords * sizeof(u32);
+	if (LOADER_MAX_BYTES - ((stubSize + 7) & ~7) < max)
+		max = LOADER_MAX_BYTES - ((stubSize + 7) & ~7);
+	if (LOADER_MAX_BYTES - (rawWords * sizeof(u32)) < max)
+		max = LOADER_MAX_BYTES - (rawWords * sizeof(u32));
+
+	/* room for the CRC word, and it has to come out at least a word under sending it raw */
+	ldrPacked = malloc(max);
+	n = (ldrPacked && max > 2 * sizeof(u32)) ?
+	    Z_Compress(ldrBuf, rawWords * sizeof(u32), (u8 *)&ldrPacked[1], max - (2 * sizeof(u32))) : 0;
+
+	if (n) {
+		crcVal = CRC16_INIT;
+		for (i = 0; i < rawWords; i++)
+			crcVal = crc16_update(crcVal, ntohl(((u32 *)ldrBuf)[i]));
+		ldrPacked[0] = htonl(crcVal);
+		ldrWords = (n / sizeof(u32)) + 1;
+		printf("Compressed the loader in %u ms, %u -> %u bytes\n",
+		       diff_msec(ticks, gettime()), rawWords * sizeof(u32), ldrWords * sizeof(u32));
+		return;
 	}
-	return;
-}
 
-static void doMultibootSetup(void) {
-	u8 *gbaBuf = M_State.blocks[0].ptr.w8;
-	if (!multibootInitialized) {
-		cmdbuf = memalign(32,32);
-		resbuf = memalign(32,32);
-		multibootInitialized = true;
-	}
+	free(ldrPacked);
+	ldrPacked = NULL;
+	puts("Loader doesn't compress enough to be worth the stub, multibooting it directly");
+	stubSize = 0;
+}
 
+/* get a ROM ready to be started the way the BIOS starts multiboot images */
+static void fixupRom(u8 *gbaBuf) {
 	if (gbaBuf[0xB2] != 0x96) {
 		printf("GBA header value incorrect (0x%02X)! Fixing value (0x96)\n", gbaBuf[0xB2]);
 		gbaBuf[0xB2] = 0x96;
@@ -230,45 +449,138 @@ static void doMultibootSetup(void) {
 		/* jump over joyboot handshake */
 		*(u32 *)(gbaBuf + 0xE0) = 0x170000EA;
 	}
+}
 
-	curState = STATE_MULTIBOOT;
-	return;
+static void readLinuxLoader(void) {
+	if (!fatInitDefault()) {
+		puts("fatInitDefault() failed, can't read linux-loader.gba!");
+		sleep(5);
+		exit(1);
+	}
+
+	ldrBuf = memalign(32, STUB_ADDR + LOADER_MAX_BYTES);
+	if (!ldrBuf) {
+		puts("No memory for the loader!");
+		sleep(5);
+		exit(1);
+	}
+
+	ldrSize = readRom(LDR_PATH, ldrBuf, LOADER_MAX_BYTES, false);
+	printf("Successfully read GBA Linux loader ROM (%u bytes)\n", ldrSize);
+
+	stubSize = readRom(STUB_PATH, ldrBuf + STUB_ADDR, LOADER_MAX_BYTES, true);
+	if (stubSize)
+		printf("Successfully read GBA Linux loader stub (%u bytes)\n", stubSize);
+
+	/* the stub starts the loader just like the BIOS would have */
+	fixupRom(ldrBuf);
+	if (stubSize) {
+		fixupRom(ldrBuf + STUB_ADDR);
+		planStage2();
+	}
+
+	/* which may have decided against the stub */
+	if (stubSize) {
+		mbBuf = ldrBuf + STUB_ADDR;
+		mbSize = stubSize;
+	}
+	else {
+		mbBuf = ldrBuf;
+		mbSize = ldrSize;
+	}
+
+	ldrRead = true;
 }
 
-static void doMultiboot(void) {
-	u32 sendsize, ourkey, fcrc, sessionkeyraw, sessionkey, enc;
-	int i;
-	u8 *gbaBuf = M_State.blocks[0].ptr.w8;
-	size_t gbaSize = statBuf.st_size;
+/* whatever the GBA on this port had going went with it, so start its guest memory over */
+static void forget(void) {
+	if (!cur->session)
+		return;
 
-	puts("GBA Found! Waiting for BIOS...");
-	resbuf[2]=0;
+	printf("Port %d's GBA is starting over, so is its guest memory\n", cur->chan + 1);
+	M_Zero(cur->base, cur->size);
+	D_Reset(cur->base, cur->size);
+	Z_Invalidate(cur->base, cur->size);
+	cur->session = 0;
+}
+
+static void checkGBA(void) {
+	if (!L_Probe(cur->chan))
+		return;
 
-	while (!(resbuf[2] & 0x10)) {
-		doreset();
-		getstatus();
+	/* it may never have stopped running the loader, in which case multiboot would wait forever */
+	L_Init(cur->chan);
+	if (L_Status(cur->chan) & JSTAT_SESSION) {
+		if (cur->session)
+			printf("Found the GBA on port %d again, still on session %08x!  Waiting for it to rejoin...\n",
+			       cur->chan + 1, cur->session);
+		else
+			printf("The GBA on port %d is still running a loader from before, power cycle it to boot it again\n",
+			       cur->chan + 1);
+		cur->probeTicks = gettime();
+		cur->state = STATE_REJOIN;
+		return;
 	}
 
-	puts("GBA Ready, sending Linux Loader...");
+	forget();
+	printf("Found a GBA on port %d!  Doing multiboot...\n", cur->chan + 1);
+	cur->foundTicks = gettime();
+	cur->state = STATE_MULTIBOOT_SETUP;
+	return;
+}
+
+static void doMultibootSetup(void) {
+	L_Init(cur->chan);
+	cur->mb.phase = MB_WAIT_BIOS;
+	cur->state = STATE_MULTIBOOT;
+	puts("GBA Found! Waiting for BIOS...");
+	return;
+}
+
+/*
+ * A step of multiboot: one look for the BIOS, or as many words as the
+ * link has room to queue, so the next GBA's turn comes round while these
+ * are still going out.
+ */
+static void doMultiboot(void) {
+	u32 sendsize, ourkey, sessionkeyraw, enc, i;
+	u8 *gbaBuf = mbBuf;
+	size_t gbaSize = mbSize;
+
 	sendsize = (((gbaSize) + 7) & ~7);
-	ourkey = calckey(sendsize);
-	printf("Our Key: %08x\n", ourkey);
 
-	/* get current sessionkey */
-	sessionkeyraw = recv();
-	sessionkey = __builtin_bswap32(sessionkeyraw ^ 0x7365646F);
+	if (cur->mb.phase == MB_WAIT_BIOS) {
+		L_Reset(cur->chan);
+		if (!(L_Status(cur->chan) & 0x10))
+			return;
+
+		printf("GBA Ready, sending %s...\n", stubSize ? "stub" : "Linux Loader");
+		cur->stageTicks = gettime();
+		ourkey = calckey(sendsize);
+		printf("Our Key: %08x\n", ourkey);
 
-	/* send over our own key */
-	ssend(ourkey);
+		/* get current sessionkey */
+		sessionkeyraw = recv();
+		cur->mb.key = __builtin_bswap32(sessionkeyraw ^ 0x7365646F);
 
-	fcrc = 0x15a0;
+		/* send over our own key */
+		ssend(ourkey);
 
-	/* send over gba header */
-	for (i = 0; i < 0xC0; i+=4)
-		ssend(*(vu32*)(gbaBuf + i));
+		cur->mb.crc = 0x15a0;
+		cur->mb.pos = 0;
+		cur->mb.phase = MB_SEND;
+		return;
+	}
+
+	for (i = cur->mb.pos; i < sendsize && L_Backlog(cur->chan) < L_QUEUE; i += 4) {
+		/* send over gba header */
+		if (i < 0xC0) {
+			ssend(*(vu32*)(gbaBuf + i));
+			if (i + 4 == 0xC0)
+				puts("Header done! Sending ROM...");
+			continue;
+		}
 
-	puts("Header done! Sending ROM...");
-	for (i = 0xC0; i < sendsize; i+=4) {
 		enc = (
 			(gbaBuf[i + 3] << 24) | 
 			(gbaBuf[i + 2] << 16) | 
@@ -276,32 +588,144 @@ static void doMultiboot(void) {
 			(gbaBuf[i])
 		);
 
-		fcrc = docrc(fcrc, enc);
-		sessionkey = (sessionkey * 0x6177614B) + 1;
-		enc ^= sessionkey;
+		cur->mb.crc = docrc(cur->mb.crc, enc);
+		cur->mb.key = (cur->mb.key * 0x6177614B) + 1;
+		enc ^= cur->mb.key;
 		enc ^= ((~(i + (0x20 << 20))) + 1);
 		enc ^= 0x20796220;
 		send(enc);
 	}
-	fcrc |= (sendsize << 16);
-	printf("ROM done! CRC: %08x\n", fcrc);
+	cur->mb.pos = i;
+	if (i < sendsize)
+		return;
+
+	cur->mb.crc |= (sendsize << 16);
+	printf("ROM done! CRC: %08x\n", cur->mb.crc);
 
 	/* send over CRC */
-	sessionkey = (sessionkey * 0x6177614B) + 1;
-	fcrc ^= sessionkey;
-	fcrc ^= ((~(i + (0x20 << 20))) + 1);
-	fcrc ^= 0x20796220;
-	send(fcrc);
+	cur->mb.key = (cur->mb.key * 0x6177614B) + 1;
+	cur->mb.crc ^= cur->mb.key;
+	cur->mb.crc ^= ((~(i + (0x20 << 20))) + 1);
+	cur->mb.crc ^= 0x20796220;
+	send(cur->mb.crc);
 
 	/* get crc back (unused) */
 	recv();
-	puts("GBA booted!  Waiting for handshake...");
+	printf("Multiboot took %u ms for %u bytes\n", diff_msec(cur->stageTicks, gettime()), sendsize);
+
+	if (stubSize) {
+		puts("Stub booted!  Sending Linux Loader...");
+		cur->state = STATE_STAGE2;
+		return;
+	}
 
-	curState = STATE_HANDSHAKE_EMU;
+	puts("GBA booted!  Waiting for handshake...");
+	cur->state = STATE_HANDSHAKE_EMU;
 
 	return;
 }
 
+/* wait for a word from the GBA that we haven't read before; false if it never shows */
+static bool recvNew(u32 *rx) {
+	u64 ticks = gettime();
+
+	while (!L_Poll(cur->chan, rx)) {
+		if (diff_msec(ticks, gettime()) > 50)
+			return false;
+	}
+	return true;
+}
+
+static void sendBurst(u32 addr, u32 length, const u32 *src);
+
+/* burst mode has its own flow control */
+static inline void paceGap(void) {
+	if (cur->pace.gap && !(cur->features & FEAT_BURST))
+		usleep(cur->pace.gap);
+}
+
+static void paceSet(u32 gap) {
+	if (gap == cur->pace.gap)
+		return;
+
+	cur->pace.gap = gap;
+	TRACE(TR_ERR, TR_PACE, CLASS_MEM | MEM_READ, cur->pace.gap, cur->pace.floor);
+}
+
+/* the GBA had to go again */
+static void paceBad(void) {
+	u32 gap = (cur->pace.gap < PACE_STEP_US) ? PACE_STEP_US : cur->pace.gap * 2;
+
+	cur->pace.good = 0;
+	paceSet((gap > PACE_MAX_US) ? PACE_MAX_US : gap);
+}
+
+static void paceGood(void) {
+	if (++cur->pace.good < PACE_GOOD_RUN || cur->pace.gap == cur->pace.floor)
+		return;
+
+	cur->pace.good = 0;
+	paceSet((cur->pace.gap - cur->pace.floor > PACE_STEP_US) ? cur->pace.gap - PACE_STEP_US : cur->pace.floor);
+}
+
+/* the SYS_ACK the stub just sent, if it's that */
+static bool stubAck(u32 rx, u32 *data) {
+	if (!crcValid(rx)                  ||
+	    (rx & PKT_CLASS)  != CLASS_SYS ||
+	    (rx & PKT_SUBCMD) != SYS_ACK   ||
+	    (rx & PKT_CMD_ID) != 0)
+		return false;
+
+	*data = (rx & PKT_DATA) >> DATA_SHIFT;
+	return true;
+}
+
+/*
+ * Hand the stub the loader, see SYS_LOADER in comms.h.  Every ACK here looks
+ * like the last one, so only ever look at words we haven't seen yet.
+ */
+static void doStage2(void) {
+	u32 rx, data, size = (ldrSize + 3) & ~3;
+	u64 ticks;
+
+	cur->stageTicks = gettime();
+	csend(CLASS_SYS | SYS_LOADER | 0 /* id */ | 0 /* data */);
+	if (!recvNew(&rx) || !stubAck(rx, &data) || data != 0)
+		return;
+
+	send(size);
+	send(ldrWords);
+	csend(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crc16_update(crc16_update(CRC16_INIT, size), ldrWords) << DATA_SHIFT));
+	if (!recvNew(&rx) || !stubAck(rx, &data) || data != 0)
+		return;
+
+	sendBurst(0, ldrWords, ldrPacked);
+
+	/* unpacking and checking it takes the GBA a little while; if it never says, see if the loader answers anyway */
+	ticks = gettime();
+	while (diff_msec(ticks, gettime()) < 2000) {
+		if (!recvNew(&rx) || !stubAck(rx, &data))
+			continue;
+
+		if (data & BURST_ACK_RETRY) {
+			puts("Stub didn't like the loader, sending it again");
+			return;
+		}
+		if (data & BURST_ACK_BAD) {
+			puts("Stub unpacked a bad loader!  Power cycle the GBA to try again");
+			cur->state = STATE_WAIT_GBA;
+			return;
+		}
+		if (data == 0)
+			break;
+	}
+
+	printf("Sending the loader took %u ms for %u bytes\n",
+	       diff_msec(cur->stageTicks, gettime()), ldrWords * sizeof(u32));
+	puts("GBA booted!  Waiting for handshake...");
+	cur->state = STATE_HANDSHAKE_EMU;
+}
+
 static void doHandshake(void) {
 	u32 rx;
 
@@ -338,57 +762,251 @@ getReply:
 	/* ACK the ping reply */
 	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
 
-	/* valid ping, start transferring kernel */
-	puts("Got ping back from GBA!  Loading kernel...");
-	curState = STATE_READ_KERNEL;
+	/* valid ping, see what the GBA can do */
+	printf("Got ping back from GBA, %u ms after finding it!  Negotiating features...\n",
+	       diff_msec(cur->foundTicks, gettime()));
+	cur->state = STATE_NEGOTIATE;
 
 	return;
 }
 
-static void readKernel(void) {
-	FILE *fp;
+static void doNegotiate(void) {
+	u32 rx;
 
-	if (stat(KERN_PATH, &statBuf)) {
-		perror("stat() on " KERN_PATH " failed");
-		sleep(5);
-		exit(1);
+	csend(CLASS_SYS | SYS_FEATURES | 0 /* id */ | (C_OfferedFeatures << DATA_SHIFT));
+	rx = srecv();
+
+	/* nonsense, corrupt, or a stale word from the handshake; just ask again */
+	if (!crcValid(rx))
+		return;
+
+	if ((rx & PKT_CLASS)  != CLASS_SYS    ||
+	    (rx & PKT_SUBCMD) != SYS_FEATURES ||
+	    (rx & PKT_CMD_ID) != 0)
+		return;
+
+	cur->features = ((rx & PKT_DATA) >> DATA_SHIFT) & HOST_FEATURES;
+	if (!(cur->features & FEAT_BURST))
+		cur->features &= ~(FEAT_TAGGED | FEAT_LZ77 | FEAT_SACK | FEAT_FEC); /* all about burst blocks */
+	else
+		cur->features &= ~FEAT_PACE; /* nothing's paced */
+	printf("Negotiated features: 0x%04x\n", cur->features);
+
+	if (cur->features & FEAT_PACE) {
+		cur->state = STATE_CALIBRATE;
+		return;
 	}
 
-	if (statBuf.st_size >= 16 * 1024 * 1024) {
-		puts(KERN_PATH " is larger than 16MB, something is wrong!");
-		sleep(5);
-		exit(1);
+	/* GBA agreed, start transferring kernel */
+	puts("Loading kernel...");
+	cur->state = STATE_READ_KERNEL;
+
+	return;
+}
+
+/* one probe at `gap' us a word, true if the GBA got all of it */
+static bool probe(u32 gap) {
+	u32 rx, i, word, data, seq = ++cur->pace.seq & 0xff;
+	u16 crcVal = CRC16_INIT;
+
+	/* whatever the last probe left lying around */
+	while (L_Poll(cur->chan, &rx));
+
+	/* leave the header and trailer plenty of room, it's the words between them we're timing */
+	csend(CLASS_SYS | SYS_PING | 0 /* id */ | ((PING_PROBE | (seq << 8)) << DATA_SHIFT));
+	for (i = 0; i < PROBE_WORDS; i++) {
+		/* never a valid packet, so the GBA can tell the trailer from them */
+		word = crc(i * 0x9e3779b9) ^ (1 << CRC8_SHIFT);
+		usleep(i ? gap : PACE_MAX_US);
+		send(word);
+		crcVal = crc16_update(crcVal, word);
+	}
+	usleep(PACE_MAX_US);
+	csend(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT));
+
+	/* skip replies to earlier probes that came in late */
+	while (recvNew(&rx)) {
+		data = (rx & PKT_DATA) >> DATA_SHIFT;
+		if (crcValid(rx)                   &&
+		    (rx & PKT_CLASS)  == CLASS_SYS &&
+		    (rx & PKT_SUBCMD) == SYS_ACK   &&
+		    (rx & PKT_CMD_ID) == 0         &&
+		    (data & 0xff) == seq)
+			return !(data & BURST_ACK_RETRY);
 	}
+	return false;
+}
 
-	fp = fopen(KERN_PATH, "rb");
-	if (!fp) {
-		puts("Failed to open " KERN_PATH "!");
-		sleep(5);
-		exit(1);
+/* a gap only counts if it works twice running */
+static bool probeTwice(u32 gap) {
+	return probe(gap) && probe(gap);
+}
+
+/*
+ * Find the shortest gap between paced words that the GBA keeps up with:
+ * make sure the old one works (or find one that does), then halve the
+ * distance to one that doesn't, and leave a bit of room on top.
+ */
+static void doCalibrate(void) {
+	u32 lo = 0, hi = PACE_START_US, mid;
+	u64 ticks = gettime();
+	bool ok;
+
+	puts("Timing paced transfers...");
+	ok = probeTwice(hi);
+	while (!ok && hi < PACE_MAX_US) {
+		hi = (hi * 2 > PACE_MAX_US) ? PACE_MAX_US : hi * 2;
+		ok = probeTwice(hi);
 	}
 
-	if (fread(M_State.blocks[0].ptr.w8, statBuf.st_size, 1, fp) != 1) {
-		fclose(fp);
-		puts("Failed to read " KERN_PATH "!");
-		sleep(5);
-		exit(1);
+	if (!ok)
+		printf("GBA can't keep up even at %u us a word, going with that anyway\n", hi);
+	else if (probeTwice(0))
+		hi = 0;
+	else {
+		while (hi - lo > PACE_STEP_US) {
+			mid = (lo + hi) / 2;
+			if (probeTwice(mid))
+				hi = mid;
+			else
+				lo = mid;
+		}
 	}
 
-	fclose(fp);
+	cur->pace.floor = hi ? hi + (hi / 8) + PACE_STEP_US : 0;
+	if (cur->pace.floor > PACE_MAX_US)
+		cur->pace.floor = PACE_MAX_US;
+	cur->pace.good = 0;
+	paceSet(cur->pace.floor);
+	printf("Paced transfers: %u us between words, took %u ms to find\n", cur->pace.gap, diff_msec(ticks, gettime()));
+
+	puts("Loading kernel...");
+	cur->state = STATE_READ_KERNEL;
+}
+
+static void ckptPath(char *path) {
+	sprintf(path, CKPT_PATH, cur->chan + 1);
+}
+
+static void readKernel(void) {
+	static u64 kernSize;
+	char path[sizeof(CKPT_PATH) + 8];
+	u32 entry, end;
+	bool elf;
+
+	/* the first GBA to get here opens it, and the pager has the file from then on */
+	if (!kernFile) {
+		if (stat(KERN_PATH, &statBuf)) {
+			perror("stat() on " KERN_PATH " failed");
+			sleep(5);
+			exit(1);
+		}
+
+		kernFile = fopen(KERN_PATH, "rb");
+		if (!kernFile) {
+			puts("Failed to open " KERN_PATH "!");
+			sleep(5);
+			exit(1);
+		}
+		kernSize = statBuf.st_size;
+		kernStamp = (u32)kernSize ^ (u32)statBuf.st_mtime;
 
-	printf("Successfully read GBA Linux Kernel (%llu bytes)\n", statBuf.st_size);
+		/* the disk outlives the GBA, if it reconnects it picks up where it left off */
+		V_Open(DISK_PATH);
+		if (V_Sectors)
+			diskOwner = cur;
 
-	curState = STATE_LOAD_KERNEL;
+		D_Open(kernFile);
+	}
+
+	/* every GBA gets the same kernel, in its own guest memory */
+	if (!cur->mapped) {
+		elf = E_Load(kernFile, cur->base, cur->size, &entry, &end);
+		if (!elf) {
+			/* a raw image, goes in as-is */
+			if (kernSize > cur->size) {
+				puts(KERN_PATH " is larger than guest memory, something is wrong!");
+				sleep(5);
+				exit(1);
+			}
+			D_Map(cur->base, 0, kernSize);
+			entry = GUEST_RAM_BASE;
+			end = kernSize;
+		}
+		kernElf = elf;
+		kernEntry = entry;
+		kernEnd = end;
+		cur->mapped = true;
+	}
+
+	/* if it saved itself last time, carry on from there instead of booting */
+	ckptPath(path);
+	if (CK_Load(path, cur->base, cur->size, kernStamp, cur->core, &cur->coreWords))
+		printf("Resuming from %s in %u ms (%u pages, %u of zeroes), delete it to boot afresh\n",
+		       path, CK_Stats.ms, CK_Stats.pages, CK_Stats.zeroes);
+
+	if (C_DemandPaging) {
+		/* Z_Reply() compresses whatever the GBA asks for as it goes instead */
+		printf("Paging in GBA Linux Kernel (%llu bytes) as it's needed\n", kernSize);
+		cur->state = STATE_LOAD_KERNEL;
+		return;
+	}
+
+	D_Finish();
+	printf("Successfully read GBA Linux Kernel (%llu bytes)\n", kernSize);
+
+	/* get compressing the kernel out of the way before the GBA starts asking for it */
+	if (cur->features & FEAT_LZ77)
+		Z_CachePages(cur->base, kernEnd);
+
+	cur->state = STATE_LOAD_KERNEL;
 	return;
 }
 
 static void loadKernel(void) {
-	u32 rx;
+	u32 rx, flags, i;
+	u16 crcVal = CRC16_INIT;
+
+	/* something it can't have been given by another port, or last time we ran */
+	while (!cur->session)
+		cur->session = ((u32)gettime() << 2) | cur->chan;
+
+	/* nothing else about the ELF matters to the GBA */
+	flags = (kernElf ? KERNEL_LOAD_ENTRY : 0) | ((cur == diskOwner) ? KERNEL_LOAD_DISK : 0) |
+	        (cur->coreWords ? KERNEL_LOAD_RESUME : 0) | KERNEL_LOAD_SESSION;
 
 	puts("sending...");
-	csend(CLASS_SYS | SYS_KERNEL_LOAD | 0 /* id */ | 0);
+	csend(CLASS_SYS | SYS_KERNEL_LOAD | 0 /* id */ | (flags << DATA_SHIFT));
+	if (flags & KERNEL_LOAD_ENTRY) {
+		paceGap();
+		send(kernEntry);
+		crcVal = crc16_update(crcVal, kernEntry);
+	}
+	if (flags & KERNEL_LOAD_DISK) {
+		paceGap();
+		send(V_Sectors);
+		crcVal = crc16_update(crcVal, V_Sectors);
+	}
+	if (flags & KERNEL_LOAD_RESUME) {
+		paceGap();
+		send(cur->coreWords);
+		crcVal = crc16_update(crcVal, cur->coreWords);
+		for (i = 0; i < cur->coreWords; i++) {
+			paceGap();
+			send(cur->core[i]);
+			crcVal = crc16_update(crcVal, cur->core[i]);
+		}
+	}
+	paceGap();
+	send(cur->session);
+	crcVal = crc16_update(crcVal, cur->session);
+	paceGap();
+	csend(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT));
+
+	/* a retry request looks just like the last one, so only take a fresh word */
 	puts("receiving...");
-	rx = srecv();
+	if (!recvNew(&rx))
+		return;
 
 	/* nonsense or corrupt */
 	if (!crcValid(rx)) {
@@ -406,84 +1024,1330 @@ static void loadKernel(void) {
 	}
 
 	/* valid ACK */
-	puts("GBA is now preparing to boot the kernel, entering main communications loop...");
+	if (flags & KERNEL_LOAD_RESUME)
+		puts("GBA is now picking up where it left off, entering main communications loop...");
+	else
+		puts("GBA is now preparing to boot the kernel, entering main communications loop...");
+	cur->coreWords = 0;
 
-	curState = STATE_READY;
+	cur->probeTicks = gettime();
+	cur->state = STATE_READY;
 
 	return;
 }
 
-static void memRead(void) {
-	u32 rx, addr, length, tmp[2];
-	u16 crcVal, crcValCalc;
-	int i;
-
-	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
-
-	while (1) {
-		rx = srecv();
-		if ((rx & PKT_CLASS) == CLASS_MEM &&
-		    (rx & PKT_SUBCMD) == MEM_READ)
-			continue; /* HACK: fix weird issue where it reads the MEM_READ command multiple times */
-		break;
+/*
+ * The next block to send: a resend if FEAT_SACK owes one, or a new one if
+ * the window has room; false for neither.  redo is a bit per block from
+ * acked on.
+ */
+static inline bool burstNext(u32 *redo, u32 *blk, u32 acked, u32 nblk, u32 *out) {
+	if (*redo) {
+		*out = acked + __builtin_ctz(*redo);
+		*redo &= *redo - 1;
+		return true;
 	}
 
-	addr = tmp[0] = rx;
-	length = tmp[1] = srecv();
-	printf("Got MEM_READ with addr=0x%08x, length=%u\n", addr, length);
-
-	rx = srecv();
-	if ((rx & PKT_CLASS)  != CLASS_SYS      ||
-	    (rx & PKT_SUBCMD) != SYS_MW_TX_DONE ||
-	    (rx & PKT_CMD_ID) != 0) {
-		printf("Invalid data (0x%08x) for MW_TX_DONE 1\n", rx);
-		return;
+	if (*blk < nblk && *blk - acked < BURST_WINDOW) {
+		*out = (*blk)++;
+		return true;
 	}
+	return false;
+}
 
-	crcVal = (rx & PKT_DATA) >> DATA_SHIFT;
-	crcValCalc = calc_crc16((u8 *)tmp, 2 * sizeof(u32));
-	if (crcVal != crcValCalc) {
-		printf("Invalid CRC (0x%04x != 0x%04x) for addr+len\n", crcVal, crcValCalc);
+/* FEAT_SACK: the GBA has everything before `to' now */
+static inline void sackAdvance(u32 *redo, u32 *acked, u32 to) {
+	if (to <= *acked)
 		return;
-	}
 
-	/* all checks out, ACK */
-	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
+	*redo = (to - *acked >= 32) ? 0 : *redo >> (to - *acked);
+	*acked = to;
+}
 
-	for (i = 0; i < length; i++) {
-		//printf("Sending word %d / %d\n", i, length);
-		usleep(1000); /* give it a bit between writes, it seems to desync if we spam it too hard */
-		send(*(u32 *)M_GuestToHost(addr + (i * sizeof(u32))));
-		usleep(1000);
-	}
-	puts("doing CRCs and sending it");
+/*
+ * Stream `length' words from addr in burst mode, or from src if it's a
+ * compressed reply.  The GBA ACKs every block cumulatively, so we only need
+ * to look at the newest ACK to know how far it got.  On a retry request,
+ * resend just the block it names with FEAT_SACK, or rewind to it without;
+ * on a stall, rewind to the first unACKed block.
+ */
+static void sendBurst(u32 addr, u32 length, const u32 *src) {
+	u32 rx, data, blk, acked, nblk, n, i, seq, lastSeq, word, redo, b, fec[FEC_WORDS];
+	bool sack = (cur->features & FEAT_SACK) != 0;
+	u16 crcVal;
+	u64 ticks;
+
+	nblk = (length + BURST_BLOCK_WORDS - 1) / BURST_BLOCK_WORDS;
+	blk = acked = redo = 0;
+	lastSeq = 0;
+	ticks = gettime();
 
-	/* sent memory, send SYS_MW_TX_DONE */
-	/* FIXME: if this crosses a memblock boundary, we're screwed */
-	crcVal = calc_crc16((u8 *)M_GuestToHost(addr), length * sizeof(u32));
-	csend(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT) /* data */);
+	while (acked < nblk) {
+		if (burstNext(&redo, &blk, acked, nblk, &b)) {
+			n = length - (b * BURST_BLOCK_WORDS);
+			if (n > BURST_BLOCK_WORDS)
+				n = BURST_BLOCK_WORDS;
+
+			csend(CLASS_MEM | MEM_READ | 0 /* id */ | (b << DATA_SHIFT));
+			crcVal = CRC16_INIT;
+			memset(fec, 0, sizeof(fec));
+			for (i = 0; i < n; i++) {
+				if (src)
+					word = ntohl(src[(b * BURST_BLOCK_WORDS) + i]);
+				else
+					word = ntohl(*(u32 *)M_GuestToHost(addr + (((b * BURST_BLOCK_WORDS) + i) * sizeof(u32))));
+				send(word);
+				crcVal = crc16_update(crcVal, word);
+				if (cur->features & FEAT_FEC)
+					fec_add(fec, i, word);
+			}
+
+			if (cur->features & FEAT_FEC) {
+				for (i = 0; i < FEC_WORDS; i++)
+					send(fec[i]);
+			}
+
+			csend(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT));
+		}
 
-	puts("read done");
+		/* see how far the GBA got */
+		rx = srecv();
+		if (crcValid(rx)                   &&
+		    (rx & PKT_CLASS)  == CLASS_SYS &&
+		    (rx & PKT_SUBCMD) == SYS_ACK   &&
+		    (rx & PKT_CMD_ID) == 0) {
+			data = (rx & PKT_DATA) >> DATA_SHIFT;
+			seq = (data & BURST_ACK_SEQ) >> BURST_ACK_SEQ_SHIFT;
+
+			/* a selective retry is still cumulative */
+			if (sack && (data & BURST_ACK_BLK) > acked) {
+				sackAdvance(&redo, &acked, data & BURST_ACK_BLK);
+				ticks = gettime();
+			}
+
+			if (data & BURST_ACK_RETRY) {
+				/* only act on each retry request once */
+				if (seq != lastSeq) {
+					lastSeq = seq;
+					if (sack)
+						redo |= 1;
+					else {
+						blk = data & BURST_ACK_BLK;
+						if (blk < acked)
+							blk = acked;
+					}
+					ticks = gettime();
+					cur->stats->retries++;
+					TRACE(TR_ERR, TR_RETRY, CLASS_MEM | MEM_READ, data & BURST_ACK_BLK, 0);
+				}
+			}
+			else if ((data & BURST_ACK_BLK) > acked) {
+				acked = data & BURST_ACK_BLK;
+				ticks = gettime();
+			}
+		}
+		else if (crcValid(rx)) {
+			/* a new request, the GBA lost the ACK before this and gave up; it'll ask again */
+			cur->stats->retries++;
+			TRACE(TR_ERR, TR_BAD, CLASS_MEM | MEM_READ, rx, acked);
+			return;
+		}
 
-	return;
+		/* no progress for a while, the GBA probably lost a word; go back */
+		if (diff_msec(ticks, gettime()) > 50) {
+			blk = acked;
+			redo = 0;
+			ticks = gettime();
+			cur->stats->retries++;
+			TRACE(TR_ERR, TR_RETRY, CLASS_MEM | MEM_READ, blk, 0);
+		}
+	}
 }
 
-static void memWrite(void) {
+/*
+ * Read-ahead: look for the GBA stepping through memory by a fixed stride
+ * with same-sized MEM_READs, and once it has done it twice in a row, push
+ * the next few blocks at it while the link is otherwise idle.  The GBA
+ * tells us how many of them it used, and the depth follows that.
+ */
+static void raAdapt(void) {
+	if (cur->ra.pushed < PUSH_ADAPT_WINDOW)
+		return;
+
+	if (cur->ra.hits * 4 >= cur->ra.pushed * 3 && cur->ra.depth < PUSH_MAX_DEPTH)
+		cur->ra.depth++;
+	else if (cur->ra.hits * 2 < cur->ra.pushed && cur->ra.depth > 1)
+		cur->ra.depth--;
 
+	printf("Read-ahead: %u/%u pushes used, depth now %u\n", cur->ra.hits, cur->ra.pushed, cur->ra.depth);
+	cur->ra.pushed = cur->ra.hits = 0;
+}
+
+static void raDemand(u32 addr, u32 words) {
+	s32 stride = addr - cur->ra.lastAddr;
+
+	if (cur->ra.streaming && words == cur->ra.lastWords && addr == cur->ra.next) {
+		/* the GBA caught up with us, get further ahead */
+		if (cur->ra.depth < PUSH_MAX_DEPTH)
+			cur->ra.depth++;
+		cur->ra.next += cur->ra.stride;
+		cur->ra.ahead = 0;
+	}
+	else if (stride && stride == cur->ra.stride && words == cur->ra.lastWords) {
+		/* same step twice running, push from here on */
+		cur->ra.streaming = true;
+		cur->ra.next = addr + stride;
+		cur->ra.ahead = 0;
+	}
+	else {
+		cur->ra.streaming = false;
+		cur->ra.stride = stride;
+	}
+
+	cur->ra.lastAddr = addr;
+	cur->ra.lastWords = words;
+	cur->ra.phase = 0;
+}
+
+/* the GBA spoke up, so it threw away whatever we were partway through */
+static void raAbort(void) {
+	cur->ra.phase = 0;
+}
+
+static bool raWantsPush(void) {
+	return cur->ra.phase || (cur->ra.streaming && cur->ra.ahead < cur->ra.depth);
+}
+
+/* send the next word of read-ahead; only call once the GBA has taken the last one */
+static void raPush(void) {
+	u32 word;
+
+	switch (cur->ra.phase) {
+	case 0: {
+		/* ra goes by the GBA's addresses, not ours */
+		if (cur->ra.lastWords > cur->ra.maxWords || cur->ra.next >= cur->size ||
+		    cur->ra.lastWords * sizeof(u32) > cur->size - cur->ra.next) {
+			cur->ra.streaming = false;
+			return;
+		}
+		D_Fault(cur->base + cur->ra.next, cur->ra.lastWords * sizeof(u32));
+		csend(CLASS_MEM | MEM_PUSH | 0 /* id */ | (cur->ra.lastWords << DATA_SHIFT));
+		TRACE(TR_STEP, TR_PUSH, CLASS_MEM | MEM_PUSH, cur->ra.next, cur->ra.lastWords);
+		cur->ra.phase = 1;
+		break;
+	}
+	case 1: {
+		send(cur->ra.next);
+		cur->ra.crc = crc16_update(CRC16_INIT, cur->ra.next);
+		cur->ra.pos = 0;
+		cur->ra.phase = 2;
+		break;
+	}
+	case 2: {
+		word = ntohl(*(u32 *)M_GuestToHost(cur->base + cur->ra.next + (cur->ra.pos * sizeof(u32))));
+		send(word);
+		cur->ra.crc = crc16_update(cur->ra.crc, word);
+		if (++cur->ra.pos == cur->ra.lastWords)
+			cur->ra.phase = 3;
+		break;
+	}
+	case 3: {
+		csend(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (cur->ra.crc << DATA_SHIFT));
+		cur->ra.phase = 0;
+		cur->ra.next += cur->ra.stride;
+		cur->ra.ahead++;
+		cur->ra.pushed++;
+		raAdapt();
+		break;
+	}
+	}
+}
+
+/* the GBA either used some pushes, or doesn't want this one */
+static void raFeedback(u32 rx) {
+	u32 data = (rx & PKT_DATA) >> DATA_SHIFT;
+
+	if (data & PUSH_CANCEL) {
+		/* it already has it, or it's too big; either way, stop guessing for now */
+		cur->ra.maxWords = data & PUSH_COUNT;
+		cur->ra.streaming = false;
+		cur->ra.phase = 0;
+		return;
+	}
+
+	cur->ra.hits += data & PUSH_COUNT;
+	cur->ra.ahead = ((data & PUSH_COUNT) > cur->ra.ahead) ? 0 : cur->ra.ahead - (data & PUSH_COUNT);
+
+	/* the GBA is spinning on the rest of this push, no need to check before each word */
+	if (data & PUSH_WAIT) {
+		while (cur->ra.phase)
+			raPush();
+	}
+}
+
+/* how the LZ77 replies are doing, along with the MEM_READ numbers */
+static void lzBench(void) {
+	if (!(cur->features & FEAT_LZ77))
+		return;
+
+	printf("LZ77: %u replies compressed, %u raw, %u of them cached, %llu -> %llu bytes\n",
+	       Z_Stats.packed, Z_Stats.raw, Z_Stats.cached, Z_Stats.in, Z_Stats.out);
+}
+
+/* MEM_READ, or BLK_READ for the disk */
+static void memRead(u32 cmd) {
+	u32 rx, addr, length, word, lzWords = 0;
+	u16 crcVal, crcValCalc;
+	u64 ticks, start = gettime();
+	int i, mode;
+	bool blk = (cmd & PKT_CLASS) == CLASS_BLK, zero;
+
+	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
+
+	/* only take fresh words, or we can see the command again, or one word twice */
+	if (!recvNew(&addr) || !recvNew(&length) || !recvNew(&rx)) {
+		puts("Timed out waiting for MEM_READ addr+len");
+		return;
+	}
+	TRACE(TR_REQ, TR_RECV, cmd, addr, length);
+
+	crcVal = (rx & PKT_DATA) >> DATA_SHIFT;
+	crcValCalc = crc16_update(crc16_update(CRC16_INIT, addr), length);
+	if (!crcValid(rx)                        ||
+	    (rx & PKT_CLASS)  != CLASS_SYS      ||
+	    (rx & PKT_SUBCMD) != SYS_MW_TX_DONE ||
+	    (rx & PKT_CMD_ID) != 0) {
+		printf("Invalid data (0x%08x) for MW_TX_DONE 1\n", rx);
+		cur->stats->crcFails++;
+		TRACE(TR_ERR, TR_BAD, cmd, rx, crcValCalc);
+		return;
+	}
+
+	if (crcVal != crcValCalc) {
+		printf("Invalid CRC (0x%04x != 0x%04x) for addr+len\n", crcVal, crcValCalc);
+		cur->stats->crcFails++;
+		TRACE(TR_ERR, TR_BAD, cmd, crcVal, crcValCalc);
+		return;
+	}
+
+	/* length is straight off the wire, it has to be in bounds before it's made bytes or it can wrap */
+	if (blk) {
+		if (cur != diskOwner || !V_Addr(addr, length, &addr)) {
+			printf("Refusing BLK_READ of %u sectors at %u\n", length, addr);
+			TRACE(TR_ERR, TR_REFUSED, cmd, addr, length);
+			csend(CLASS_SYS | SYS_ACK | 0 /* id */ | (READ_ACK_BAD << DATA_SHIFT));
+			return;
+		}
+		length *= BLK_SECTOR_WORDS;
+	}
+	else if (!length || length > BURST_MAX_WORDS || (addr & 3) || !guestAddr(&addr, length * sizeof(u32))) {
+		printf("Refusing MEM_READ of %u words at 0x%08x\n", length, addr);
+		TRACE(TR_ERR, TR_REFUSED, cmd, addr, length);
+		csend(CLASS_SYS | SYS_ACK | 0 /* id */ | (READ_ACK_BAD << DATA_SHIFT));
+		return;
+	}
+
+	/* all checks out, ACK, and say if it's coming compressed, or not coming at all */
+	D_Fault(addr, length * sizeof(u32));
+	zero = (cur->features & FEAT_ZERO) && M_Untouched(addr, length * sizeof(u32));
+	if (!zero && (cur->features & FEAT_LZ77) && (cmd & (READ_LZ_OK << DATA_SHIFT)))
+		lzWords = Z_Reply(addr, length, (u8 *)writeBuf);
+	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | ((zero ? READ_ACK_ZERO : lzWords ? READ_ACK_LZ | lzWords : 0) << DATA_SHIFT));
+	TRACE(TR_STEP, TR_DATA, cmd, length, lzWords);
+
+	if (!blk && (cur->features & FEAT_PUSH))
+		raDemand(addr - cur->base, length);
+
+	ticks = gettime();
+	mode = (cur->features & FEAT_BURST) ? 1 : 0;
+	if (zero) {
+		C_ZeroReplies++;
+		goto done;
+	}
+	if (mode) {
+		if (lzWords)
+			sendBurst(addr, lzWords, writeBuf);
+		else
+			sendBurst(addr, length, NULL);
+		goto done;
+	}
+
+	/* the GBA says if it lost track of the last one, so we know if we're going too fast */
+	if (cur->features & FEAT_PACE) {
+		if (cmd & (READ_RETRY << DATA_SHIFT))
+			paceBad();
+		else
+			paceGood();
+	}
+
+	crcVal = CRC16_INIT;
+	for (i = 0; i < length; i++) {
+		//printf("Sending word %d / %d\n", i, length);
+		word = ntohl(*(u32 *)M_GuestToHost(addr + (i * sizeof(u32))));
+		paceGap(); /* give it a bit between writes, it desyncs if we spam it too hard */
+		send(word);
+		crcVal = crc16_update(crcVal, word);
+	}
+	paceGap();
+
+	/* sent memory, send SYS_MW_TX_DONE */
+	csend(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT) /* data */);
+
+done:
+	stats_done(cur->stats, cmd & PKT_CLASS, false, length * sizeof(u32), diff_usec(start, gettime()));
+	readBench[mode].ticks += gettime() - ticks;
+	readBench[mode].words += length;
+	if (++readBench[mode].reads % BENCH_PRINT_INTERVAL == 0) {
+		u32 ms = diff_msec(0, readBench[mode].ticks);
+		printf("MEM_READ (%s): %u words in %u ms, %u words/s\n",
+		       mode ? "burst" : "paced", readBench[mode].words, ms,
+		       ms ? (u32)(((u64)readBench[mode].words * 1000) / ms) : 0);
+		lzBench();
+	}
+
+	TRACE(TR_REQ, TR_DONE, cmd, length * sizeof(u32), diff_usec(start, gettime()));
+	return;
+}
+
+/* MEM_WRITE, or BLK_WRITE for the disk */
+static void memWrite(u32 cmd) {
+	u32 rx, addr, length, i;
+	u16 crcVal, crcValCalc;
+	u64 ticks, start = gettime();
+	bool blk = (cmd & PKT_CLASS) == CLASS_BLK, ok;
+
+	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
+
+	if (!recvNew(&addr) || !recvNew(&length) || !recvNew(&rx)) {
+		puts("Timed out waiting for MEM_WRITE addr+len");
+		return;
+	}
+	TRACE(TR_REQ, TR_RECV, cmd, addr, length);
+
+	crcVal = (rx & PKT_DATA) >> DATA_SHIFT;
+	crcValCalc = crc16_update(crc16_update(CRC16_INIT, addr), length);
+	if (!crcValid(rx)                        ||
+	    (rx & PKT_CLASS)  != CLASS_SYS      ||
+	    (rx & PKT_SUBCMD) != SYS_MW_TX_DONE ||
+	    (rx & PKT_CMD_ID) != 0) {
+		printf("Invalid data (0x%08x) for MW_TX_DONE 1\n", rx);
+		cur->stats->crcFails++;
+		TRACE(TR_ERR, TR_BAD, cmd, rx, crcValCalc);
+		return;
+	}
+
+	if (crcVal != crcValCalc) {
+		printf("Invalid CRC (0x%04x != 0x%04x) for addr+len\n", crcVal, crcValCalc);
+		cur->stats->crcFails++;
+		TRACE(TR_ERR, TR_BAD, cmd, crcVal, crcValCalc);
+		return;
+	}
+
+	if (blk)
+		ok = cur == diskOwner && V_Addr(addr, length, &addr);
+	else
+		ok = !(addr & 3) && length <= WRITE_MAX_WORDS && guestAddr(&addr, length * sizeof(u32)) &&
+		     M_Writable(addr, length * sizeof(u32)) && poolRoom(addr, length * sizeof(u32));
+	if (!ok) {
+		if (blk)
+			printf("Refusing BLK_WRITE of %u sectors at %u\n", length, addr);
+		else
+			printf("Refusing MEM_WRITE of %u words to 0x%08x\n", length, addr);
+		TRACE(TR_ERR, TR_REFUSED, cmd, addr, length);
+		csend(CLASS_SYS | SYS_ACK | 0 /* id */ | (WRITE_ACK_BAD << DATA_SHIFT));
+		recvNew(&rx); /* GBA idles the line */
+		return;
+	}
+
+	if (blk)
+		length *= BLK_SECTOR_WORDS;
+
+	/* all checks out, ACK */
+	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | (WRITE_ACK_OK << DATA_SHIFT));
+
+	ticks = gettime();
+	crcValCalc = CRC16_INIT;
+	for (i = 0; i < length; i++) {
+		if (!recvNew(&writeBuf[i])) {
+			printf("Timed out on MEM_WRITE word %u / %u\n", i, length);
+			return;
+		}
+		crcValCalc = crc16_update(crcValCalc, writeBuf[i]);
+	}
+
+	if (!recvNew(&rx)) {
+		puts("Timed out waiting for MW_TX_DONE 2");
+		return;
+	}
+
+	crcVal = (rx & PKT_DATA) >> DATA_SHIFT;
+	if (!crcValid(rx)                        ||
+	    (rx & PKT_CLASS)  != CLASS_SYS      ||
+	    (rx & PKT_SUBCMD) != SYS_MW_TX_DONE ||
+	    (rx & PKT_CMD_ID) != 0              ||
+	    crcVal != crcValCalc) {
+		printf("Invalid CRC (0x%04x != 0x%04x) for MEM_WRITE data, asking again\n", crcVal, crcValCalc);
+		cur->stats->crcFails++;
+		cur->stats->retries++;
+		TRACE(TR_ERR, TR_BAD, cmd, crcVal, crcValCalc);
+		csend(CLASS_SYS | SYS_ACK | 0 /* id */ | (WRITE_ACK_RETRY << DATA_SHIFT));
+		recvNew(&rx); /* GBA idles the line */
+		return;
+	}
+
+	/* good data, it can go into guest memory now; the rest of the page has to be there first */
+	D_Fault(addr, length * sizeof(u32));
+	for (i = 0; i < length; i++)
+		writeBuf[i] = htonl(writeBuf[i]);
+	M_Write(addr, writeBuf, length * sizeof(u32));
+	Z_Invalidate(addr, length * sizeof(u32));
+
+	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | (WRITE_ACK_OK << DATA_SHIFT));
+	recvNew(&rx); /* GBA idles the line */
+
+	stats_done(cur->stats, cmd & PKT_CLASS, true, length * sizeof(u32), diff_usec(start, gettime()));
+	writeBench.ticks += gettime() - ticks;
+	writeBench.words += length;
+	if (++writeBench.writes % BENCH_PRINT_INTERVAL == 0) {
+		u32 ms = diff_msec(0, writeBench.ticks);
+		printf("MEM_WRITE: %u words in %u ms, %u words/s\n", writeBench.words, ms,
+		       ms ? (u32)(((u64)writeBench.words * 1000) / ms) : 0);
+	}
+
+	TRACE(TR_REQ, TR_DONE, cmd, length * sizeof(u32), diff_usec(start, gettime()));
+	return;
+}
+
+/* the GBA wants its guest saved, see PING_SAVE */
+static void doSave(u32 rx) {
+	u32 words = ((rx & PKT_DATA) >> DATA_SHIFT) >> 8, i;
+	u16 crcVal, crcValCalc = CRC16_INIT;
+	char path[sizeof(CKPT_PATH) + 8];
+	bool ok;
+
+	if (words > SAVE_MAX_WORDS) {
+		printf("Refusing a checkpoint with %u words of core state\n", words);
+		csend(CLASS_SYS | SYS_ACK | 0 /* id */ | (WRITE_ACK_BAD << DATA_SHIFT));
+		return;
+	}
+	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
+
+	for (i = 0; i < words; i++) {
+		if (!recvNew(&writeBuf[i])) {
+			printf("Timed out on core state word %u / %u\n", i, words);
+			return;
+		}
+		crcValCalc = crc16_update(crcValCalc, writeBuf[i]);
+	}
+
+	if (!recvNew(&rx)) {
+		puts("Timed out waiting for the core state's MW_TX_DONE");
+		return;
+	}
+
+	crcVal = (rx & PKT_DATA) >> DATA_SHIFT;
+	if (!crcValid(rx)                        ||
+	    (rx & PKT_CLASS)  != CLASS_SYS      ||
+	    (rx & PKT_SUBCMD) != SYS_MW_TX_DONE ||
+	    (rx & PKT_CMD_ID) != 0              ||
+	    crcVal != crcValCalc) {
+		printf("Invalid CRC (0x%04x != 0x%04x) for core state, asking again\n", crcVal, crcValCalc);
+		cur->stats->crcFails++;
+		cur->stats->retries++;
+		TRACE(TR_ERR, TR_BAD, rx, crcVal, crcValCalc);
+		csend(CLASS_SYS | SYS_ACK | 0 /* id */ | (WRITE_ACK_RETRY << DATA_SHIFT));
+		recvNew(&rx); /* GBA idles the line */
+		return;
+	}
+
+	/* what's on the disk has to go with what the guest thinks it wrote there */
+	T_Flush();
+	ckptPath(path);
+	ok = CK_Save(path, cur->base, cur->size, kernStamp, writeBuf, words);
+	if (ok)
+		printf("Saved port %d to %s in %u ms: %u pages, %u of zeroes, %u left out\n", cur->chan + 1,
+		       path, CK_Stats.ms, CK_Stats.pages, CK_Stats.zeroes, CK_Stats.skipped);
+
+	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | ((ok ? WRITE_ACK_OK : WRITE_ACK_BAD) << DATA_SHIFT));
+	recvNew(&rx); /* GBA idles the line */
+}
+
+/* wait out a look at the link that's still on its way back, and forget what it saw */
+static void lookDone(void) {
+	u32 rx;
+	u8 stat;
+	bool fresh;
+
+	while (cur->look == LOOK_STATUS && !L_StatusDone(cur->chan, &stat));
+	while (cur->look == LOOK_POLL && !L_PollDone(cur->chan, &rx, &fresh));
+	cur->look = LOOK_NONE;
+}
+
+/* drop everything that was in flight, the GBA asks again for whatever it still wants */
+static void resetLink(void) {
+	u32 id;
+
+	lookDone();
+	/* writes that never landed give back the frames they had set aside */
+	for (id = 0; id < MAX_INFLIGHT; id++)
+		M_Reserve(-(s32)cur->tags[id].frames);
+	memset(cur->tags, 0, sizeof(cur->tags));
+	memset(&cur->trx, 0, sizeof(cur->trx));
+	memset(&cur->ttx, 0, sizeof(cur->ttx));
+	cur->trxBusy = false;
+	raAbort();
+	cur->ra.streaming = false;
+	cur->ra.ahead = 0;
+}
+
+/* the GBA lost touch with us and wants back in (PING_SESSION); true if it's the one we have guest memory for */
+static bool doSession(void) {
+	u32 session, rx;
+	u16 crcVal;
+	bool ok;
+
+	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | 0 /* data */);
+	if (!recvNew(&session) || !recvNew(&rx)) {
+		puts("Timed out waiting for the GBA's session");
+		return false;
+	}
+
+	crcVal = (rx & PKT_DATA) >> DATA_SHIFT;
+	if (!crcValid(rx)                        ||
+	    (rx & PKT_CLASS)  != CLASS_SYS      ||
+	    (rx & PKT_SUBCMD) != SYS_MW_TX_DONE ||
+	    (rx & PKT_CMD_ID) != 0              ||
+	    crcVal != crc16_update(CRC16_INIT, session)) {
+		puts("Invalid CRC on the GBA's session, asking again");
+		cur->stats->crcFails++;
+		cur->stats->retries++;
+		TRACE(TR_ERR, TR_BAD, rx, crcVal, crc16_update(CRC16_INIT, session));
+		csend(CLASS_SYS | SYS_ACK | 0 /* id */ | (WRITE_ACK_RETRY << DATA_SHIFT));
+		recvNew(&rx); /* GBA idles the line */
+		return false;
+	}
+
+	ok = cur->session && session == cur->session;
+	if (ok) {
+		printf("GBA on port %d is back on session %08x, carrying on\n", cur->chan + 1, session);
+		resetLink();
+	}
+	else
+		printf("GBA on port %d wants session %08x, we don't have that one\n", cur->chan + 1, session);
+
+	csend(CLASS_SYS | SYS_ACK | 0 /* id */ | ((ok ? WRITE_ACK_OK : WRITE_ACK_BAD) << DATA_SHIFT));
+	recvNew(&rx); /* GBA idles the line */
+	return ok;
+}
+
+/* a ping once the kernel's going, maybe asking for our stats, a checkpoint, or to rejoin */
+static void doPing(u32 rx) {
+	u32 i;
+	u16 crcVal;
+
+	TRACE(TR_REQ, TR_PING, rx, (rx & PKT_DATA) >> DATA_SHIFT, 0);
+	if ((((rx & PKT_DATA) >> DATA_SHIFT) & 0xff) == PING_SAVE) {
+		doSave(rx);
+		return;
+	}
+	if (((rx & PKT_DATA) >> DATA_SHIFT) == PING_SESSION) {
+		/* it only asks after we've been quiet on it a while, whether or not we noticed */
+		doSession();
+		return;
+	}
+	if (((rx & PKT_DATA) >> DATA_SHIFT) != PING_STATS) {
+		csend(CLASS_SYS | SYS_PING_REPLY | 0 /* id */);
+		return;
+	}
+
+	/* a snapshot, so it doesn't change under us while it's going out */
+	memcpy(writeBuf, cur->stats, sizeof(*cur->stats));
+	for (i = 0; i < STATS_WORDS; i++)
+		writeBuf[i] = htonl(writeBuf[i]);
+
+	csend(CLASS_SYS | SYS_PING_REPLY | 0 /* id */ | (STATS_WORDS << DATA_SHIFT));
+	if (cur->features & FEAT_BURST) {
+		sendBurst(0, STATS_WORDS, writeBuf);
+		return;
+	}
+
+	crcVal = CRC16_INIT;
+	for (i = 0; i < STATS_WORDS; i++) {
+		paceGap();
+		send(ntohl(writeBuf[i]));
+		crcVal = crc16_update(crcVal, ntohl(writeBuf[i]));
+	}
+	paceGap();
+	csend(CLASS_SYS | SYS_MW_TX_DONE | 0 /* id */ | (crcVal << DATA_SHIFT));
+}
+
+void C_DumpStats(void) {
+	struct gba *was = cur;
+	int i;
+
+	for (i = 0; i < C_MAX_GBAS; i++) {
+		cur = &gbas[i];
+		if (!cur->size || cur->state == STATE_WAIT_GBA)
+			continue;
+
+		printf("Port %d:\n", cur->chan + 1);
+		stats_dump(cur->stats, "Host");
+		if (!(cur->features & FEAT_BURST))
+			printf("Paced word gap: %u us (calibrated %u us)\n", cur->pace.gap, cur->pace.floor);
+	}
+	cur = was;
+
+	if (cur)
+		lzBench();
+	printf("Guest memory: %u/%u page frames used, %u pages shared, %u reads of untouched pages\n",
+	       M_Stats.used, M_Stats.frames, M_Stats.shared, C_ZeroReplies);
+}
+
+bool C_DumpTrace(const char *path) {
+	FILE *fp = fopen(path, "wb");
+	bool ok;
+
+	if (!fp) {
+		printf("Can't open %s for the trace\n", path);
+		return false;
+	}
+
+	ok = fwrite(&trace, sizeof(trace), 1, fp) == 1;
+	ok = (fclose(fp) == 0) && ok;
+	printf("%s %u trace records to %s\n", ok ? "Wrote" : "Failed writing",
+	       (trace.hdr.head < C_TRACE_RECS) ? trace.hdr.head : C_TRACE_RECS, path);
+	return ok;
+}
+
+/*
+ * Tagged requests.  Up to MAX_INFLIGHT of them at once, one per cmd id,
+ * and nothing here waits on the GBA: tagRx() takes one word from it and
+ * tagTx() sends one word to it, and doTagged() keeps both going.
+ */
+#define TAG_RX_EVERY (BURST_BLOCK_WORDS) /* while we're sending, look for the GBA's ACKs about once a block */
+
+static inline u32 tagBlockWords(u32 length, u32 blk) {
+	u32 n = length - (blk * BURST_BLOCK_WORDS);
+
+	return (n > BURST_BLOCK_WORDS) ? BURST_BLOCK_WORDS : n;
+}
+
+/* done with, or dropped; a write that never landed gives back its frames */
+static void tagFree(u32 id) {
+	M_Reserve(-(s32)cur->tags[id].frames);
+	cur->tags[id].frames = 0;
+	cur->tags[id].type = TAG_FREE;
+}
+
+static void tagAck(u32 id, u32 data) {
+	cur->tags[id].ackPending = true;
+	cur->tags[id].ackData = data;
+}
+
+/* the request packet a tag came in as, for the trace */
+static inline u32 tagPkt(u32 id) {
+	return (cur->tags[id].disk ? CLASS_BLK : CLASS_MEM) | ((cur->tags[id].type == TAG_WRITE) ? MEM_WRITE : MEM_READ) |
+	       (id << CMD_ID_SHIFT);
+}
+
+static void tagBench(u32 id) {
+	bool write = cur->tags[id].type == TAG_WRITE;
+	u64 ticks = gettime() - cur->tags[id].start;
+	u32 ms;
+
+	stats_done(cur->stats, cur->tags[id].disk ? CLASS_BLK : CLASS_MEM, write, cur->tags[id].length * sizeof(u32), diff_usec(0, ticks));
+
+	if (write) {
+		writeBench.ticks += ticks;
+		writeBench.words += cur->tags[id].length;
+		if (++writeBench.writes % BENCH_PRINT_INTERVAL == 0) {
+			ms = diff_msec(0, writeBench.ticks);
+			printf("MEM_WRITE (tagged): %u words in %u ms, %u words/s\n", writeBench.words, ms,
+			       ms ? (u32)(((u64)writeBench.words * 1000) / ms) : 0);
+		}
+	}
+	else {
+		readBench[1].ticks += ticks;
+		readBench[1].words += cur->tags[id].length;
+		if (++readBench[1].reads % BENCH_PRINT_INTERVAL == 0) {
+			ms = diff_msec(0, readBench[1].ticks);
+			printf("MEM_READ (tagged): %u words in %u ms, %u words/s\n", readBench[1].words, ms,
+			       ms ? (u32)(((u64)readBench[1].words * 1000) / ms) : 0);
+			lzBench();
+		}
+	}
+
+	TRACE(TR_REQ, TR_DONE, tagPkt(id), cur->tags[id].length * sizeof(u32), diff_usec(0, ticks));
+}
+
+/* a whole request is in: addr, length, and the trailer in rx */
+static void tagSubmit(u32 rx) {
+	u32 id = cur->trx.id, addr = cur->trx.addr, length = cur->trx.length;
+	u32 pkt = (cur->trx.disk ? CLASS_BLK : CLASS_MEM) | ((cur->trx.type == TAG_WRITE) ? MEM_WRITE : MEM_READ) | (id << CMD_ID_SHIFT);
+	u16 crcVal = crc16_update(crc16_update(CRC16_INIT, addr), length);
+	bool zero;
+
+	TRACE(TR_REQ, TR_RECV, pkt, addr, length);
+
+	if (!crcValid(rx)                              ||
+	    (rx & PKT_CLASS)  != CLASS_SYS            ||
+	    (rx & PKT_SUBCMD) != SYS_MW_TX_DONE       ||
+	    ((rx & PKT_CMD_ID) >> CMD_ID_SHIFT) != id ||
+	    ((rx & PKT_DATA) >> DATA_SHIFT) != crcVal) {
+		printf("Invalid data (0x%08x) for MW_TX_DONE 1 (id %u), asking again\n", rx, id);
+		cur->stats->crcFails++;
+		cur->stats->retries++;
+		TRACE(TR_ERR, TR_BAD, pkt, rx, crcVal);
+		tagAck(id, BURST_ACK_RETRY);
+		return;
+	}
+
+	/* whatever had this id before is done with, the GBA only reuses ids it's finished with */
+	if (cur->ttx.busy && cur->ttx.id == id)
+		cur->ttx.busy = false;
+	tagFree(id);
+
+	if (cur->trx.disk) {
+		if (cur != diskOwner || !V_Addr(addr, length, &addr)) {
+			printf("Refusing request for %u sectors at %u (id %u)\n", length, addr, id);
+			TRACE(TR_ERR, TR_REFUSED, pkt, addr, length);
+			tagAck(id, BURST_ACK_BAD);
+			return;
+		}
+		length *= BLK_SECTOR_WORDS;
+	}
+	else {
+		if (!length || length > ((cur->trx.type == TAG_WRITE) ? WRITE_MAX_WORDS : BURST_MAX_WORDS) ||
+		    (addr & 3) || !guestAddr(&addr, length * sizeof(u32)) ||
+		    (cur->trx.type == TAG_WRITE && !M_Writable(addr, length * sizeof(u32)))) {
+			printf("Refusing request for %u words at 0x%08x (id %u)\n", length, addr, id);
+			TRACE(TR_ERR, TR_REFUSED, pkt, addr, length);
+			tagAck(id, BURST_ACK_BAD);
+			return;
+		}
+
+		/* other GBAs can go on writing while this one's data comes in, keep its frames for it */
+		if (cur->trx.type == TAG_WRITE) {
+			if (!poolRoom(addr, length * sizeof(u32))) {
+				printf("Out of page frames, refusing write of %u words to 0x%08x (id %u)\n", length, addr, id);
+				TRACE(TR_ERR, TR_REFUSED, pkt, addr, length);
+				tagAck(id, BURST_ACK_BAD);
+				return;
+			}
+			cur->tags[id].frames = M_Needed(addr, length * sizeof(u32));
+			M_Reserve(cur->tags[id].frames);
+		}
+	}
+
+	/* reads need it now, and writes mustn't be overwritten by it later */
+	D_Fault(addr, length * sizeof(u32));
+	zero = cur->trx.type == TAG_READ && (cur->features & FEAT_ZERO) && M_Untouched(addr, length * sizeof(u32));
+
+	cur->tags[id].type = cur->trx.type;
+	cur->tags[id].disk = cur->trx.disk;
+	cur->tags[id].addr = addr;
+	cur->tags[id].length = length;
+	cur->tags[id].lzWords = 0;
+	if (cur->trx.type == TAG_READ && !zero && cur->trx.lzOk && (cur->features & FEAT_LZ77))
+		cur->tags[id].lzWords = Z_Reply(addr, length, (u8 *)cur->tags[id].buf);
+	cur->tags[id].nblk = ((cur->tags[id].lzWords ? cur->tags[id].lzWords : length) + BURST_BLOCK_WORDS - 1) / BURST_BLOCK_WORDS;
+	cur->tags[id].start = cur->tags[id].ticks = gettime();
+	cur->tags[id].blk = cur->tags[id].acked = cur->tags[id].lastSeq = cur->tags[id].redo = 0;
+	cur->tags[id].expected = cur->tags[id].seq = 0;
+	cur->tags[id].hunting = false;
+
+	if (cur->trx.type == TAG_READ && !cur->trx.disk && (cur->features & FEAT_PUSH))
+		raDemand(addr - cur->base, length);
+
+	/* nothing to send if it's never been written, so it's done once the GBA has the ACK */
+	if (zero) {
+		tagAck(id, READ_ACK_ZERO);
+		TRACE(TR_STEP, TR_DATA, pkt, length, 0);
+		tagBench(id);
+		cur->tags[id].type = TAG_FREE;
+		C_ZeroReplies++;
+		return;
+	}
+
+	tagAck(id, cur->tags[id].lzWords ? READ_ACK_LZ | cur->tags[id].lzWords : 0);
+	TRACE(TR_STEP, TR_DATA, pkt, length, cur->tags[id].lzWords);
+}
+
+/* GBA ACKed some read data; same as sendBurst() */
+static void tagReadAck(u32 id, u32 data) {
+	u32 seq;
+
+	if (cur->tags[id].type != TAG_READ)
+		return;
+
+	seq = (data & BURST_ACK_SEQ) >> BURST_ACK_SEQ_SHIFT;
+	if ((cur->features & FEAT_SACK) && (data & BURST_ACK_BLK) > cur->tags[id].acked) {
+		sackAdvance(&cur->tags[id].redo, &cur->tags[id].acked, data & BURST_ACK_BLK);
+		cur->tags[id].ticks = gettime();
+	}
+
+	if (data & BURST_ACK_RETRY) {
+		/* only act on each retry request once */
+		if (seq != cur->tags[id].lastSeq) {
+			cur->tags[id].lastSeq = seq;
+			if (cur->features & FEAT_SACK)
+				cur->tags[id].redo |= 1;
+			else {
+				cur->tags[id].blk = data & BURST_ACK_BLK;
+				if (cur->tags[id].blk < cur->tags[id].acked)
+					cur->tags[id].blk = cur->tags[id].acked;
+			}
+			cur->tags[id].ticks = gettime();
+			cur->stats->retries++;
+			TRACE(TR_ERR, TR_RETRY, tagPkt(id), data & BURST_ACK_BLK, 0);
+		}
+		return;
+	}
+
+	if (!(cur->features & FEAT_SACK)) {
+		if ((data & BURST_ACK_BLK) <= cur->tags[id].acked)
+			return;
+		cur->tags[id].acked = data & BURST_ACK_BLK;
+		cur->tags[id].ticks = gettime();
+	}
+	if (cur->tags[id].acked >= cur->tags[id].nblk) {
+		tagBench(id);
+		cur->tags[id].type = TAG_FREE;
+	}
+}
+
+/* ask for a write block again */
+static void tagWriteRetry(u32 id) {
+	cur->stats->retries++;
+	TRACE(TR_ERR, TR_RETRY, tagPkt(id), cur->tags[id].expected, 0);
+	cur->tags[id].seq = (cur->tags[id].seq + 1) & 3;
+	tagAck(id, BURST_ACK_RETRY | (cur->tags[id].seq << BURST_ACK_SEQ_SHIFT) | cur->tags[id].expected);
+	cur->tags[id].hunting = true;
+}
+
+static void tagWriteHeader(u32 id, u32 blk) {
+	/* the GBA is resending something we already have, it must have missed our ACK */
+	if (cur->tags[id].type != TAG_WRITE) {
+		tagAck(id, blk + 1);
+		return;
+	}
+	if (blk < cur->tags[id].expected) {
+		tagAck(id, cur->tags[id].expected);
+		goto skip;
+	}
+
+	if (blk != cur->tags[id].expected) {
+		/* only ask once, then keep quiet until the GBA rewinds */
+		if (!cur->tags[id].hunting)
+			tagWriteRetry(id);
+		goto skip;
+	}
+
+	cur->tags[id].hunting = false;
+	cur->trx.state = TRX_WDATA;
+	cur->trx.id = id;
+	cur->trx.blk = blk;
+	cur->trx.pos = 0;
+	cur->trx.n = tagBlockWords(cur->tags[id].length, blk);
+	cur->trx.crc = CRC16_INIT;
+	return;
+
+skip:
+	/* don't go looking for packets in its data */
+	if (blk < cur->tags[id].nblk) {
+		cur->trx.state = TRX_SKIP;
+		cur->trx.n = tagBlockWords(cur->tags[id].length, blk) + 1;
+	}
+}
+
+static void tagWriteTrailer(u32 rx) {
+	u32 id = cur->trx.id, i;
+
+	if (!crcValid(rx)                              ||
+	    (rx & PKT_CLASS)  != CLASS_SYS            ||
+	    (rx & PKT_SUBCMD) != SYS_MW_TX_DONE       ||
+	    ((rx & PKT_CMD_ID) >> CMD_ID_SHIFT) != id ||
+	    ((rx & PKT_DATA) >> DATA_SHIFT) != cur->trx.crc) {
+		printf("Invalid CRC for MEM_WRITE block %u (id %u), asking again\n", cur->trx.blk, id);
+		cur->stats->crcFails++;
+		TRACE(TR_ERR, TR_BAD, tagPkt(id), rx, cur->trx.crc);
+		tagWriteRetry(id);
+		return;
+	}
+
+	/* ACKing every other block is plenty to keep the GBA's window open */
+	cur->tags[id].expected++;
+	if (!(cur->tags[id].expected % (BURST_WINDOW / 2)) || cur->tags[id].expected == cur->tags[id].nblk)
+		tagAck(id, cur->tags[id].expected);
+	if (cur->tags[id].expected < cur->tags[id].nblk)
+		return;
+
+	/* good data, it can go into guest memory now, in the frames it had set aside */
+	for (i = 0; i < cur->tags[id].length; i++)
+		cur->tags[id].buf[i] = htonl(cur->tags[id].buf[i]);
+	tagBench(id);
+	tagFree(id);
+	M_Write(cur->tags[id].addr, cur->tags[id].buf, cur->tags[id].length * sizeof(u32));
+	Z_Invalidate(cur->tags[id].addr, cur->tags[id].length * sizeof(u32));
+}
+
+static void tagRx(u32 rx) {
+	u32 id;
+
+	switch (cur->trx.state) {
+	case TRX_SUBMIT: {
+		if (cur->trx.pos == 0)
+			cur->trx.addr = rx;
+		else if (cur->trx.pos == 1)
+			cur->trx.length = rx;
+		else {
+			cur->trx.state = TRX_IDLE;
+			tagSubmit(rx);
+		}
+		cur->trx.pos++;
+		return;
+	}
+	case TRX_WDATA: {
+		cur->tags[cur->trx.id].buf[(cur->trx.blk * BURST_BLOCK_WORDS) + cur->trx.pos] = rx;
+		cur->trx.crc = crc16_update(cur->trx.crc, rx);
+		if (++cur->trx.pos == cur->trx.n)
+			cur->trx.state = TRX_WTRAILER;
+		return;
+	}
+	case TRX_WTRAILER: {
+		cur->trx.state = TRX_IDLE;
+		tagWriteTrailer(rx);
+		return;
+	}
+	case TRX_SKIP: {
+		if (--cur->trx.n == 0)
+			cur->trx.state = TRX_IDLE;
+		return;
+	}
+	case TRX_IDLE:
+		break;
+	}
+
+	if (rx == 0)
+		return;
+
+	if (!crcValid(rx)) {
+		puts("parity invalid");
+		cur->stats->crcFails++;
+		return;
+	}
+
+	id = (rx & PKT_CMD_ID) >> CMD_ID_SHIFT;
+	switch (rx & (PKT_CLASS | PKT_SUBCMD)) {
+	case CLASS_MEM | MEM_READ:
+	case CLASS_MEM | MEM_WRITE:
+	case CLASS_BLK | BLK_READ:
+	case CLASS_BLK | BLK_WRITE: {
+		/* the GBA dropped any read-ahead it was partway through to send this */
+		raAbort();
+		stats_req(cur->stats, rx);
+		cur->trx.state = TRX_SUBMIT;
+		cur->trx.type = ((rx & PKT_SUBCMD) == MEM_WRITE) ? TAG_WRITE : TAG_READ;
+		cur->trx.disk = (rx & PKT_CLASS) == CLASS_BLK;
+		cur->trx.lzOk = (rx & (READ_LZ_OK << DATA_SHIFT)) != 0;
+		cur->trx.id = id;
+		cur->trx.pos = 0;
+		break;
+	}
+	case CLASS_MEM | MEM_DATA: {
+		tagWriteHeader(id, (rx & PKT_DATA) >> DATA_SHIFT);
+		break;
+	}
+	case CLASS_MEM | MEM_PUSH: {
+		raFeedback(rx);
+		break;
+	}
+	case CLASS_SYS | SYS_ACK: {
+		tagReadAck(id, (rx & PKT_DATA) >> DATA_SHIFT);
+		break;
+	}
+	case CLASS_SYS | SYS_PING: {
+		/* only ever sent with nothing in flight */
+		raAbort();
+		stats_req(cur->stats, rx);
+		doPing(rx);
+		break;
+	}
+	default: {
+		printf("Unexpected packet in tagged mode: 0x%08x\n", rx);
+		break;
+	}
+	}
+}
+
+/* send the GBA the next word we owe it, false if there's nothing */
+static bool tagTx(void) {
+	u32 i, id, word;
+
+	if (cur->ttx.busy) {
+		id = cur->ttx.id;
+		if (cur->ttx.pos < cur->ttx.n) {
+			if (cur->tags[id].lzWords)
+				word = ntohl(cur->tags[id].buf[(cur->ttx.blk * BURST_BLOCK_WORDS) + cur->ttx.pos]);
+			else
+				word = ntohl(*(u32 *)M_GuestToHost(cur->tags[id].addr + (((cur->ttx.blk * BURST_BLOCK_WORDS) + cur->ttx.pos) * sizeof(u32))));
+			send(word);
+			cur->ttx.crc = crc16_update(cur->ttx.crc, word);
+			if (cur->features & FEAT_FEC)
+				fec_add(cur->ttx.fec, cur->ttx.pos, word);
+			cur->ttx.pos++;
+		}
+		else if ((cur->features & FEAT_FEC) && cur->ttx.pos < cur->ttx.n + FEC_WORDS) {
+			send(cur->ttx.fec[cur->ttx.pos - cur->ttx.n]);
+			cur->ttx.pos++;
+		}
+		else {
+			csend(CLASS_SYS | SYS_MW_TX_DONE | (id << CMD_ID_SHIFT) | (cur->ttx.crc << DATA_SHIFT));
+			cur->ttx.busy = false;
+		}
+		return true;
+	}
+
+	/* in between blocks: ACKs first, the GBA may be waiting on one */
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		if (cur->tags[id].ackPending) {
+			cur->tags[id].ackPending = false;
+			csend(CLASS_SYS | SYS_ACK | (id << CMD_ID_SHIFT) | (cur->tags[id].ackData << DATA_SHIFT));
+			return true;
+		}
+	}
+
+	/* then read data, taking turns */
+	for (i = 1; i <= MAX_INFLIGHT; i++) {
+		id = (cur->ttxNext + i) % MAX_INFLIGHT;
+		if (cur->tags[id].type != TAG_READ)
+			continue;
+
+		/* no progress for a while, the GBA probably lost a word; go back */
+		if (diff_msec(cur->tags[id].ticks, gettime()) > 50) {
+			cur->tags[id].blk = cur->tags[id].acked;
+			cur->tags[id].redo = 0;
+			cur->tags[id].ticks = gettime();
+			cur->stats->retries++;
+			TRACE(TR_ERR, TR_RETRY, tagPkt(id), cur->tags[id].blk, 0);
+		}
+
+		if (!burstNext(&cur->tags[id].redo, &cur->tags[id].blk, cur->tags[id].acked, cur->tags[id].nblk, &cur->ttx.blk))
+			continue;
+
+		cur->ttx.busy = true;
+		cur->ttx.id = id;
+		cur->ttx.pos = 0;
+		cur->ttx.n = tagBlockWords(cur->tags[id].lzWords ? cur->tags[id].lzWords : cur->tags[id].length, cur->ttx.blk);
+		cur->ttx.crc = CRC16_INIT;
+		memset(cur->ttx.fec, 0, sizeof(cur->ttx.fec));
+		csend(CLASS_MEM | MEM_READ | (id << CMD_ID_SHIFT) | (cur->ttx.blk << DATA_SHIFT));
+		cur->ttxNext = id;
+		return true;
+	}
+
+	return false;
+}
+
+static bool tagIdle(void) {
+	u32 id;
+
+	if (cur->ttx.busy || cur->trx.state != TRX_IDLE)
+		return false;
+
+	for (id = 0; id < MAX_INFLIGHT; id++) {
+		if (cur->tags[id].type != TAG_FREE || cur->tags[id].ackPending)
+			return false;
+	}
+	return true;
+}
+
+/* the GBA's been quiet for a bit, get some more of the kernel in off the SD card, and the disk's changes out */
+static void pagerIdle(void) {
+	u64 now = gettime();
+	int i;
+
+	/* the SD card holds everyone up, so only when they've all gone quiet */
+	for (i = 0; i < C_MAX_GBAS; i++) {
+		if (gbas[i].state == STATE_READY && diff_msec(gbas[i].lastHeard, now) < PAGER_IDLE_MS)
+			return;
+	}
+
+	D_Idle();
+	T_Clean();
+}
+
+/*
+ * The main loop's looks at the link, L_Status() and L_Poll() without the
+ * wait: the first call queues the transfer, and it and the calls after it
+ * say false until it's back, so the caller can get on with something else
+ * in the meantime (sending, or the pager) and come back.  One at a time.
+ */
+
+static bool lookStatus(u8 *stat) {
+	if (cur->look == LOOK_NONE) {
+		L_StatusStart(cur->chan);
+		cur->look = LOOK_STATUS;
+	}
+	if (!L_StatusDone(cur->chan, stat))
+		return false;
+
+	cur->look = LOOK_NONE;
+	return true;
+}
+
+static bool lookPoll(u32 *rx, bool *fresh) {
+	if (cur->look == LOOK_NONE) {
+		L_PollStart(cur->chan);
+		cur->look = LOOK_POLL;
+	}
+	if (!L_PollDone(cur->chan, rx, fresh))
+		return false;
+
+	cur->look = LOOK_NONE;
+	return true;
+}
+
+static void doTagged(void) {
+	u32 rx;
+	u8 stat;
+	bool sent, fresh;
+
+	/* keep read-ahead going for as long as neither side has anything else to do */
+	if (cur->look == LOOK_STATUS || (cur->look == LOOK_NONE && (cur->ra.phase || (tagIdle() && raWantsPush())))) {
+		if (!lookStatus(&stat)) {
+			pagerIdle();
+			return;
+		}
+		if (!(stat & 0x8)) {
+			if (!(stat & 0x2))
+				raPush();
+			else
+				pagerIdle(); /* the GBA's busy with something else, so are we */
+			return;
+		}
+	}
+
+	/* words go out behind a look that's still on its way back, so keep sending meanwhile */
+	sent = tagTx();
+
+	/* don't let the GBA sit on a word for long, it can't send the next one until we read it */
+	if (cur->look == LOOK_NONE && sent && !cur->trxBusy && ++cur->ttxSent % TAG_RX_EVERY != 0)
+		return;
+
+	if (!lookPoll(&rx, &fresh)) {
+		if (!sent && tagIdle())
+			pagerIdle();
+		return;
+	}
+
+	if (fresh) {
+		cur->lastHeard = gettime();
+		tagRx(rx);
+	}
+	else if (tagIdle())
+		pagerIdle();
+	cur->trxBusy = cur->trx.state != TRX_IDLE;
+}
+
+/* every so often, make sure it's still plugged in; if it isn't, keep its guest memory for when it's back */
+static bool stillThere(void) {
+	if (diff_msec(cur->probeTicks, gettime()) < PROBE_MS)
+		return true;
+
+	cur->probeTicks = gettime();
+	if (L_Probe(cur->chan))
+		return true;
+
+	printf("Lost the GBA on port %d!  Keeping session %08x for it\n", cur->chan + 1, cur->session);
+	resetLink();
+	cur->state = STATE_WAIT_GBA;
+	return false;
+}
+
+/* a GBA still running the loader, waiting for it to notice it lost us and ask to rejoin */
+static void doRejoin(void) {
+	u32 rx;
+	u8 stat;
+	bool fresh;
+
+	if (!L_Probe(cur->chan)) {
+		puts("GBA went away again");
+		lookDone();
+		cur->state = STATE_WAIT_GBA;
+		return;
+	}
+
+	/* power cycling it may not have taken long enough for us to see it go */
+	if (cur->look == LOOK_STATUS || (cur->look == LOOK_NONE && diff_msec(cur->probeTicks, gettime()) >= PROBE_MS)) {
+		if (!lookStatus(&stat))
+			return;
+
+		cur->probeTicks = gettime();
+		if (!(stat & JSTAT_SESSION)) {
+			puts("GBA's not running the loader any more");
+			cur->state = STATE_WAIT_GBA;
+		}
+		return;
+	}
+
+	if (!lookPoll(&rx, &fresh) || !fresh || !crcValid(rx) ||
+	    (rx & (PKT_CLASS | PKT_SUBCMD | PKT_CMD_ID)) != (CLASS_SYS | SYS_PING) ||
+	    ((rx & PKT_DATA) >> DATA_SHIFT) != PING_SESSION)
+		return;
+
+	cur->lastHeard = gettime();
+	if (!doSession())
+		return;
+
+	cur->probeTicks = gettime();
+	cur->state = STATE_READY;
 }
 
 static void doEmuComms(void) {
 	u32 rx;
+	u8 stat;
+	bool fresh;
 
-	rx = srecv();
-	if (rx == 0) /* anything going on? */
+	if (cur->features & FEAT_TAGGED) {
+		doTagged();
+		return;
+	}
+
+	/* keep read-ahead going for as long as the GBA has nothing to say */
+	if (cur->look == LOOK_STATUS || (cur->look == LOOK_NONE && raWantsPush())) {
+		if (!lookStatus(&stat)) {
+			pagerIdle();
+			return;
+		}
+		if (!(stat & 0x8)) {
+			if (!(stat & 0x2))
+				raPush();
+			else
+				pagerIdle(); /* the GBA's busy with something else, so are we */
+			return;
+		}
+	}
+
+	/* anything new going on? */
+	if (!lookPoll(&rx, &fresh) || !fresh || rx == 0) {
+		pagerIdle();
 		return;
+	}
+	cur->lastHeard = gettime();
 
 	if (!crcValid(rx)) {
 		puts("parity invalid");
+		cur->stats->crcFails++;
 		return;
 	}
 
+	if ((rx & PKT_CLASS) != CLASS_MEM || (rx & PKT_SUBCMD) != MEM_PUSH)
+		raAbort();
+	if ((rx & (PKT_CLASS | PKT_SUBCMD)) != (CLASS_SYS | SYS_ACK) &&
+	    (rx & (PKT_CLASS | PKT_SUBCMD)) != (CLASS_MEM | MEM_PUSH))
+		stats_req(cur->stats, rx);
+
 	switch (rx & PKT_CLASS) {
 	case CLASS_SYS: {
 		switch (rx & PKT_SUBCMD) {
@@ -497,10 +2361,14 @@ static void doEmuComms(void) {
 
 			break;
 		}
+		case SYS_PING: {
+			doPing(rx);
+			break;
+		}
 		case SYS_MW_TX_DONE:
-		case SYS_PING: /* TODO: maybe actually implement ping + reply for mainloop */
 		case SYS_PING_REPLY:
-		case SYS_KERNEL_LOAD: {
+		case SYS_KERNEL_LOAD:
+		case SYS_FEATURES: {
 			printf("Got weird SYS subcmd: 0x%08X\n", (rx & PKT_SUBCMD) >> SUBCMD_SHIFT);
 			sleep(1);
 			break;
@@ -515,11 +2383,15 @@ static void doEmuComms(void) {
 	case CLASS_MEM: {
 		switch (rx & PKT_SUBCMD) {
 		case MEM_READ: {
-			memRead();
+			memRead(rx);
 			break;
 		}
 		case MEM_WRITE: {
-			memWrite();
+			memWrite(rx);
+			break;
+		}
+		case MEM_PUSH: {
+			raFeedback(rx);
 			break;
 		}
 		default: {
@@ -529,6 +2401,23 @@ static void doEmuComms(void) {
 		}
 		break;
 	}
+	case CLASS_BLK: {
+		switch (rx & PKT_SUBCMD) {
+		case BLK_READ: {
+			memRead(rx);
+			break;
+		}
+		case BLK_WRITE: {
+			memWrite(rx);
+			break;
+		}
+		default: {
+			printf("Unknown BLK subcmd: 0x%08X\n", (rx & PKT_SUBCMD) >> SUBCMD_SHIFT);
+			break;
+		}
+		}
+		break;
+	}
 	default: {
 		printf("Unknown class: 0x%08x\n", (rx & PKT_CLASS) >> CLASS_SHIFT);
 		break;
@@ -537,15 +2426,47 @@ static void doEmuComms(void) {
 }
 
 void C_Process(void) {
-	switch (curState) {
-	case STATE_READ_LINUX_LOADER: {
+	static u32 next;
+	int i;
+
+	if (!ldrRead) {
 		readLinuxLoader();
-		break;
+		return;
+	}
+
+	if (!cur) {
+		for (i = 0; i < C_MAX_GBAS; i++) {
+			gbas[i].chan = i;
+			if (i < M_State.numGuests) {
+				gbas[i].base = M_State.guests[i].base;
+				gbas[i].size = M_State.guests[i].size;
+			}
+			gbas[i].stats = &C_Stats[i];
+			gbas[i].ra.depth = 2;
+			gbas[i].ra.maxWords = PKT_DATA >> DATA_SHIFT;
+			gbas[i].pace.gap = gbas[i].pace.floor = PACE_START_US;
+			gbas[i].state = STATE_WAIT_GBA;
+		}
 	}
+
+	/* one step for each GBA in turn, skipping the ports there's no guest memory for */
+	for (i = 0; i < C_MAX_GBAS; i++) {
+		cur = &gbas[next++ % C_MAX_GBAS];
+		if (cur->size)
+			break;
+	}
+	if (!cur->size)
+		return;
+
+	switch (cur->state) {
 	case STATE_WAIT_GBA: {
 		checkGBA();
 		break;
 	}
+	case STATE_REJOIN: {
+		doRejoin();
+		break;
+	}
 	case STATE_MULTIBOOT_SETUP: {
 		doMultibootSetup();
 		break;
@@ -554,10 +2475,22 @@ void C_Process(void) {
 		doMultiboot();
 		break;
 	}
+	case STATE_STAGE2: {
+		doStage2();
+		break;
+	}
 	case STATE_HANDSHAKE_EMU: {
 		doHandshake();
 		break;
 	}
+	case STATE_NEGOTIATE: {
+		doNegotiate();
+		break;
+	}
+	case STATE_CALIBRATE: {
+		doCalibrate();
+		break;
+	}
 	case STATE_READ_KERNEL: {
 		readKernel();
 		break;
@@ -567,7 +2500,8 @@ void C_Process(void) {
 		break;
 	}
 	case STATE_READY: {
-		doEmuComms();
+		if (stillThere())
+			doEmuComms();
 		break;
 	}
 	}
@@ -13,4 +13,15 @@
 #define RVL_ONLY(x)
 #endif
 
+#ifdef HW_RVL
+#define DOL_ONLY(x)
+#else
+#define DOL_ONLY(x) x
+#endif
+
+/* stupid libogc not exporting functions.... */
+extern u64 gettime(void);
+extern u32 diff_msec(u64 start,u64 end);
+extern u32 diff_usec(u64 start,u64 end);
+
 #endif
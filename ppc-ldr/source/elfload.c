@@ -0,0 +1,132 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - ELF kernel loading
+ *
+ * Only the program headers matter: each PT_LOAD segment goes to guest
+ * memory at its physical address, file contents first and then zeroes up
+ * to its size in memory.  Headers, section data and padding never make it
+ * into guest memory, so the GBA never has to read past them either.
+ *
+ * The file contents are only mapped here, the pager reads them in later.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gccore.h>
+#include "mem.h"
+#include "comms.h"
+#include "elfload.h"
+#include "pager.h"
+
+#define EI_NIDENT   (16)
+#define ELFCLASS32  (1)
+#define ELFDATA2LSB (1)
+#define EM_RISCV    (243)
+#define PT_LOAD     (1)
+
+#define EHDR_SIZE   (52)
+#define PHDR_SIZE   (32)
+#define MAX_PHDRS   (32)
+
+/* RISC-V is little endian, we might not be */
+static inline u16 le16(const u8 *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline u32 le32(const u8 *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static struct {
+	u32 offset, vaddr, paddr, filesz, memsz;
+} phdrs[MAX_PHDRS];
+
+static void fail(const char *why) {
+	printf("Can't load the kernel: %s!\n", why);
+	sleep(5);
+	exit(1);
+}
+
+bool E_Load(FILE *fp, u32 base, u32 size, u32 *entry, u32 *end) {
+	u8 ehdr[EHDR_SIZE], phdr[PHDR_SIZE];
+	u32 phoff, phentsize, phnum, e, i, n = 0, placed = 0, zeroed = 0, addr, fileSize;
+	bool found = false;
+
+	rewind(fp);
+	if (fread(ehdr, sizeof(ehdr), 1, fp) != 1           ||
+	    memcmp(ehdr, "\177ELF", 4)                      ||
+	    ehdr[4] != ELFCLASS32 || ehdr[5] != ELFDATA2LSB ||
+	    le16(&ehdr[18]) != EM_RISCV) {
+		rewind(fp);
+		return false;
+	}
+
+	e = le32(&ehdr[24]);
+	phoff = le32(&ehdr[28]);
+	phentsize = le16(&ehdr[42]);
+	phnum = le16(&ehdr[44]);
+	if (phentsize < PHDR_SIZE)
+		fail("program headers are too small");
+
+	/* read them all before placing anything, the first segment may well go over them */
+	for (i = 0; i < phnum; i++) {
+		if (fseek(fp, phoff + (i * phentsize), SEEK_SET) || fread(phdr, sizeof(phdr), 1, fp) != 1)
+			fail("program headers are past the end of the file");
+
+		if (le32(&phdr[0]) != PT_LOAD || !le32(&phdr[20]))
+			continue;
+
+		if (n == MAX_PHDRS)
+			fail("too many segments");
+
+		phdrs[n].offset = le32(&phdr[4]);
+		phdrs[n].vaddr  = le32(&phdr[8]);
+		phdrs[n].paddr  = le32(&phdr[12]);
+		phdrs[n].filesz = le32(&phdr[16]);
+		phdrs[n].memsz  = le32(&phdr[20]);
+
+		if (phdrs[n].filesz > phdrs[n].memsz)
+			fail("segment is bigger in the file than in memory");
+		if (phdrs[n].paddr < GUEST_RAM_BASE || phdrs[n].paddr - GUEST_RAM_BASE >= size ||
+		    phdrs[n].memsz > size - (phdrs[n].paddr - GUEST_RAM_BASE))
+			fail("segment is outside guest memory");
+
+		/* the core starts out without translation, so it wants the physical entry point */
+		if (!found && e - phdrs[n].vaddr < phdrs[n].memsz) {
+			*entry = e - phdrs[n].vaddr + phdrs[n].paddr;
+			found = true;
+		}
+		n++;
+	}
+
+	if (!found)
+		fail("entry point isn't in any segment");
+
+	/* nothing gets read until the GBA wants it, so check it's all there now */
+	if (fseek(fp, 0, SEEK_END))
+		fail("can't find the end of the file");
+	fileSize = ftell(fp);
+	for (i = 0; i < n; i++) {
+		if (phdrs[i].offset > fileSize || phdrs[i].filesz > fileSize - phdrs[i].offset)
+			fail("segment is past the end of the file");
+	}
+
+	*end = 0;
+	for (i = 0; i < n; i++) {
+		addr = phdrs[i].paddr - GUEST_RAM_BASE;
+		D_Map(base + addr, phdrs[i].offset, phdrs[i].filesz);
+		M_Zero(base + addr + phdrs[i].filesz, phdrs[i].memsz - phdrs[i].filesz);
+
+		placed += phdrs[i].filesz;
+		zeroed += phdrs[i].memsz - phdrs[i].filesz;
+		if (addr + phdrs[i].memsz > *end)
+			*end = addr + phdrs[i].memsz;
+	}
+
+	printf("Mapped %u segments, %u bytes from the file and %u zeroed, entry at 0x%08x\n",
+	       n, placed, zeroed, *entry);
+	return true;
+}
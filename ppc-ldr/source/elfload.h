@@ -0,0 +1,23 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - ELF kernel loading
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _ELFLOAD_H
+#define _ELFLOAD_H
+
+#include <stdio.h>
+#include <gccore.h>
+
+/*
+ * Place every PT_LOAD segment of the kernel in fp at its guest physical
+ * address in the size bytes of guest memory at base, and zero what's left
+ * over of each one in memory.  Fills in the physical entry point, and the
+ * end of the highest segment as an offset from base.  Returns false
+ * without touching anything if fp isn't a 32-bit RISC-V ELF; anything
+ * else wrong with it is fatal.
+ */
+extern bool E_Load(FILE *fp, u32 base, u32 size, u32 *entry, u32 *end);
+
+#endif /* _ELFLOAD_H */
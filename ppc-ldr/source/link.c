@@ -0,0 +1,241 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - JOY bus link over SI
+ *
+ * Transfers go through a queue of L_QUEUE slots rather than one at a time.
+ * Whoever queues one starts it if SI has room; otherwise the completion
+ * callback starts the next one as it finishes the last, so SI never sits
+ * waiting on us.  The callback also marks slots done, which makes
+ * [qTail, qDone) a ring of finished transfers that only the main loop
+ * empties: one producer, one consumer, and only the indices are shared.
+ *
+ * Sends don't wait for anything but room in the queue.  Reads go on the
+ * back of it like anything else, so they still see the GBA after every
+ * send before them, and either wait for their own slot or, for the
+ * L_StatusStart()/L_PollStart() ones, get checked on later.
+ *
+ * Each SI channel has a queue of its own, so GBAs on different ports don't
+ * wait on each other's transfers; SI goes between the channels by itself.
+ *
+ * Copyright (C) 2025 Techflash
+ *
+ * Derived from FIX94's gba-link-cable-rom-sender:
+ *   Copyright (C) 2018 FIX94
+ *   This software may be modified and distributed under the terms
+ *   of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <string.h>
+#include <malloc.h>
+#include <gccore.h>
+#include "console.h"
+#include "comms.h"
+#include "link.h"
+
+#define SI_TRANS_DELAY 50
+
+#define L_SI_DEPTH (2)  /* handed to SI at once, one going and one waiting on the delay */
+
+struct xfer {
+	u8 cmd[32];
+	u8 res[32];
+	u32 cmdLen, resLen;
+};
+
+/* every channel has a queue of its own, and SI takes turns between them */
+static struct {
+	struct xfer *xfers;
+	vu32 qHead;   /* next slot to fill; main loop */
+	vu32 qIssued; /* next slot to hand to SI; with IRQs off */
+	vu32 qDone;   /* next slot SI will finish; callback */
+	u32 qTail;    /* next finished slot to look at; main loop */
+
+	/* the one *Start() that's waiting on its *Done(), and its result once it's been reaped */
+	bool pend, pendReady;
+	u32 pendSlot;
+	u8 pendRes[5];
+} chans[L_CHANS];
+
+static void transcb(s32 chan, u32 ret);
+
+/* hand SI whatever it has room for; IRQs off */
+static void issue(s32 chan) {
+	struct xfer *x;
+
+	while (chans[chan].qIssued != chans[chan].qHead && chans[chan].qIssued - chans[chan].qDone < L_SI_DEPTH) {
+		x = &chans[chan].xfers[chans[chan].qIssued & (L_QUEUE - 1)];
+		if (!SI_Transfer(chan, x->cmd, x->cmdLen, x->res, x->resLen, transcb, SI_TRANS_DELAY))
+			break; /* still busy; we'll be back */
+		chans[chan].qIssued++;
+	}
+}
+
+static void kick(s32 chan) {
+	u32 level;
+
+	_CPU_ISR_Disable(level);
+	issue(chan);
+	_CPU_ISR_Restore(level);
+}
+
+static void transcb(s32 chan, u32 ret) {
+	chans[chan].qDone++;
+	issue(chan);
+}
+
+/* done looking at everything before slot `upto', which has to have finished */
+static void reap(s32 chan, u32 upto) {
+	while (chans[chan].qTail != upto) {
+		if (chans[chan].pend && chans[chan].qTail == chans[chan].pendSlot) {
+			memcpy(chans[chan].pendRes, chans[chan].xfers[chans[chan].qTail & (L_QUEUE - 1)].res, sizeof(chans[chan].pendRes));
+			chans[chan].pendReady = true;
+		}
+		chans[chan].qTail++;
+	}
+}
+
+static bool finished(s32 chan, u32 slot) {
+	return (s32)(chans[chan].qDone - slot) > 0;
+}
+
+/* queue a transfer and start it if SI's free, hand back its slot */
+static u32 queue(s32 chan, const u8 *cmd, u32 cmdLen, u32 resLen) {
+	struct xfer *x;
+	u32 level, slot;
+
+	while (chans[chan].qHead - chans[chan].qTail >= L_QUEUE) {
+		kick(chan);
+		reap(chan, chans[chan].qDone);
+	}
+
+	slot = chans[chan].qHead;
+	x = &chans[chan].xfers[slot & (L_QUEUE - 1)];
+	memcpy(x->cmd, cmd, cmdLen);
+	memset(x->res, 0, sizeof(x->res));
+	x->cmdLen = cmdLen;
+	x->resLen = resLen;
+
+	_CPU_ISR_Disable(level);
+	chans[chan].qHead = slot + 1;
+	issue(chan);
+	_CPU_ISR_Restore(level);
+	return slot;
+}
+
+/* wait for slot to finish, and hand back what came back; good until the next transfer is queued */
+static u8 *wait(s32 chan, u32 slot) {
+	u8 *res = chans[chan].xfers[slot & (L_QUEUE - 1)].res;
+
+	while (!finished(chan, slot))
+		kick(chan);
+
+	reap(chan, slot + 1);
+	return res;
+}
+
+void L_Init(s32 chan) {
+	if (chans[chan].xfers)
+		return;
+
+	chans[chan].xfers = memalign(32, sizeof(struct xfer) * L_QUEUE);
+}
+
+bool L_Probe(s32 chan) {
+	return (SI_GetType(chan) & SI_GBA) != 0;
+}
+
+u8 L_Reset(s32 chan) {
+	static const u8 cmd = 0xFF; /* reset */
+
+	return wait(chan, queue(chan, &cmd, 1, 3))[2];
+}
+
+u8 L_Status(s32 chan) {
+	static const u8 cmd = 0; /* status */
+
+	return wait(chan, queue(chan, &cmd, 1, 3))[2];
+}
+
+/* comes in LSB first */
+static inline u32 readWord(const u8 *res) {
+	return __builtin_bswap32(*(const u32 *)res);
+}
+
+u32 L_Recv(s32 chan) {
+	static const u8 cmd = 0x14; /* read */
+
+	return readWord(wait(chan, queue(chan, &cmd, 1, 5)));
+}
+
+bool L_Poll(s32 chan, u32 *msg) {
+	static const u8 cmd = 0x14; /* read */
+	u8 *res = wait(chan, queue(chan, &cmd, 1, 5));
+
+	*msg = readWord(res);
+	/* trailing status byte is JOYSTAT from before this read cleared the send flag */
+	return (res[4] & 0x8) != 0;
+}
+
+void L_Send(s32 chan, u32 msg) {
+	u8 cmd[5];
+
+	cmd[0] = 0x15;
+	cmd[1] = (msg >> 0) & 0xFF;
+	cmd[2] = (msg >> 8) & 0xFF;
+	cmd[3] = (msg >> 16) & 0xFF;
+	cmd[4] = (msg >> 24) & 0xFF;
+	queue(chan, cmd, 5, 1);
+}
+
+u32 L_Backlog(s32 chan) {
+	return chans[chan].qHead - chans[chan].qDone;
+}
+
+void L_Sync(s32 chan) {
+	if (chans[chan].qHead != chans[chan].qTail)
+		wait(chan, chans[chan].qHead - 1);
+}
+
+static void start(s32 chan, u8 cmd, u32 resLen) {
+	chans[chan].pendSlot = queue(chan, &cmd, 1, resLen);
+	chans[chan].pendReady = false;
+	chans[chan].pend = true;
+}
+
+/* is the *Start() back yet? */
+static bool done(s32 chan) {
+	if (!chans[chan].pendReady) {
+		if (!finished(chan, chans[chan].pendSlot)) {
+			kick(chan);
+			return false;
+		}
+		reap(chan, chans[chan].pendSlot + 1);
+	}
+
+	chans[chan].pend = false;
+	return true;
+}
+
+void L_StatusStart(s32 chan) {
+	start(chan, 0, 3);
+}
+
+bool L_StatusDone(s32 chan, u8 *stat) {
+	if (!done(chan))
+		return false;
+
+	*stat = chans[chan].pendRes[2];
+	return true;
+}
+
+void L_PollStart(s32 chan) {
+	start(chan, 0x14, 5);
+}
+
+bool L_PollDone(s32 chan, u32 *msg, bool *fresh) {
+	if (!done(chan))
+		return false;
+
+	*msg = readWord(chans[chan].pendRes);
+	*fresh = (chans[chan].pendRes[4] & 0x8) != 0;
+	return true;
+}
@@ -0,0 +1,54 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - JOY bus link
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _LINK_H
+#define _LINK_H
+
+#include <gccore.h>
+
+/* SI channels, a GBA can be on any of them */
+#define L_CHANS (4)
+
+/* transfers each channel can have queued, a power of two */
+#define L_QUEUE (16)
+
+extern void L_Init(s32 chan);
+
+/* is there a GBA on the other end? */
+extern bool L_Probe(s32 chan);
+
+/* JOY bus reset/status commands, return the GBA's status byte */
+extern u8   L_Reset(s32 chan);
+extern u8   L_Status(s32 chan);
+
+/* read what the GBA wrote to REG_JOYTR */
+extern u32  L_Recv(s32 chan);
+
+/* same, but also say whether the GBA wrote it since we last read it */
+extern bool L_Poll(s32 chan, u32 *msg);
+
+/* write msg to the GBA's REG_JOYRE; only waits if the transfer queue is full */
+extern void L_Send(s32 chan, u32 msg);
+
+/* how many transfers are queued up and not done yet */
+extern u32  L_Backlog(s32 chan);
+
+/* wait for everything queued to get to the GBA */
+extern void L_Sync(s32 chan);
+
+/*
+ * L_Status() and L_Poll() without the wait, for the main loop.  *Start()
+ * queues the transfer and returns; the matching *Done() says false until
+ * it's finished, then hands back the result.  One at a time per channel,
+ * and it sees the GBA after anything sent before the *Start(), but not
+ * after.
+ */
+extern void L_StatusStart(s32 chan);
+extern bool L_StatusDone(s32 chan, u8 *stat);
+extern void L_PollStart(s32 chan);
+extern bool L_PollDone(s32 chan, u32 *msg, bool *fresh);
+
+#endif /* _LINK_H */
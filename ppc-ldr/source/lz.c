@@ -0,0 +1,240 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - LZ77 replies
+ *
+ * Compresses MEM_READ replies into the format the GBA BIOS decodes with
+ * LZ77UnCompWram, so the GBA pays a few cycles a byte instead of link time.
+ * A type 0x10 header with the unpacked size, then groups of 8 items behind
+ * a flag byte, MSB first: a 0 bit is a literal byte, a 1 bit is a 2 byte
+ * back reference, (length - 3) << 12 | (distance - 1), big endian.
+ *
+ * Kernel pages get compressed once, right after the kernel is read in, and
+ * kept until the guest writes to them; anything else is done on the spot.
+ * The loader goes the same way for a two-stage boot, all in one piece.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gccore.h>
+#include "console.h"
+#include "mem.h"
+#include "comms.h"
+#include "lz.h"
+
+#define Z_WINDOW    (4096)
+#define Z_MIN_LEN   (3)
+#define Z_MAX_LEN   (18)
+#define Z_HASH_BITS (12)
+#define Z_MAX_CHAIN (32) /* how many earlier matches to try, plenty for 512B pages */
+
+/* biggest reply worth trying; the GBA can't take more than LZ_MAX_WORDS back anyway */
+#define Z_MAX_RAW_WORDS (4 * LZ_MAX_WORDS)
+
+/* cached replies are for requests of exactly one page, the GBA's default cache line */
+#define Z_PAGE_WORDS (128)
+#define Z_PAGE_BYTES (Z_PAGE_WORDS * sizeof(u32))
+
+struct _zStats Z_Stats;
+
+static struct {
+	enum { Z_NONE, Z_RAW, Z_PACKED } state;
+	u16 words;
+	u8 *data;
+} *pages;
+static u32 numPages;
+
+static s32 head[1 << Z_HASH_BITS];
+static s32 chain[Z_WINDOW];
+static u8 raw[Z_MAX_RAW_WORDS * sizeof(u32)];
+
+static inline u32 hash(const u8 *p) {
+	return (((p[0] << 16) | (p[1] << 8) | p[2]) * 2654435761u) >> (32 - Z_HASH_BITS);
+}
+
+u32 Z_Compress(const u8 *src, u32 len, u8 *dst, u32 max) {
+	u32 pos = 0, out = 4, flags = 0, bit = 8, best, dist, n, h, i;
+	s32 cand, tries;
+
+	if (len > 0xffffff || max < 8)
+		return 0;
+
+	dst[0] = 0x10;
+	dst[1] = len;
+	dst[2] = len >> 8;
+	dst[3] = len >> 16;
+	memset(head, 0xff, sizeof(head));
+
+	while (pos < len) {
+		/* room for a flag byte and a reference */
+		if (out + 3 > max)
+			return 0;
+
+		if (bit == 8) {
+			flags = out++;
+			dst[flags] = 0;
+			bit = 0;
+		}
+
+		/* longest match in the window; positions only go in once they're behind us */
+		best = dist = 0;
+		if (pos + Z_MIN_LEN <= len) {
+			cand = head[hash(&src[pos])];
+			for (tries = 0; cand >= 0 && pos - cand <= Z_WINDOW && tries < Z_MAX_CHAIN; tries++) {
+				n = 0;
+				while (n < Z_MAX_LEN && pos + n < len && src[cand + n] == src[pos + n])
+					n++;
+				if (n > best) {
+					best = n;
+					dist = pos - cand;
+					if (n == Z_MAX_LEN)
+						break;
+				}
+				cand = chain[cand & (Z_WINDOW - 1)];
+			}
+		}
+
+		if (best < Z_MIN_LEN) {
+			best = 1;
+			dst[out++] = src[pos];
+		}
+		else {
+			dst[flags] |= 0x80 >> bit;
+			dst[out++] = ((best - Z_MIN_LEN) << 4) | ((dist - 1) >> 8);
+			dst[out++] = (dist - 1) & 0xff;
+		}
+		bit++;
+
+		for (i = 0; i < best; i++, pos++) {
+			if (pos + Z_MIN_LEN > len)
+				continue;
+			h = hash(&src[pos]);
+			chain[pos & (Z_WINDOW - 1)] = head[h];
+			head[h] = pos;
+		}
+	}
+
+	/* the BIOS reads it in words */
+	while (out & 3) {
+		if (out >= max)
+			return 0;
+		dst[out++] = 0;
+	}
+	return out;
+}
+
+/* reply for words words at addr into out, 0 if it's not worth it */
+static u32 pack(u32 addr, u32 words, u8 *out) {
+	u32 max, n;
+	u16 crcVal;
+
+	if (words < 4 || words > Z_MAX_RAW_WORDS)
+		return 0;
+
+	M_Read(raw, addr, words * sizeof(u32));
+	crcVal = calc_crc16(raw, words * sizeof(u32));
+
+	/* has to beat sending it raw, CRC word and all */
+	max = (((words - 1 < LZ_MAX_WORDS) ? words - 1 : LZ_MAX_WORDS) - 1) * sizeof(u32);
+	n = Z_Compress(raw, words * sizeof(u32), out + sizeof(u32), max);
+	if (!n)
+		return 0;
+
+	*(u32 *)out = htonl(crcVal);
+	return (n / sizeof(u32)) + 1;
+}
+
+void Z_CachePages(u32 addr, u32 len) {
+	u8 buf[LZ_MAX_WORDS * sizeof(u32)];
+	u32 i, first, n, packed = 0, in = 0, out = 0;
+	u64 ticks = gettime();
+
+	first = addr / Z_PAGE_BYTES;
+	n = (addr + len + Z_PAGE_BYTES - 1) / Z_PAGE_BYTES;
+	if (n > numPages) {
+		pages = realloc(pages, n * sizeof(*pages));
+		if (!pages) {
+			puts("Out of memory for the compressed page cache, compressing on demand");
+			numPages = 0;
+			return;
+		}
+		memset(&pages[numPages], 0, (n - numPages) * sizeof(*pages));
+		numPages = n;
+	}
+
+	for (i = first; i < n; i++) {
+		free(pages[i].data);
+		pages[i].data = NULL;
+		pages[i].words = pack(i * Z_PAGE_BYTES, Z_PAGE_WORDS, buf);
+		pages[i].state = Z_RAW;
+		if (pages[i].words) {
+			pages[i].data = malloc(pages[i].words * sizeof(u32));
+			if (!pages[i].data) {
+				pages[i].state = Z_NONE;
+				continue;
+			}
+			memcpy(pages[i].data, buf, pages[i].words * sizeof(u32));
+			pages[i].state = Z_PACKED;
+			packed++;
+			in += Z_PAGE_BYTES;
+			out += pages[i].words * sizeof(u32);
+		}
+	}
+
+	printf("Compressed %u of %u kernel pages in %u ms, %u -> %u bytes\n",
+	       packed, n - first, diff_msec(ticks, gettime()), in, out);
+}
+
+void Z_Invalidate(u32 addr, u32 len) {
+	u32 i, last;
+
+	if (!len || addr / Z_PAGE_BYTES >= numPages)
+		return;
+
+	last = (addr + len - 1) / Z_PAGE_BYTES;
+	if (last >= numPages)
+		last = numPages - 1;
+
+	for (i = addr / Z_PAGE_BYTES; i <= last; i++) {
+		free(pages[i].data);
+		pages[i].data = NULL;
+		pages[i].state = Z_NONE;
+	}
+}
+
+u32 Z_Reply(u32 addr, u32 words, u8 *out) {
+	u32 n, page = addr / Z_PAGE_BYTES;
+
+	/* exactly one page we've seen before? */
+	if (words == Z_PAGE_WORDS && !(addr % Z_PAGE_BYTES) && page < numPages) {
+		switch (pages[page].state) {
+		case Z_RAW: {
+			Z_Stats.raw++;
+			Z_Stats.cached++;
+			return 0;
+		}
+		case Z_PACKED: {
+			memcpy(out, pages[page].data, pages[page].words * sizeof(u32));
+			Z_Stats.packed++;
+			Z_Stats.cached++;
+			Z_Stats.in += Z_PAGE_BYTES;
+			Z_Stats.out += pages[page].words * sizeof(u32);
+			return pages[page].words;
+		}
+		case Z_NONE:
+			break;
+		}
+	}
+
+	n = pack(addr, words, out);
+	if (!n) {
+		Z_Stats.raw++;
+		return 0;
+	}
+
+	Z_Stats.packed++;
+	Z_Stats.in += words * sizeof(u32);
+	Z_Stats.out += n * sizeof(u32);
+	return n;
+}
@@ -0,0 +1,37 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - LZ77 replies
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _LZ_H
+#define _LZ_H
+
+#include <gccore.h>
+
+struct _zStats {
+	u32 packed, raw, cached; /* replies sent compressed, not worth it, straight from the cache */
+	u64 in, out;             /* bytes, for the compressed ones */
+};
+extern struct _zStats Z_Stats;
+
+/*
+ * Compress len bytes at src into dst in the format the BIOS unpacks, header
+ * included.  Returns how many bytes that took, padded out to a whole word,
+ * or 0 if it didn't fit in max.
+ */
+extern u32 Z_Compress(const u8 *src, u32 len, u8 *dst, u32 max);
+
+/* compress every page in [addr, addr + len) ahead of time */
+extern void Z_CachePages(u32 addr, u32 len);
+
+/* guest memory in [addr, addr + len) changed */
+extern void Z_Invalidate(u32 addr, u32 len);
+
+/*
+ * Build the compressed reply for `words' words at addr in out, which needs
+ * room for LZ_MAX_WORDS.  Returns its length in words, or 0 to send it raw.
+ */
+extern u32 Z_Reply(u32 addr, u32 words, u8 *out);
+
+#endif /* _LZ_H */
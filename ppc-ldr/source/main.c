@@ -17,18 +17,48 @@
 #include "mem.h"
 #include "console.h"
 #include "comms.h"
+#include "vdisk.h"
+#ifdef CRC_BENCH
+#include "crcbench.h"
+#endif
+#ifndef HW_RVL
+#include "aram.h"
+#endif
 
 static void *xfb = NULL;
 static GXRModeObj *rmode = NULL;
 
+/*
+ * The controllers get looked at off a timer, not every time round the main
+ * loop, which belongs to the link; a button press doesn't need it any faster.
+ */
+#define PAD_SCAN_MS (50)
+static syswd_t padAlarm;
+static vu32 padsDue;
+
+static void padTick(syswd_t alarm, void *arg) {
+	padsDue = 1;
+}
+
 /* our buffer in MEM1 */
-u8 mem1_buf[MEM1_BUF_SZ];
+u8 mem1_buf[MEM1_BUF_SZ] __attribute__((aligned(32)));
 
 struct _memState M_State;
 
+static const char *portNames[C_MAX_GBAS] = { "Port 1", "Port 2", "Port 3", "Port 4" };
+
+#ifdef CRC_BENCH
+/* Broadway runs at 12x the timebase on both GCN and Wii */
+static u32 cycles(void) {
+	return gettime() * 12;
+}
+#endif
+
 int main(int argc, char **argv) {
-	int mem1_blkSz;
+	int mem1_blkSz, chan;
 	RVL_ONLY(int i; int mem2_blkSz);
+	DOL_ONLY(u32 aramSz);
+	struct timespec padPeriod = { 0, PAD_SCAN_MS * 1000000 };
 	union memRegion mem1_blk;
 	RVL_ONLY(union memRegion mem2_blk);
 
@@ -49,6 +79,10 @@ int main(int argc, char **argv) {
 	VIDEO_WaitVSync();
 	if(rmode->viTVMode&VI_NON_INTERLACE) VIDEO_WaitVSync();
 
+#ifdef CRC_BENCH
+	crc_bench(cycles);
+#endif
+
 	puts("Setting up memory...");
 
 
@@ -78,8 +112,6 @@ int main(int argc, char **argv) {
 		sleep(5);
 		exit(1);
 	}
-	M_State.blocks[1].ptr = mem2_blk;
-	M_State.blocks[1].size = mem2_blkSz;
 #endif
 
 	mem1_blkSz = MEM1_BUF_SZ;
@@ -90,20 +122,56 @@ int main(int argc, char **argv) {
 		sleep(5);
 		exit(1);
 	}
-	M_State.blocks[0].ptr = mem1_blk;
-	M_State.blocks[0].size = mem1_blkSz;
 
-	printf("Cleaing memory... ");
-	memset(mem1_blk.w8, 0, mem1_blkSz);
-	RVL_ONLY(memset(mem2_blk.w8, 0, mem2_blkSz));
-	puts("done");
+	/*
+	 * the slow tier's hot pages (ARAM, and the virtual disk) come off the
+	 * top of MEM2, or MEM1 if there isn't one
+	 */
+#ifdef HW_RVL
+	mem2_blkSz -= T_FRAMES_SZ;
+	T_Init(mem2_blk.w8 + mem2_blkSz, T_FRAMES_SZ);
+#else
+	mem1_blkSz -= T_FRAMES_SZ;
+	T_Init(mem1_blk.w8 + mem1_blkSz, T_FRAMES_SZ);
+
+	/* no MEM2, so ARAM goes on the end as a slow tier */
+	aramSz = A_Init();
+#endif
+
+	/*
+	 * MEM1 and MEM2 are the pool every GBA's pages come out of.  Each one
+	 * gets a window as big as all of it, since most of it is never written,
+	 * and the kernel's pages are only in it once between them.  None of it
+	 * needs clearing: a page reads as zeroes until it's first written, and
+	 * gets a frame, filled in, then.  If they write enough to run it dry,
+	 * the writes that don't fit get refused, the host keeps going.
+	 */
+	M_AddFrames(mem1_blk.w8, mem1_blkSz);
+	RVL_ONLY(M_AddFrames(mem2_blk.w8, mem2_blkSz));
+	for (chan = 0; chan < C_MAX_GBAS; chan++) {
+		M_AddGuest();
+		M_AddPoolRegion(portNames[chan], M_Stats.frames << M_PAGE_SHIFT, 0);
+
+		/* ARAM can't be shared out a page at a time, it goes to the port GBAs always went on */
+		DOL_ONLY(if (chan == GBA_CHAN) M_AddSlowRegion("ARAM", &A_Backend, aramSz, 0));
+	}
+
+	printf("Waiting for GBAs to connect on any port...\nHOME (WiiMote)/Start (GCN Controller on port 1) to exit,\n"
+	       "1 (WiiMote)/Y (GCN Controller on port 1) for link stats, 2/X to save the protocol trace,\n"
+	       "B/B before the GBA connects to turn error correction on for a noisy link.\n");
 
-	printf("Waiting for GBA connection on port %d...\nHOME (WiiMote)/Start (GCN Controller on port 1) to exit.\n", GBA_CHAN + 1);
+	SYS_CreateAlarm(&padAlarm);
+	SYS_SetPeriodicAlarm(padAlarm, &padPeriod, &padPeriod, padTick, NULL);
 
 	while(1) {
 		u32 pressedG;
 		RVL_ONLY(u32 pressedW);
 
+		C_Process();
+		if (!padsDue)
+			continue;
+		padsDue = 0;
+
 		PAD_ScanPads();
 #ifdef HW_RVL
 		WPAD_ScanPads();
@@ -111,12 +179,20 @@ int main(int argc, char **argv) {
 #endif
 		pressedG = PAD_ButtonsDown(0);
 		if (RVL_ONLY(pressedW & WPAD_BUTTON_HOME ||) pressedG & PAD_BUTTON_START) {
+			V_Close();
 			puts("Bye!");
 			sleep(5);
 			exit(0);
 		}
-
-		C_Process();
+		if (RVL_ONLY(pressedW & WPAD_BUTTON_1 ||) pressedG & PAD_BUTTON_Y)
+			C_DumpStats();
+		if (RVL_ONLY(pressedW & WPAD_BUTTON_2 ||) pressedG & PAD_BUTTON_X)
+			C_DumpTrace(C_TRACE_PATH);
+		if (RVL_ONLY(pressedW & WPAD_BUTTON_B ||) pressedG & PAD_BUTTON_B) {
+			/* only counts for the next time features get negotiated */
+			C_OfferedFeatures ^= FEAT_FEC;
+			printf("Error correction %s\n", (C_OfferedFeatures & FEAT_FEC) ? "on" : "off");
+		}
 	}
 
 	return 0;
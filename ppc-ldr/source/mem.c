@@ -3,14 +3,339 @@
  *
  * Copyright (C) 2025 Techflash
  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 #include <gccore.h>
+#include "comms.h"
 #include "mem.h"
-void *M_GuestToHost(u32 addr) {
-	if (addr < M_State.blocks[0].size)
-		return M_State.blocks[0].ptr.w8 + addr;
-	else if (M_State.blocks[1].size)
-		return M_State.blocks[1].ptr.w8 + (addr - M_State.blocks[0].size);
+
+/* what every page of a zero region points at, and pool pages until they're written */
+static u8 zeroPage[M_PAGE_SIZE] __attribute__((aligned(32)));
+
+struct _mStats M_Stats;
+
+/* the pool: chunks of main RAM handed out a frame at a time, and frames given back */
+static struct {
+	u8 *ptr;
+	u32 frames, next;
+} chunks[M_MAX_REGIONS];
+static u32 numChunks;
+static u8 *freeFrames; /* each one's first word points at the next */
+
+static void fail(const char *why) {
+	printf("FATAL: Can't set up guest memory: %s!\n", why);
+	sleep(5);
+	exit(1);
+}
+
+static void addRegion(const char *name, void *ptr, const struct _tierBackend *backend, u32 size, u32 flags) {
+	u32 i, first, n, r = M_State.numRegions;
+
+	size &= ~(M_PAGE_SIZE - 1);
+	if (!size)
+		return;
+	if (r == M_MAX_REGIONS)
+		fail("too many regions");
+	if (M_State.size + size < M_State.size)
+		fail("too big");
+	if (!(flags & M_REGION_DISK) && M_State.ramSize != M_State.size)
+		fail("guest memory has to come before the disk");
+
+	first = M_State.size >> M_PAGE_SHIFT;
+	n = size >> M_PAGE_SHIFT;
+	M_State.pages = realloc(M_State.pages, (first + n) * sizeof(u8 *));
+	M_State.regionOf = realloc(M_State.regionOf, first + n);
+	M_State.own = realloc(M_State.own, ((first + n + 31) / 32) * sizeof(u32));
+	if (!M_State.pages || !M_State.regionOf || !M_State.own)
+		fail("out of memory for the page table");
+
+	for (i = 0; i < n; i++) {
+		if (backend)
+			M_State.pages[first + i] = NULL;
+		else
+			M_State.pages[first + i] = ptr ? (u8 *)ptr + (i << M_PAGE_SHIFT) : zeroPage;
+		M_State.regionOf[first + i] = r;
+		M_State.own[(first + i) / 32] &= ~(1 << ((first + i) % 32));
+	}
+
+	M_State.regions[r].name = name;
+	M_State.regions[r].ptr.w8 = ptr;
+	M_State.regions[r].backend = backend;
+	M_State.regions[r].base = M_State.size;
+	M_State.regions[r].size = size;
+	M_State.regions[r].flags = (ptr || backend || (flags & M_REGION_POOL)) ? flags : flags | M_REGION_RO;
+	M_State.numRegions++;
+	M_State.size += size;
+	if (!(flags & M_REGION_DISK)) {
+		M_State.ramSize += size;
+		if (M_State.numGuests)
+			M_State.guests[M_State.numGuests - 1].size += size;
+	}
+
+	printf("Guest memory 0x%08x-0x%08x: %s\n", M_State.regions[r].base,
+	       M_State.regions[r].base + size - 1, name);
+}
+
+void M_AddRegion(const char *name, void *ptr, u32 size, u32 flags) {
+	addRegion(name, ptr, NULL, size, flags);
+}
+
+void M_AddSlowRegion(const char *name, const struct _tierBackend *backend, u32 size, u32 flags) {
+	addRegion(name, NULL, backend, size, flags);
+}
+
+void M_AddPoolRegion(const char *name, u32 size, u32 flags) {
+	addRegion(name, NULL, NULL, size, flags | M_REGION_POOL);
+}
+
+void M_AddGuest(void) {
+	if (M_State.numGuests == M_MAX_GUESTS)
+		fail("too many GBAs");
+	if (M_State.ramSize != M_State.size)
+		fail("guest memory has to come before the disk");
+
+	M_State.guests[M_State.numGuests].base = M_State.size;
+	M_State.guests[M_State.numGuests].size = 0;
+	M_State.numGuests++;
+}
+
+void M_AddFrames(void *ptr, u32 size) {
+	u32 skip = -(uintptr_t)ptr & (M_PAGE_SIZE - 1);
+
+	if (size <= skip || (size - skip) < M_PAGE_SIZE)
+		return;
+	if (numChunks == M_MAX_REGIONS)
+		fail("too many pieces of pool");
+
+	chunks[numChunks].ptr = (u8 *)ptr + skip;
+	chunks[numChunks].frames = (size - skip) >> M_PAGE_SHIFT;
+	chunks[numChunks].next = 0;
+	M_Stats.frames += chunks[numChunks].frames;
+	numChunks++;
+}
+
+void *M_AllocFrame(void) {
+	u32 i;
+	u8 *f;
+
+	if (freeFrames) {
+		f = freeFrames;
+		freeFrames = *(u8 **)f;
+		M_Stats.used++;
+		return f;
+	}
+
+	for (i = 0; i < numChunks; i++) {
+		if (chunks[i].next < chunks[i].frames) {
+			M_Stats.used++;
+			return chunks[i].ptr + (chunks[i].next++ << M_PAGE_SHIFT);
+		}
+	}
+
+	fail("out of page frames for guest memory");
+	return NULL;
+}
+
+static void freeFrame(u8 *f) {
+	*(u8 **)f = freeFrames;
+	freeFrames = f;
+	M_Stats.used--;
+}
+
+static inline bool owns(u32 page) {
+	return (M_State.own[page / 32] & (1 << (page % 32))) != 0;
+}
+
+bool M_Share(u32 addr, void *frame) {
+	u32 page = addr >> M_PAGE_SHIFT;
+
+	if (!M_InPool(addr))
+		return false;
+
+	if (owns(page))
+		freeFrame(M_State.pages[page]);
+	else if (M_State.pages[page] != zeroPage)
+		M_Stats.shared--;
+
+	M_State.pages[page] = frame;
+	M_State.own[page / 32] &= ~(1 << (page % 32));
+	M_Stats.shared++;
+	return true;
+}
+
+bool M_Owned(u32 addr) {
+	return M_InPool(addr) && owns(addr >> M_PAGE_SHIFT);
+}
+
+u32 M_Needed(u32 addr, u32 len) {
+	u32 page, n = 0;
+
+	if (!len)
+		return 0;
+
+	for (page = addr >> M_PAGE_SHIFT; page <= (addr + len - 1) >> M_PAGE_SHIFT; page++) {
+		if ((M_State.regions[M_State.regionOf[page]].flags & M_REGION_POOL) && !owns(page))
+			n++;
+	}
+	return n;
+}
+
+bool M_Reserve(s32 frames) {
+	if (frames > 0 && (u32)frames > M_Spare())
+		return false;
+
+	M_Stats.reserved += frames;
+	return true;
+}
+
+/* the pool page's zero again, it can go back to sharing the zero page */
+static void release(u32 page) {
+	if (owns(page))
+		freeFrame(M_State.pages[page]);
+	else if (M_State.pages[page] != zeroPage)
+		M_Stats.shared--;
+
+	M_State.pages[page] = zeroPage;
+	M_State.own[page / 32] &= ~(1 << (page % 32));
+}
+
+/* a pool page is about to be written, give it a frame of its own with what it had in it */
+static void claim(u32 page) {
+	u8 *f;
+
+	if (owns(page))
+		return;
+
+	f = M_AllocFrame();
+	memcpy(f, M_State.pages[page], M_PAGE_SIZE);
+	if (M_State.pages[page] != zeroPage)
+		M_Stats.shared--;
+
+	M_State.pages[page] = f;
+	M_State.own[page / 32] |= 1 << (page % 32);
+}
+
+bool M_Untouched(u32 addr, u32 len) {
+	u32 page;
+
+	if (!len)
+		return true;
+
+	/* pool pages and zero regions point at the zero page until they're written, slow ones the tier keeps track of */
+	for (page = addr >> M_PAGE_SHIFT; page <= (addr + len - 1) >> M_PAGE_SHIFT; page++) {
+		if (M_State.regions[M_State.regionOf[page]].backend) {
+			if (!T_Untouched(page))
+				return false;
+		}
+		else if (M_State.pages[page] != zeroPage)
+			return false;
+	}
+	return true;
+}
+
+bool M_Writable(u32 addr, u32 len) {
+	u32 page;
+
+	if (!M_Valid(addr, len))
+		return false;
+	if (!len)
+		return true;
+
+	/* ranges are never more than a few regions long, go by region */
+	for (page = addr >> M_PAGE_SHIFT; page <= (addr + len - 1) >> M_PAGE_SHIFT;
+	     page = (M_State.regions[M_State.regionOf[page]].base + M_State.regions[M_State.regionOf[page]].size) >> M_PAGE_SHIFT) {
+		if (M_State.regions[M_State.regionOf[page]].flags & M_REGION_RO)
+			return false;
+	}
+	return true;
+}
+
+static void *runOf(u32 addr, u32 len, u32 *run, bool write) {
+	u32 page = addr >> M_PAGE_SHIFT, r = M_State.regionOf[page], n;
+
+	/* a zero region is the same page over and over, and slow tier and pool pages are wherever they landed */
+	if (M_State.regions[r].ptr.w8)
+		n = M_State.regions[r].base + M_State.regions[r].size - addr;
 	else
-		return NULL;
-	/* TODO: virtual ramdisk? */
+		n = M_PAGE_SIZE - (addr & (M_PAGE_SIZE - 1));
+	*run = (len < n) ? len : n;
+
+	if (M_State.regions[r].backend)
+		return T_Page(page, write) + (addr & (M_PAGE_SIZE - 1));
+	if (write && (M_State.regions[r].flags & M_REGION_POOL))
+		claim(page);
+	return M_State.pages[page] + (addr & (M_PAGE_SIZE - 1));
+}
+
+void *M_Run(u32 addr, u32 len, u32 *run) {
+	return runOf(addr, len, run, false);
+}
+
+void *M_RunW(u32 addr, u32 len, u32 *run) {
+	return runOf(addr, len, run, true);
+}
+
+void M_Read(void *dst, u32 addr, u32 len) {
+	u32 n;
+	u8 *p;
+
+	for (; len; addr += n, len -= n, dst = (u8 *)dst + n) {
+		p = M_Run(addr, len, &n);
+		memcpy(dst, p, n);
+	}
+}
+
+/* zero regions stay zero */
+void M_Write(u32 addr, const void *src, u32 len) {
+	u32 n;
+	u8 *p;
+
+	for (; len; addr += n, len -= n, src = (const u8 *)src + n) {
+		p = M_RunW(addr, len, &n);
+		if (p < zeroPage || p >= zeroPage + M_PAGE_SIZE)
+			memcpy(p, src, n);
+	}
+}
+
+void M_Zero(u32 addr, u32 len) {
+	u32 n, page;
+	u8 *p;
+
+	for (; len; addr += n, len -= n) {
+		/* a pool page nobody's written yet is already zero, and a whole one can go back to being that */
+		page = addr >> M_PAGE_SHIFT;
+		if (M_State.regions[M_State.regionOf[page]].flags & M_REGION_POOL) {
+			n = M_PAGE_SIZE - (addr & (M_PAGE_SIZE - 1));
+			n = (len < n) ? len : n;
+			if (n == M_PAGE_SIZE)
+				release(page);
+			if (M_State.pages[page] == zeroPage)
+				continue;
+		}
+		/* same for a slow one, which would otherwise have to come in, and go back out changed */
+		else if (M_State.regions[M_State.regionOf[page]].backend && T_Untouched(page)) {
+			n = M_PAGE_SIZE - (addr & (M_PAGE_SIZE - 1));
+			n = (len < n) ? len : n;
+			continue;
+		}
+
+		p = M_RunW(addr, len, &n);
+		if (p < zeroPage || p >= zeroPage + M_PAGE_SIZE)
+			memset(p, 0, n);
+	}
+}
+
+u16 M_Crc16(u16 crc, u32 addr, u32 len) {
+	u32 n, i;
+	const u32 *p;
+
+	for (; len; addr += n, len -= n) {
+		p = M_Run(addr, len, &n);
+		for (i = 0; i < n / sizeof(u32); i++)
+			crc = crc16_update(crc, ntohl(p[i]));
+	}
+	return crc;
 }
@@ -6,6 +6,8 @@
 #ifndef _MEM_H
 #define _MEM_H
 
+#include "tier.h"
+
 /* same pointer as different sizes */
 union memRegion {
 	u32 *w32;
@@ -13,15 +15,160 @@ union memRegion {
 	u8  *w8;
 };
 
+/*
+ * Guest physical memory is a list of regions, one after the other from
+ * address 0 up, each a whole number of pages.  Every page has its host
+ * address in pages[], so finding any byte is one lookup no matter how
+ * many regions there are.  Pages in a slow region have NULL there instead,
+ * and go through the slow tier.  The virtual disk goes on the very end the
+ * same way, but it isn't guest memory as far as the GBA is concerned; it
+ * only gets at it through BLK_READ and BLK_WRITE.
+ */
+#define M_PAGE_SHIFT  (12)
+#define M_PAGE_SIZE   (1 << M_PAGE_SHIFT)
+#define M_MAX_REGIONS (8)
+
+/* region flags */
+#define M_REGION_RO   (1 << 0) /* the GBA can't write to it */
+#define M_REGION_DISK (1 << 1) /* the virtual disk, not guest memory */
+#define M_REGION_POOL (1 << 2) /* no memory of its own, see M_AddPoolRegion() */
+
+/*
+ * Every GBA gets its own window of all this as its guest memory, starting
+ * at 0 as far as it knows.  Windows are made of pool regions, which take a
+ * page frame from the pool the first time each page gets written, and
+ * until then read as zeroes, or as whatever frame M_Share() pointed them
+ * at, so the kernel's pages only need to be in main RAM once however many
+ * GBAs are running it.
+ */
+#define M_MAX_GUESTS  (4)
+
 struct _memState {
 	struct {
-		union memRegion ptr;
-		int size;
-	} blocks[2];
+		const char *name;
+		union memRegion ptr; /* NULL for a zero region, which all shares one page */
+		const struct _tierBackend *backend; /* or a slow one, which lives here */
+		u32 base, size, flags;
+	} regions[M_MAX_REGIONS];
+	u32 numRegions;
+
+	u32 size;     /* all of guest memory, and the disk */
+	u32 ramSize;  /* just guest memory */
+	u8 **pages;   /* host address of each guest page */
+	u8 *regionOf; /* and which region it's in */
+	u32 *own;     /* a bit per page, set once a pool page has a frame of its own */
+
+	struct {
+		u32 base, size;
+	} guests[M_MAX_GUESTS];
+	u32 numGuests;
 };
 
 extern struct _memState M_State;
-extern void *M_GuestToHost(u32 addr);
+
+struct _mStats {
+	u32 frames, used; /* in the pool */
+	u32 shared;       /* pool pages pointed at a frame by M_Share() and not written since */
+	u32 reserved;     /* set aside with M_Reserve() */
+};
+extern struct _mStats M_Stats;
+
+/* frames the pool can still hand out, less what's been set aside */
+static inline u32 M_Spare(void) {
+	return (M_Stats.used + M_Stats.reserved < M_Stats.frames) ? M_Stats.frames - M_Stats.used - M_Stats.reserved : 0;
+}
+
+/*
+ * Set aside frames for writes that are on their way, so nothing else can
+ * have them, or give them back with a negative count just before they
+ * land.  False, with nothing set aside, if there aren't that many spare.
+ */
+extern bool M_Reserve(s32 frames);
+
+/* add size bytes at ptr (or zeroes, if it's NULL) to the end of guest memory */
+extern void M_AddRegion(const char *name, void *ptr, u32 size, u32 flags);
+
+/* same, but kept in backend, T_Init() has to have given it somewhere to go first */
+extern void M_AddSlowRegion(const char *name, const struct _tierBackend *backend, u32 size, u32 flags);
+
+/* same, but out of the pool a page at a time; only costs anything once it's written */
+extern void M_AddPoolRegion(const char *name, u32 size, u32 flags);
+
+/* regions added from here on are the next GBA's guest memory */
+extern void M_AddGuest(void);
+
+/* carve size bytes at ptr up into page frames for the pool */
+extern void M_AddFrames(void *ptr, u32 size);
+
+/* a frame out of the pool to fill in and hand to M_Share(), for good */
+extern void *M_AllocFrame(void);
+
+/*
+ * Point the pool page at addr at frame until it's next written, when it
+ * gets a copy of its own; false if it isn't in a pool region.
+ */
+extern bool M_Share(u32 addr, void *frame);
+
+/* has the pool page at addr got a frame of its own, that nothing else shares? */
+extern bool M_Owned(u32 addr);
+
+/* how many frames writing to all of [addr, addr + len) would take out of the pool */
+extern u32 M_Needed(u32 addr, u32 len);
+
+/*
+ * Has nothing ever been written to any page of [addr, addr + len), so that
+ * it's all still zeroes without having to look?  Only ask for valid ranges.
+ */
+extern bool M_Untouched(u32 addr, u32 len);
+
+/* is all of [addr, addr + len) backed by guest memory? */
+static inline bool M_Valid(u32 addr, u32 len) {
+	return addr < M_State.ramSize && len <= M_State.ramSize - addr;
+}
+
+/*
+ * Only good up to the end of the page, M_Run() says how far past that it
+ * goes.  Slow tier pages are only good until the next lookup, and changes
+ * to them, or to pool pages, get lost unless they go through M_RunW(),
+ * M_Write() or M_Zero().
+ */
+static inline void *M_GuestToHost(u32 addr) {
+	u8 *p;
+
+	if (addr >= M_State.size)
+		return NULL;
+
+	p = M_State.pages[addr >> M_PAGE_SHIFT];
+	if (__builtin_expect(!p, 0))
+		p = T_Page(addr >> M_PAGE_SHIFT, false);
+	return p + (addr & (M_PAGE_SIZE - 1));
+}
+
+/* is addr in a pool region? */
+static inline bool M_InPool(u32 addr) {
+	return addr < M_State.size && (M_State.regions[M_State.regionOf[addr >> M_PAGE_SHIFT]].flags & M_REGION_POOL);
+}
+
+/* as M_Valid(), and the GBA can write to all of it too */
+extern bool M_Writable(u32 addr, u32 len);
+
+/*
+ * Scatter/gather: host address of addr, and in *run how much of
+ * [addr, addr + len) carries on contiguously from there.  Only ask for
+ * valid ranges.
+ */
+extern void *M_Run(u32 addr, u32 len, u32 *run);
+
+/* M_Run(), to write to */
+extern void *M_RunW(u32 addr, u32 len, u32 *run);
+
+/* bulk access, split up wherever the host side isn't contiguous */
+extern void M_Read(void *dst, u32 addr, u32 len);
+extern void M_Write(u32 addr, const void *src, u32 len);
+extern void M_Zero(u32 addr, u32 len);
+
+/* CRC16 of [addr, addr + len) as big endian words, the same as the link sends them; both word aligned */
+extern u16 M_Crc16(u16 crc, u32 addr, u32 len);
 
 /* this seems to be as high as we can go before stuff starts to break :( */
 #define MEM1_BUF_SZ (21 * 1024 * 1024)
@@ -0,0 +1,239 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - Demand paged kernel
+ *
+ * Rather than reading the whole kernel in before the GBA can ask for any of
+ * it, keep the file open and load it into guest memory a page at a time as
+ * it's needed.  A fault loads the whole aligned D_FAULT_BYTES around what
+ * was asked for, since the SD card is far better at a few big reads than a
+ * lot of small ones, and the idle link loads the rest in order, a page at a
+ * time, until it's all in.
+ *
+ * Every GBA maps the same file into its own guest memory.  Whole pages of
+ * it that land in the pool only get read the once, into a frame of their
+ * own, and every GBA after the first just points its page at that (see
+ * M_Share()); so the file stays open in case another one turns up.
+ *
+ * Guest memory outside the mapped parts of the file is already zero, and
+ * stays "present" the whole time.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gccore.h>
+#include "console.h"
+#include "mem.h"
+#include "pager.h"
+
+#define D_PAGE_SHIFT  (12)
+#define D_PAGE_BYTES  (1 << D_PAGE_SHIFT)
+#define D_FAULT_BYTES (64 * 1024)
+#define D_MAX_EXTENTS (8 * M_MAX_GUESTS)
+
+struct _dStats D_Stats;
+
+static FILE *file;
+static struct {
+	u32 addr, offset, len;
+} extents[D_MAX_EXTENTS];
+static u32 numExtents;
+
+/* a frame for each whole page of the file, once some GBA's needed it */
+static u8 **shared;
+static u32 filePages;
+
+/* one bit per guest page, set once it's not waiting on the file */
+static u32 *present;
+static u32 numPages, missing, nextIdle;
+
+static inline bool isPresent(u32 page) {
+	return present[page / 32] & (1 << (page % 32));
+}
+
+static void fail(const char *why) {
+	printf("Can't page in the kernel: %s!\n", why);
+	sleep(5);
+	exit(1);
+}
+
+static void readGuest(u32 offset, u32 addr, u32 len) {
+	u32 n, at = ~0;
+	u8 *p;
+
+	for (; len; addr += n, offset += n, len -= n) {
+		if (!(addr & (D_PAGE_BYTES - 1)) && !(offset & (D_PAGE_BYTES - 1)) &&
+		    len >= D_PAGE_BYTES && M_InPool(addr)) {
+			n = D_PAGE_BYTES;
+			p = shared[offset >> D_PAGE_SHIFT];
+			if (p) {
+				M_Share(addr, p);
+				continue;
+			}
+
+			p = shared[offset >> D_PAGE_SHIFT] = M_AllocFrame();
+			M_Share(addr, p);
+		}
+		else
+			p = M_RunW(addr, len, &n);
+
+		if (at != offset && fseek(file, offset, SEEK_SET))
+			fail("seek failed");
+		if (fread(p, n, 1, file) != 1)
+			fail("read failed");
+		at = offset + n;
+	}
+}
+
+/* pages [first, first + n), none of them present yet */
+static void loadRun(u32 first, u32 n) {
+	u32 start = first << D_PAGE_SHIFT, end = (first + n) << D_PAGE_SHIFT, lo, hi, i;
+
+	for (i = 0; i < numExtents; i++) {
+		lo = (extents[i].addr > start) ? extents[i].addr : start;
+		hi = (extents[i].addr + extents[i].len < end) ? extents[i].addr + extents[i].len : end;
+		if (lo < hi)
+			readGuest(extents[i].offset + (lo - extents[i].addr), lo, hi - lo);
+	}
+
+	for (i = first; i < first + n; i++)
+		present[i / 32] |= 1 << (i % 32);
+	missing -= n;
+}
+
+/* load every missing page in [first, last], in as few reads as there are gaps */
+static u32 loadPages(u32 first, u32 last) {
+	u32 page, run, loaded = 0;
+	u64 ticks = gettime();
+
+	for (page = first; page <= last; page += run) {
+		for (run = 0; page + run <= last && !isPresent(page + run); run++);
+		if (run) {
+			loadRun(page, run);
+			loaded += run;
+		}
+		else
+			run = 1;
+	}
+
+	D_Stats.ticks += gettime() - ticks;
+	return loaded;
+}
+
+static void finish(void) {
+	printf("Kernel all paged in: %u faults, %u pages on fault, %u while idle, %u ms reading\n",
+	       D_Stats.faults, D_Stats.faultPages, D_Stats.idlePages, diff_msec(0, D_Stats.ticks));
+}
+
+void D_Open(FILE *fp) {
+	if (file)
+		fclose(file);
+
+	file = fp;
+	numExtents = 0;
+	missing = nextIdle = 0;
+	numPages = M_State.size >> D_PAGE_SHIFT;
+
+	if (fseek(fp, 0, SEEK_END))
+		fail("can't find the end of the file");
+	filePages = (ftell(fp) + D_PAGE_BYTES - 1) >> D_PAGE_SHIFT;
+	free(shared);
+	shared = calloc(filePages ? filePages : 1, sizeof(u8 *));
+	if (!shared)
+		fail("out of memory");
+
+	free(present);
+	present = malloc(((numPages + 31) / 32) * sizeof(u32));
+	if (!present)
+		fail("out of memory");
+	memset(present, 0xff, ((numPages + 31) / 32) * sizeof(u32));
+}
+
+/* [addr, addr + len) is waiting on the file */
+static void unload(u32 addr, u32 len) {
+	u32 page;
+
+	if (nextIdle > addr >> D_PAGE_SHIFT)
+		nextIdle = addr >> D_PAGE_SHIFT;
+	for (page = addr >> D_PAGE_SHIFT; page <= (addr + len - 1) >> D_PAGE_SHIFT; page++) {
+		if (isPresent(page)) {
+			present[page / 32] &= ~(1 << (page % 32));
+			missing++;
+		}
+	}
+}
+
+void D_Map(u32 addr, u32 offset, u32 len) {
+
+	if (!len)
+		return;
+	if (numExtents == D_MAX_EXTENTS)
+		fail("too many pieces");
+	if (!M_Valid(addr, len))
+		fail("outside guest memory");
+
+	extents[numExtents].addr = addr;
+	extents[numExtents].offset = offset;
+	extents[numExtents].len = len;
+	numExtents++;
+	unload(addr, len);
+}
+
+void D_Reset(u32 addr, u32 len) {
+	u32 i, lo, hi;
+
+	for (i = 0; i < numExtents; i++) {
+		lo = (extents[i].addr > addr) ? extents[i].addr : addr;
+		hi = (extents[i].addr + extents[i].len < addr + len) ? extents[i].addr + extents[i].len : addr + len;
+		if (lo < hi)
+			unload(lo, hi - lo);
+	}
+}
+
+void D_Fault(u32 addr, u32 len) {
+	u32 first, last, n;
+
+	if (!missing || !len)
+		return;
+
+	first = (addr & ~(D_FAULT_BYTES - 1)) >> D_PAGE_SHIFT;
+	last = ((addr + len - 1) | (D_FAULT_BYTES - 1)) >> D_PAGE_SHIFT;
+	if (last >= numPages)
+		last = numPages - 1;
+
+	n = loadPages(first, last);
+	if (!n)
+		return;
+
+	D_Stats.faults++;
+	D_Stats.faultPages += n;
+	if (!missing)
+		finish();
+}
+
+void D_Idle(void) {
+	if (!missing)
+		return;
+
+	while (nextIdle < numPages && isPresent(nextIdle))
+		nextIdle++;
+
+	if (nextIdle < numPages)
+		D_Stats.idlePages += loadPages(nextIdle, nextIdle);
+	if (!missing)
+		finish();
+}
+
+u32 D_Missing(void) {
+	return missing;
+}
+
+void D_Finish(void) {
+	if (!missing)
+		return;
+
+	loadPages(0, numPages - 1);
+	finish();
+}
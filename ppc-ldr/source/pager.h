@@ -0,0 +1,41 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - Demand paged kernel
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _PAGER_H
+#define _PAGER_H
+
+#include <stdio.h>
+#include <gccore.h>
+
+struct _dStats {
+	u32 faults;             /* requests that had to wait on the SD card */
+	u32 faultPages, idlePages;
+	u64 ticks;              /* spent reading, all told */
+};
+extern struct _dStats D_Stats;
+
+/* start paging from fp, which is ours from now on */
+extern void D_Open(FILE *fp);
+
+/* len bytes at guest address addr come from offset in the file; as many times over as there are GBAs */
+extern void D_Map(u32 addr, u32 offset, u32 len);
+
+/* [addr, addr + len) got thrown away, the parts of it that are mapped have to come off the file again */
+extern void D_Reset(u32 addr, u32 len);
+
+/* make sure [addr, addr + len) has been loaded before using it */
+extern void D_Fault(u32 addr, u32 len);
+
+/* load a little more while the link has nothing better to do */
+extern void D_Idle(void);
+
+/* how many pages are still waiting on the file */
+extern u32 D_Missing(void);
+
+/* load whatever's left now */
+extern void D_Finish(void);
+
+#endif /* _PAGER_H */
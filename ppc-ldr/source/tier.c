@@ -0,0 +1,221 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - Slow tier of guest memory
+ *
+ * Guest memory in a slow region lives in some backend we can't point at
+ * directly (ARAM, or a file in the simulator), and gets brought into a
+ * pool of page frames in main RAM whenever it's touched.  Each frame keeps
+ * a count of how often its page has been touched, and when we need a free
+ * one, the clock hand goes around halving those counts until it finds one
+ * that's gone cold; that one gets written back if it has to be, and
+ * replaced.  So pages the GBA keeps coming back to stay in main RAM, and
+ * the rest only cost backend space.
+ *
+ * Pages of a blank backend that have never been written back start out as
+ * zeroes, so it doesn't have to be cleared first.  Anything else (the
+ * virtual disk) gets read in the first time, and changed pages get written
+ * back while the link is idle, not just when they're pushed out.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gccore.h>
+#include "mem.h"
+#include "tier.h"
+
+#define NO_FRAME (0xffffffff) /* in the backend */
+#define NEVER    (0xfffffffe) /* never been written back, all zeroes */
+#define HEAT_MAX (255)
+
+struct _tStats T_Stats;
+
+static u8 *frames;
+static u32 numFrames, nextFree, hand;
+static u32 *owner; /* guest page in each frame */
+static u8 *heat;
+static bool *dirty, *backed; /* backed: the backend has a copy of it */
+static u32 numDirty, cleanHand;
+
+/* frame for each guest page, or NO_FRAME/NEVER */
+static u32 *frameOf;
+static u32 frameOfPages;
+
+/* the page we handed out last, word at a time loops keep asking for it */
+static u32 lastPage = NO_FRAME, lastFrame;
+
+static void fail(const char *why) {
+	printf("FATAL: Slow tier of guest memory: %s!\n", why);
+	sleep(5);
+	exit(1);
+}
+
+void T_Init(void *ptr, u32 bytes) {
+	frames = ptr;
+	numFrames = bytes >> M_PAGE_SHIFT;
+	nextFree = hand = 0;
+
+	owner = malloc(numFrames * sizeof(u32));
+	heat = calloc(numFrames, sizeof(u8));
+	dirty = calloc(numFrames, sizeof(bool));
+	backed = calloc(numFrames, sizeof(bool));
+	if (!owner || !heat || !dirty || !backed)
+		fail("out of memory");
+
+	printf("Slow tier gets %u pages of main RAM\n", numFrames);
+}
+
+static inline const struct _tierBackend *backendOf(u32 page, u32 *offset) {
+	u32 r = M_State.regionOf[page];
+
+	*offset = (page << M_PAGE_SHIFT) - M_State.regions[r].base;
+	return M_State.regions[r].backend;
+}
+
+static void markDirty(u32 f) {
+	if (!dirty[f]) {
+		dirty[f] = true;
+		numDirty++;
+	}
+}
+
+static void writeBack(u32 f) {
+	const struct _tierBackend *be;
+	u32 offset;
+
+	be = backendOf(owner[f], &offset);
+	if (!be->write(offset, frames + (f << M_PAGE_SHIFT), M_PAGE_SIZE))
+		fail("can't write a page back");
+	dirty[f] = false;
+	backed[f] = true;
+	numDirty--;
+	T_Stats.writeBacks++;
+}
+
+/* a frame to put a new page in, demoting whatever was in it */
+static u32 evict(void) {
+	u32 f;
+
+	if (nextFree < numFrames)
+		return nextFree++;
+
+	while (1) {
+		f = hand;
+		hand = (hand + 1) % numFrames;
+		if (!heat[f])
+			break;
+		heat[f] >>= 1;
+	}
+
+	if (dirty[f])
+		writeBack(f);
+	frameOf[owner[f]] = backed[f] ? NO_FRAME : NEVER;
+	T_Stats.demotions++;
+	return f;
+}
+
+u8 *T_Page(u32 page, bool write) {
+	const struct _tierBackend *be;
+	u32 f, offset, n;
+	bool fresh;
+
+	if (page == lastPage) {
+		if (write)
+			markDirty(lastFrame);
+		return frames + (lastFrame << M_PAGE_SHIFT);
+	}
+
+	if (numFrames < 2)
+		fail("no main RAM to put it in");
+
+	/* regions only ever get added at the end, grow along with them */
+	if (page >= frameOfPages) {
+		n = M_State.size >> M_PAGE_SHIFT;
+		frameOf = realloc(frameOf, n * sizeof(u32));
+		if (!frameOf)
+			fail("out of memory");
+		for (; frameOfPages < n; frameOfPages++) {
+			be = M_State.regions[M_State.regionOf[frameOfPages]].backend;
+			frameOf[frameOfPages] = (be && !be->blank) ? NO_FRAME : NEVER;
+		}
+	}
+
+	f = frameOf[page];
+	if (f < NEVER) {
+		if (heat[f] < HEAT_MAX)
+			heat[f]++;
+		T_Stats.hits++;
+	}
+	else {
+		fresh = f == NEVER;
+		f = evict();
+		if (fresh)
+			memset(frames + (f << M_PAGE_SHIFT), 0, M_PAGE_SIZE);
+		else {
+			be = backendOf(page, &offset);
+			if (!be->read(offset, frames + (f << M_PAGE_SHIFT), M_PAGE_SIZE))
+				fail("can't read a page in");
+		}
+
+		frameOf[page] = f;
+		owner[f] = page;
+		backed[f] = !fresh;
+		heat[f] = 1;
+		dirty[f] = false;
+		T_Stats.promotions++;
+	}
+
+	lastPage = page;
+	lastFrame = f;
+	if (write)
+		markDirty(f);
+	return frames + (f << M_PAGE_SHIFT);
+}
+
+bool T_Untouched(u32 page) {
+	const struct _tierBackend *be;
+	u32 f;
+
+	if (page >= frameOfPages) {
+		be = M_State.regions[M_State.regionOf[page]].backend;
+		return be && be->blank;
+	}
+
+	/* in main RAM, it's still zero as long as it's never been changed or written back */
+	f = frameOf[page];
+	if (f == NEVER)
+		return true;
+	if (f == NO_FRAME)
+		return false;
+	return !backed[f] && !dirty[f];
+}
+
+u32 T_Resident(void) {
+	return nextFree;
+}
+
+bool T_Clean(void) {
+	u32 i;
+
+	if (!numDirty)
+		return false;
+
+	/* the page the GBA is busy with is likely to change again, leave it for last */
+	for (i = 0; i < nextFree; i++) {
+		cleanHand = (cleanHand + 1) % nextFree;
+		if (dirty[cleanHand] && (cleanHand != lastFrame || numDirty == 1))
+			break;
+	}
+	writeBack(cleanHand);
+	return true;
+}
+
+void T_Flush(void) {
+	while (T_Clean());
+}
+
+u32 T_Dirty(void) {
+	return numDirty;
+}
@@ -0,0 +1,62 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - Slow tier of guest memory
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _TIER_H
+#define _TIER_H
+
+#include <gccore.h>
+
+/*
+ * Somewhere to keep guest pages that we can't point at directly, like
+ * ARAM.  Offsets and lengths are always whole, page aligned pages, and
+ * buffers are page aligned too; false on failure.  A blank backend is
+ * taken to be all zeroes until something gets written to it, so those
+ * pages never get read.
+ */
+struct _tierBackend {
+	const char *name;
+	bool (*read)(u32 offset, void *dst, u32 len);
+	bool (*write)(u32 offset, const void *src, u32 len);
+	bool blank;
+};
+
+struct _tStats {
+	u32 hits;       /* touches of a page that was already in main RAM */
+	u32 promotions; /* pages brought in from the slow tier */
+	u32 demotions;  /* pages pushed back out to make room */
+	u32 writeBacks; /* demotions that had to write the page back */
+};
+extern struct _tStats T_Stats;
+
+/* how much main RAM the hot slow tier pages get */
+#define T_FRAMES_SZ (1024 * 1024)
+
+/* main RAM to keep the hot slow tier pages in, page aligned */
+extern void T_Init(void *frames, u32 bytes);
+
+/*
+ * Host address of guest page `page' (in a slow region), brought into main
+ * RAM if it isn't already.  Only good until the next call, and only
+ * written back if write is set.
+ */
+extern u8 *T_Page(u32 page, bool write);
+
+/* has page `page' (in a slow region) never been written, so that it's still all zeroes? */
+extern bool T_Untouched(u32 page);
+
+/* how many pages are in main RAM right now */
+extern u32 T_Resident(void);
+
+/* write one changed page back while nothing else is going on, false if there weren't any */
+extern bool T_Clean(void);
+
+/* write every changed page back */
+extern void T_Flush(void);
+
+/* how many pages in main RAM have changes that haven't been written back */
+extern u32 T_Dirty(void);
+
+#endif /* _TIER_H */
@@ -0,0 +1,107 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - Virtual disk
+ *
+ * A disk image on the SD card, for the guest to use as a block device over
+ * the link.  It goes on the end of the host's map as one more slow region,
+ * so the slow tier's frames are its block cache: sectors the GBA keeps
+ * coming back to stay in main RAM, and the ones it changes get written
+ * back to the image while the link is idle.
+ *
+ * The image doesn't have to be a whole number of pages; anything past the
+ * end of it reads as zeroes and never gets written.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <gccore.h>
+#include "comms.h"
+#include "mem.h"
+#include "vdisk.h"
+
+u32 V_Sectors;
+
+static FILE *file;
+static u32 fileSize, base;
+static bool opened;
+
+/* how much of [offset, offset + len) the image actually has */
+static inline u32 inFile(u32 offset, u32 len) {
+	if (offset >= fileSize)
+		return 0;
+	return (len < fileSize - offset) ? len : fileSize - offset;
+}
+
+static bool diskRead(u32 offset, void *dst, u32 len) {
+	u32 n = inFile(offset, len);
+
+	if (n && (fseek(file, offset, SEEK_SET) || fread(dst, n, 1, file) != 1))
+		return false;
+	memset((u8 *)dst + n, 0, len - n);
+	return true;
+}
+
+static bool diskWrite(u32 offset, const void *src, u32 len) {
+	u32 n = inFile(offset, len);
+
+	if (n && (fseek(file, offset, SEEK_SET) || fwrite(src, n, 1, file) != 1))
+		return false;
+	return fflush(file) == 0;
+}
+
+static const struct _tierBackend backend = {
+	.name  = "disk",
+	.read  = diskRead,
+	.write = diskWrite
+};
+
+void V_Open(const char *path) {
+	struct stat st;
+	u32 size;
+
+	if (opened)
+		return;
+	opened = true;
+
+	/* no disk is fine, the guest just doesn't get one */
+	if (stat(path, &st))
+		return;
+
+	size = ((u64)st.st_size + M_PAGE_SIZE - 1) & ~(M_PAGE_SIZE - 1);
+	if ((u64)st.st_size < BLK_SECTOR_SIZE || (u64)st.st_size + M_PAGE_SIZE > 0xffffffff - M_State.size) {
+		printf("%s is %llu bytes, that's no good for a disk, going without\n", path, (u64)st.st_size);
+		return;
+	}
+
+	file = fopen(path, "rb+");
+	if (!file) {
+		printf("Can't open %s, going without a disk\n", path);
+		return;
+	}
+
+	fileSize = st.st_size;
+	base = M_State.size;
+	M_AddSlowRegion("disk", &backend, size, M_REGION_DISK);
+	V_Sectors = fileSize / BLK_SECTOR_SIZE;
+	printf("Disk: %s, %u sectors\n", path, V_Sectors);
+}
+
+bool V_Addr(u32 sector, u32 count, u32 *addr) {
+	if (!count || count > BLK_MAX_SECTORS || sector >= V_Sectors || count > V_Sectors - sector)
+		return false;
+
+	*addr = base + (sector * BLK_SECTOR_SIZE);
+	return true;
+}
+
+void V_Close(void) {
+	if (!file)
+		return;
+
+	T_Flush();
+	fclose(file);
+	file = NULL;
+	V_Sectors = 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * GBA Linux Loader - GCN/Wii host side - Virtual disk
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _VDISK_H
+#define _VDISK_H
+
+#include <gccore.h>
+
+/* how big the disk is, 0 if there isn't one */
+extern u32 V_Sectors;
+
+/* use the image at path as the disk, if it's there; only the first call does anything */
+extern void V_Open(const char *path);
+
+/* where [sector, sector + count) is in the host's map, false if it's not all on the disk */
+extern bool V_Addr(u32 sector, u32 count, u32 *addr);
+
+/* write everything the GBA changed out to the image, and let go of it */
+extern void V_Close(void);
+
+#endif /* _VDISK_H */
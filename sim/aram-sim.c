@@ -0,0 +1,43 @@
+/*
+ * GBA Linux Loader - Link simulator - ARAM stand-in
+ *
+ * A file standing in for the GameCube's ARAM as the slow tier of guest
+ * memory.  It's just as unaddressable from our side, and slow enough that
+ * the hot pages staying in main RAM matters.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <gccore.h>
+#include "sim.h"
+#include "tier.h"
+
+static int fd = -1;
+
+static bool fileRead(u32 offset, void *dst, u32 len) {
+	return pread(fd, dst, len, offset) == len;
+}
+
+static bool fileWrite(u32 offset, const void *src, u32 len) {
+	return pwrite(fd, src, len, offset) == len;
+}
+
+const struct _tierBackend S_AramBackend = {
+	.name  = "ARAM (file)",
+	.read  = fileRead,
+	.write = fileWrite,
+	.blank = true
+};
+
+void S_AramInit(u32 size) {
+	/* nobody else needs to find it, it goes away with us */
+	fd = open("aram.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || unlink("aram.bin") || ftruncate(fd, size)) {
+		perror("aram.bin");
+		exit(1);
+	}
+}
@@ -0,0 +1,227 @@
+/*
+ * GBA Linux Loader - Link simulator - Page cache trace replay
+ *
+ * Feeds a recorded trace of guest memory accesses through pagecache.c and
+ * reports the hit rate and link traffic, for one cache geometry or for a
+ * sweep over all of them.  Understands:
+ *
+ *   R <addr> <bytes>     plain trace lines (W for writes)
+ *   <addr> <bytes>       same as R
+ *   Got MEM_READ with addr=0x..., length=<words>   (gba-trace-dump, host ring)
+ *   Got MEM_WRITE with addr=0x..., length=<words>
+ *   Reading <bytes>B from 0x...                    (gba-trace-dump, GBA ring)
+ *   Writing <bytes>B to 0x...
+ *
+ * Give it one side's trace, not both, or it sees every access twice.  For a
+ * trace of every guest access, rather than just the misses, record it from
+ * a loader built with -DP_DEFAULT_LINE_SHIFT=0.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gba_types.h>
+#include "host.h"
+#include "pagecache.h"
+
+struct access {
+	u32 addr;
+	u32 len;
+	bool write;
+};
+
+static struct access *trace;
+static u32 traceLen, traceCap;
+static u64 fetchedBytes, storedBytes, accessedBytes;
+static u8 scratch[1 << P_MAX_LINE_SHIFT];
+
+/*
+ * What pagecache.c links against; nothing goes anywhere, we just count it
+ */
+u32 H_Features; /* no FEAT_TAGGED, so no prefetching */
+
+void H_FetchMemBuf(void *buf, u32 addr, int len) {
+	memset(buf, 0, len);
+	fetchedBytes += len;
+}
+
+void H_StoreMemBuf(const void *buf, u32 addr, int len) {
+	storedBytes += len;
+}
+
+int H_SubmitWrite(const void *buf, u32 addr, int len) {
+	H_StoreMemBuf(buf, addr, len);
+	return H_NO_ID;
+}
+
+int H_SubmitRead(void *buf, u32 addr, int len) {
+	H_FetchMemBuf(buf, addr, len);
+	return H_NO_ID;
+}
+
+bool H_Done(int id) {
+	return true;
+}
+
+u32 H_FreeIds(void) {
+	return MAX_INFLIGHT;
+}
+
+bool H_Wait(int id) {
+	return true;
+}
+
+static void addAccess(u32 addr, u32 len, bool write) {
+	if (!len)
+		return;
+
+	if (traceLen == traceCap) {
+		traceCap = traceCap ? traceCap * 2 : 4096;
+		trace = realloc(trace, traceCap * sizeof(*trace));
+		if (!trace) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	trace[traceLen].addr = addr;
+	trace[traceLen].len = len;
+	trace[traceLen].write = write;
+	traceLen++;
+}
+
+static void loadTrace(const char *path) {
+	char line[256], *p, op;
+	unsigned long addr, len;
+	FILE *fp;
+
+	fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if ((p = strstr(line, "Got MEM_READ with addr=")) &&
+		    sscanf(p, "Got MEM_READ with addr=%lx, length=%lu", &addr, &len) == 2)
+			addAccess(addr, len * 4, false);
+		else if ((p = strstr(line, "Got MEM_WRITE with addr=")) &&
+			 sscanf(p, "Got MEM_WRITE with addr=%lx, length=%lu", &addr, &len) == 2)
+			addAccess(addr, len * 4, true);
+		else if ((p = strstr(line, "Reading ")) &&
+			 sscanf(p, "Reading %luB from %lx", &len, &addr) == 2)
+			addAccess(addr, len, false);
+		else if ((p = strstr(line, "Writing ")) &&
+			 sscanf(p, "Writing %luB to %lx", &len, &addr) == 2)
+			addAccess(addr, len, true);
+		else if (sscanf(line, " %c %li %li", &op, (long *)&addr, (long *)&len) == 3 &&
+			 (op == 'R' || op == 'W'))
+			addAccess(addr, len, op == 'W');
+		else if (sscanf(line, " %li %li", (long *)&addr, (long *)&len) == 2)
+			addAccess(addr, len, false);
+	}
+
+	if (fp != stdin)
+		fclose(fp);
+}
+
+static void replay(u32 lineShift, u32 ways, int policy) {
+	u32 i, n, off;
+	u64 lookups;
+
+	if (!P_Init(lineShift, ways, policy))
+		return;
+
+	fetchedBytes = 0;
+	storedBytes = 0;
+	accessedBytes = 0;
+	for (i = 0; i < traceLen; i++) {
+		/* big accesses go through in line sized pieces, same as they would on the GBA */
+		for (off = 0; off < trace[i].len; off += n) {
+			n = trace[i].len - off;
+			if (n > sizeof(scratch))
+				n = sizeof(scratch);
+
+			if (trace[i].write)
+				P_Write(scratch, trace[i].addr + off, n);
+			else
+				P_Read(scratch, trace[i].addr + off, n);
+		}
+		accessedBytes += trace[i].len;
+	}
+	P_Flush();
+
+	lookups = (u64)P_Stats.hits + P_Stats.misses;
+	printf("%5u %4u  %-5s %10u %10u %10u %7.2f%% %10llu %10llu %8u %6.2f\n",
+	       1 << lineShift, ways, policy == P_CLOCK ? "clock" : "lru",
+	       P_Stats.hits, P_Stats.misses, P_Stats.evictions,
+	       lookups ? 100.0 * P_Stats.hits / lookups : 0.0,
+	       (unsigned long long)fetchedBytes, (unsigned long long)storedBytes,
+	       P_Stats.writeBacks,
+	       accessedBytes ? (double)(fetchedBytes + storedBytes) / accessedBytes : 0.0);
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [options] trace... (- for stdin)\n"
+		"  -l bytes  line size, %u - %u (default: sweep)\n"
+		"  -w ways   associativity (default: sweep)\n"
+		"  -p pol    lru or clock (default: both)\n",
+		argv0, 1 << P_MIN_LINE_SHIFT, 1 << P_MAX_LINE_SHIFT);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	u32 line = 0, ways = 0, shift, w;
+	int opt, policy = -1, pol;
+
+	while ((opt = getopt(argc, argv, "l:w:p:")) != -1) {
+		switch (opt) {
+		case 'l': line = strtoul(optarg, NULL, 0); break;
+		case 'w': ways = strtoul(optarg, NULL, 0); break;
+		case 'p':
+			if (!strcmp(optarg, "lru"))
+				policy = P_LRU;
+			else if (!strcmp(optarg, "clock"))
+				policy = P_CLOCK;
+			else
+				usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+
+	if (optind >= argc)
+		usage(argv[0]);
+
+	for (; optind < argc; optind++)
+		loadTrace(argv[optind]);
+
+	if (!traceLen) {
+		fprintf(stderr, "no accesses found in trace\n");
+		return 1;
+	}
+
+	printf("%u accesses, %u byte cache\n", traceLen, P_CACHE_BYTES);
+	printf(" line ways  pol         hits     misses  evictions     hit%%    fetched     stored   writes  ratio\n");
+	for (shift = P_MIN_LINE_SHIFT; shift <= P_MAX_LINE_SHIFT; shift++) {
+		if (line && (1u << shift) != line)
+			continue;
+
+		for (w = 1; (w << shift) <= P_CACHE_BYTES && w <= 16; w <<= 1) {
+			if (ways && w != ways)
+				continue;
+
+			for (pol = P_LRU; pol <= P_CLOCK; pol++) {
+				if (policy >= 0 && pol != policy)
+					continue;
+
+				replay(shift, w, pol);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+/*
+ * GBA Linux Loader - Link simulator - libfat stand-in
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _FAT_H
+#define _FAT_H
+
+#include <stdbool.h>
+
+extern bool fatInitDefault(void);
+
+#endif /* _FAT_H */
@@ -0,0 +1,31 @@
+/*
+ * GBA Linux Loader - Link simulator - libgba stand-in
+ *
+ * Only what main.c needs; the link itself goes through joy.h.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _GBA_H
+#define _GBA_H
+
+#include "gba_types.h"
+
+#define IRQ_SERIAL (1 << 7)
+
+static inline void irqInit(void) { }
+static inline void irqEnable(int irq) { (void)irq; }
+
+static inline void consoleInit(int charBase, int mapBase, int background,
+			       const u8 *font, int fontSize, int palette) { }
+
+static u16 BG_COLORS[256] __attribute__((unused));
+
+#define RGB5(r, g, b) ((r) | ((g) << 5) | ((b) << 10))
+#define RGB8(r, g, b) (((r) >> 3) | (((g) >> 3) << 5) | (((b) >> 3) << 10))
+
+#define MODE_0     (0)
+#define BG0_ON     (1 << 8)
+#define SetMode(m) ((void)(m))
+
+#endif /* _GBA_H */
@@ -0,0 +1,44 @@
+/*
+ * GBA Linux Loader - Link simulator - libgba stand-in
+ *
+ * The BIOS calls the GBA side uses, done in C.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _GBA_SYSTEMCALLS_H
+#define _GBA_SYSTEMCALLS_H
+
+#include "gba_types.h"
+
+/* SWI 0x11: type 0x10 header with the unpacked size, then flag bytes, MSB first */
+static inline void LZ77UnCompWram(const void *source, void *dest) {
+	const u8 *src = source;
+	u8 *dst = dest;
+	u32 size, out = 0, len, disp;
+	u8 flags;
+	int i;
+
+	size = src[1] | (src[2] << 8) | (src[3] << 16);
+	src += 4;
+
+	while (out < size) {
+		flags = *src++;
+		for (i = 0; i < 8 && out < size; i++, flags <<= 1) {
+			if (!(flags & 0x80)) {
+				dst[out++] = *src++;
+				continue;
+			}
+
+			len = (src[0] >> 4) + 3;
+			disp = (((src[0] & 0xf) << 8) | src[1]) + 1;
+			src += 2;
+			while (len-- && out < size) {
+				dst[out] = dst[out - disp];
+				out++;
+			}
+		}
+	}
+}
+
+#endif /* _GBA_SYSTEMCALLS_H */
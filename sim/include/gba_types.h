@@ -0,0 +1,16 @@
+/*
+ * GBA Linux Loader - Link simulator - libgba stand-in
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _GBA_TYPES_H
+#define _GBA_TYPES_H
+
+#include "sim-types.h"
+
+#define EWRAM_DATA
+#define EWRAM_BSS
+#define IWRAM_CODE
+
+#endif /* _GBA_TYPES_H */
@@ -0,0 +1,19 @@
+/*
+ * GBA Linux Loader - Link simulator - libogc stand-in
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _GCCORE_H
+#define _GCCORE_H
+
+#include <sys/stat.h>
+#include "sim-types.h"
+
+/* ticks are microseconds in the simulator */
+#define TB_TIMER_CLOCK (1000) /* per millisecond */
+extern u64 gettime(void);
+extern u32 diff_msec(u64 start, u64 end);
+extern u32 diff_usec(u64 start, u64 end);
+
+#endif /* _GCCORE_H */
@@ -0,0 +1,27 @@
+/*
+ * GBA Linux Loader - Link simulator - Console output
+ *
+ * Force-included into both loaders, so their printf()/puts() chatter is
+ * tagged with the side it came from, and hidden unless asked for.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _SIM_STDIO_H
+#define _SIM_STDIO_H
+
+#include <stdio.h>
+
+#define SIM_HOST (0)
+#define SIM_GBA  (1)
+
+extern int S_Printf(int side, const char *fmt, ...);
+extern int S_Puts(int side, const char *s);
+
+#ifdef SIM_SIDE
+#define printf(...)  S_Printf(SIM_SIDE, __VA_ARGS__)
+#define iprintf(...) S_Printf(SIM_SIDE, __VA_ARGS__)
+#define puts(s)      S_Puts(SIM_SIDE, s)
+#endif
+
+#endif /* _SIM_STDIO_H */
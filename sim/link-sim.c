@@ -0,0 +1,345 @@
+/*
+ * GBA Linux Loader - Link simulator - JOY bus model
+ *
+ * Models the two JOY bus data registers the way the hardware does: one word
+ * each way, a flag saying whether the other side has picked it up yet, and
+ * nothing stopping a writer from clobbering a word that was never read.
+ * Every host-side transfer costs a configurable latency, plus jitter, and
+ * the GBA can be made slow to notice a new word, so one the host sends too
+ * soon after the last takes its place before it's seen.  Words on their way
+ * to the GBA can also pick up bit errors, like over a worn cable.
+ *
+ * Once the loader installs its serial IRQ handler, the host thread runs it
+ * for every word that lands or gets picked up, under a lock that stands in
+ * for the GBA masking IRQs.  A slow pickup delays the IRQ the same way it
+ * delays polling, and the GBA runs a late one itself while it waits.
+ *
+ * Before the GBA "boots", the host talks to a stand-in for the BIOS
+ * multiboot code, which swallows the ROM and then starts the GBA thread.
+ *
+ * The cable can be pulled out for a while, too: the host sees no GBA on
+ * the port, its words go nowhere, and it reads nothing, while both of the
+ * GBA's registers stay just as they were.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "sim.h"
+#include "comms.h"
+#include "joy.h"
+#include "link.h"
+
+/*
+ * host -> GBA (REG_JOYRE) and GBA -> host (REG_JOYTR), with the "not read
+ * yet" flag alongside so reading a word and clearing its flag is one access,
+ * like it is on hardware
+ */
+#define REG_FULL (1ULL << 32)
+static u64 joyre, joytr;
+
+static u32 latency, jitter, pickup, seed = 0x12345678;
+static u64 joyreAt; /* when the host's last word landed */
+static void (*irqHandler)(void);
+static pthread_mutex_t irqLock = PTHREAD_MUTEX_INITIALIZER;
+static u32 flipOdds; /* a word gets a bit flipped when the next random number is below this, 0 for never */
+u32 S_Flips;
+static u64 unplugUntil;
+static u16 jflags; /* the GBA's general purpose JOY status flags */
+
+static enum {
+	BIOS_WAIT_KEY, /* host is about to read the session key */
+	BIOS_RECV_ROM, /* host is pushing the ROM at us */
+	BOOTED         /* loader is running */
+} bios = BIOS_WAIT_KEY;
+static u32 romWords; /* everything the host sent the BIOS: key, header, ROM, CRC */
+static pthread_mutex_t bootLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bootCond = PTHREAD_COND_INITIALIZER;
+
+u64 S_Micros(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u64)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*
+ * Spin rather than sleep, the scheduler is far too coarse for this, but
+ * yield while doing it so the other side gets to run on a single CPU.
+ */
+void S_Delay(u32 us) {
+	u64 end = S_Micros() + us;
+
+	while (S_Micros() < end)
+		sched_yield();
+}
+
+void S_LinkInit(u32 latencyUs, u32 jitterUs, u32 pickupUs) {
+	latency = latencyUs;
+	jitter = jitterUs;
+	pickup = pickupUs;
+}
+
+u32 S_WaitBoot(void) {
+	pthread_mutex_lock(&bootLock);
+	while (bios != BOOTED)
+		pthread_cond_wait(&bootCond, &bootLock);
+	pthread_mutex_unlock(&bootLock);
+
+	return romWords * sizeof(u32);
+}
+
+static void boot(void) {
+	pthread_mutex_lock(&bootLock);
+	bios = BOOTED;
+	pthread_cond_broadcast(&bootCond);
+	pthread_mutex_unlock(&bootLock);
+}
+
+void S_LinkNoise(double bitErrorRate) {
+	double p = bitErrorRate * 32; /* close enough for rates that are any use */
+
+	__atomic_store_n(&flipOdds, (p >= 1.0) ? 0xffffffff : (u32)(p * 4294967296.0), __ATOMIC_RELAXED);
+}
+
+/* xorshift32, only ever called from the host thread */
+static u32 rand32(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+void S_Unplug(u32 ms) {
+	__atomic_store_n(&unplugUntil, S_Micros() + ((u64)ms * 1000), __ATOMIC_RELEASE);
+}
+
+static bool unplugged(void) {
+	return S_Micros() < __atomic_load_n(&unplugUntil, __ATOMIC_ACQUIRE);
+}
+
+/* one host-side transfer's worth of time on the wire */
+static void wordDelay(void) {
+	u32 us = latency;
+
+	if (jitter)
+		us += rand32() % (jitter + 1);
+	if (us)
+		S_Delay(us);
+}
+
+static bool rxFull(void) {
+	return (__atomic_load_n(&joyre, __ATOMIC_ACQUIRE) & REG_FULL) &&
+	       (!pickup || S_Micros() - __atomic_load_n(&joyreAt, __ATOMIC_ACQUIRE) >= pickup);
+}
+
+static bool txFull(void) {
+	return (__atomic_load_n(&joytr, __ATOMIC_ACQUIRE) & REG_FULL) != 0;
+}
+
+/* the GBA's serial IRQ, if it has one yet and there's a reason for it */
+static void irq(void) {
+	void (*handler)(void) = __atomic_load_n(&irqHandler, __ATOMIC_ACQUIRE);
+
+	if (!handler)
+		return;
+
+	pthread_mutex_lock(&irqLock);
+	handler();
+	pthread_mutex_unlock(&irqLock);
+}
+
+/*
+ * GBA side
+ */
+bool J_HwRxReady(void) {
+	return rxFull();
+}
+
+bool J_HwTxPending(void) {
+	return txFull();
+}
+
+u32 J_HwRead(void) {
+	return __atomic_fetch_and(&joyre, ~REG_FULL, __ATOMIC_ACQ_REL);
+}
+
+void J_HwSend(u32 msg) {
+	__atomic_store_n(&joytr, msg | REG_FULL, __ATOMIC_RELEASE);
+}
+
+void J_HwIrqInit(void (*handler)(void)) {
+	__atomic_store_n(&irqHandler, handler, __ATOMIC_RELEASE);
+}
+
+u32 J_HwIrqOff(void) {
+	pthread_mutex_lock(&irqLock);
+	return 0;
+}
+
+void J_HwIrqOn(u32 old) {
+	(void)old;
+	pthread_mutex_unlock(&irqLock);
+}
+
+void J_HwFlag(u16 flags) {
+	__atomic_fetch_or(&jflags, flags, __ATOMIC_ACQ_REL);
+}
+
+/* the GBA's spinning on the link; take an IRQ the pickup delay held back, and let the host run */
+void J_HwIdle(void) {
+	if (rxFull())
+		irq();
+	sched_yield();
+}
+
+/*
+ * Host side
+ */
+/* the one port the GBA's on, the rest are empty */
+s32 S_Chan = GBA_CHAN;
+
+void L_Init(s32 chan) {
+}
+
+bool L_Probe(s32 chan) {
+	return chan == S_Chan && !unplugged();
+}
+
+u8 L_Status(s32 chan) {
+	u8 stat = 0;
+
+	wordDelay();
+	if (unplugged())
+		return 0;
+	if (__atomic_load_n(&joyre, __ATOMIC_ACQUIRE) & REG_FULL)
+		stat |= 0x2;
+	if (__atomic_load_n(&joytr, __ATOMIC_ACQUIRE) & REG_FULL)
+		stat |= 0x8;
+
+	/* the BIOS raises a general purpose flag when it's ready for multiboot */
+	if (bios != BOOTED)
+		stat |= 0x10;
+	else
+		stat |= __atomic_load_n(&jflags, __ATOMIC_ACQUIRE);
+
+	return stat;
+}
+
+u8 L_Reset(s32 chan) {
+	return L_Status(chan);
+}
+
+static u64 recvReg(void) {
+	u64 reg;
+
+	wordDelay();
+	switch (bios) {
+	case BIOS_WAIT_KEY: {
+		bios = BIOS_RECV_ROM;
+		return 0x7365646f; /* any session key will do, nobody checks the ROM */
+	}
+	case BIOS_RECV_ROM: {
+		/* host wants the CRC back, the ROM is in */
+		boot();
+		return 0;
+	}
+	case BOOTED:
+		break;
+	}
+
+	if (unplugged())
+		return 0;
+	reg = __atomic_fetch_and(&joytr, ~REG_FULL, __ATOMIC_ACQ_REL);
+	if (reg & REG_FULL)
+		irq();
+	return reg;
+}
+
+u32 L_Recv(s32 chan) {
+	return recvReg();
+}
+
+bool L_Poll(s32 chan, u32 *msg) {
+	u64 reg = recvReg();
+
+	*msg = reg;
+	return (reg & REG_FULL) != 0;
+}
+
+void L_Send(s32 chan, u32 msg) {
+	u32 odds;
+
+	wordDelay();
+	if (bios != BOOTED) {
+		if (bios == BIOS_RECV_ROM)
+			romWords++;
+		return;
+	}
+	if (unplugged())
+		return;
+
+	odds = __atomic_load_n(&flipOdds, __ATOMIC_RELAXED);
+	if (odds && rand32() < odds) {
+		msg ^= 1 << (rand32() % 32);
+		S_Flips++;
+	}
+
+	__atomic_store_n(&joyreAt, S_Micros(), __ATOMIC_RELEASE);
+	/* one that's waiting on the pickup delay gets in before this lands on top of it */
+	if (rxFull())
+		irq();
+	__atomic_store_n(&joyre, msg | REG_FULL, __ATOMIC_RELEASE);
+	if (rxFull())
+		irq();
+}
+
+u32 L_Backlog(s32 chan) {
+	return 0;
+}
+
+void L_Sync(s32 chan) {
+}
+
+/*
+ * The transfer happens right away, like everything else here, but the
+ * first look always finds it still going, so the callers' waiting paths
+ * get a run too.
+ */
+static u64 pendReg;
+static u8 pendStat;
+static bool pendSeen;
+
+void L_StatusStart(s32 chan) {
+	pendStat = L_Status(chan);
+	pendSeen = false;
+}
+
+bool L_StatusDone(s32 chan, u8 *stat) {
+	if (!pendSeen) {
+		pendSeen = true;
+		return false;
+	}
+
+	*stat = pendStat;
+	return true;
+}
+
+void L_PollStart(s32 chan) {
+	pendReg = recvReg();
+	pendSeen = false;
+}
+
+bool L_PollDone(s32 chan, u32 *msg, bool *fresh) {
+	if (!pendSeen) {
+		pendSeen = true;
+		return false;
+	}
+
+	*msg = pendReg;
+	*fresh = (pendReg & REG_FULL) != 0;
+	return true;
+}
+
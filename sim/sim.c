@@ -0,0 +1,809 @@
+/*
+ * GBA Linux Loader - Link simulator - Main
+ *
+ * Runs the host state machine (C_Process) on the main thread, and the GBA
+ * side (the stub, then main.c handshake, then H_ReadMemBuf) on a second
+ * one, against the JOY bus model in link-sim.c.  In place of uc-rv32ima-gba,
+ * app_main() reads back the kernel image through the link and checks every
+ * byte, and beats on the virtual disk if there is one.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <limits.h>
+#include <utime.h>
+#include <gccore.h>
+#include "sim.h"
+#include "sim-stdio.h"
+#include "mem.h"
+#include "comms.h"
+#include "host.h"
+#include "pagecache.h"
+#include "readahead.h"
+#include "lz.h"
+#include "pager.h"
+#include "tier.h"
+#include "vdisk.h"
+#include "crcbench.h"
+
+/* GBA side main.c and the stub's, renamed so they don't clash with ours */
+extern int gba_main(void);
+extern int stub_main(void);
+
+#define MEM_SZ (MEM1_BUF_SZ)
+
+struct _memState M_State;
+bool S_Verbose = false;
+
+static char sdRoot[] = "/tmp/gba-link-sim.XXXXXX";
+static u8 *kernel;
+static u32 kernelSize = 1024 * 1024;
+static u32 numReads = 64, readSize = 1024, workingSet, thinkTime;
+static bool randomReads = false, prefetch = false, writes = false, compressible = false, twoStage = true, elfKernel = false, showStats = false;
+static char tracePrefix[PATH_MAX];
+
+/* pull the cable out partway through (-u), for this many ms */
+static u32 unplugMs;
+
+/* a checkpoint to save at the end (-K), or to resume from (-R), and the core state that goes in it */
+#define CKPT_PATH       "apps/gba-linux-loader/checkpoint-%d.bin"
+#define SIM_CORE_WORDS  (40)
+static char ckptOut[PATH_MAX], ckptIn[PATH_MAX];
+
+/* the disk image, and our copy of what should be in it */
+#define DISK_PATH      "apps/gba-linux-loader/rootfs.img"
+#define DISK_TAIL      (3 * BLK_SECTOR_SIZE) /* so it's not a whole number of pages */
+#define DISK_MAX_SECTORS (20)                /* per access, a couple of BLK_MAX_SECTORS worth */
+static u8 *disk;
+static u32 diskSize;
+
+/* the ELF kernel: the image goes in one segment, the end of it as BSS */
+#define ELF_SEG_OFFSET (0x1000)
+#define ELF_VADDR      (0xC0000000)
+#define ELF_ENTRY      (0x100)
+#define ELF_BSS        (64 * 1024)
+
+/* the loader ROM, to check what the stub got against */
+#define ROM_SZ  (96 * 1024)
+#define STUB_SZ (4 * 1024)
+static u8 rom[ROM_SZ];
+u8 S_Ewram[LOADER_MAX_BYTES] __attribute__((aligned(4)));
+
+/*
+ * libogc/libfat bits the host side expects
+ */
+u64 gettime(void) {
+	return S_Micros();
+}
+
+u32 diff_msec(u64 start, u64 end) {
+	return (end - start) / 1000;
+}
+
+u32 diff_usec(u64 start, u64 end) {
+	return end - start;
+}
+
+/* and the GBA's clock.h */
+u32 K_Micros(void) {
+	return S_Micros();
+}
+
+bool fatInitDefault(void) {
+	return true;
+}
+
+/*
+ * Console output from either side
+ */
+int S_Printf(int side, const char *fmt, ...) {
+	va_list ap;
+	int ret;
+
+	if (!S_Verbose)
+		return 0;
+
+	va_start(ap, fmt);
+	printf(side == SIM_GBA ? "[gba]  " : "[host] ");
+	ret = vprintf(fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+int S_Puts(int side, const char *s) {
+	if (!S_Verbose)
+		return 0;
+
+	return printf("%s%s\n", side == SIM_GBA ? "[gba]  " : "[host] ", s);
+}
+
+/*
+ * Fake SD card contents
+ */
+static void writeFile(const char *path, const void *data, size_t len) {
+	FILE *fp;
+
+	fp = fopen(path, "wb");
+	if (!fp || fwrite(data, len, 1, fp) != 1) {
+		perror(path);
+		exit(1);
+	}
+	fclose(fp);
+}
+
+static void put16(u8 *p, u16 v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(u8 *p, u32 v) {
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+/*
+ * Wrap the kernel image up like a vmlinux: a note nobody loads, then the
+ * image in a segment linked high but loaded at the start of guest RAM
+ */
+static void writeElf(const char *path) {
+	u8 *elf = calloc(1, ELF_SEG_OFFSET + kernelSize), *ph;
+
+	memcpy(elf, "\177ELF", 4);
+	elf[4] = 1;                       /* 32-bit */
+	elf[5] = 1;                       /* little endian */
+	elf[6] = 1;                       /* version */
+	put16(&elf[16], 2);               /* executable */
+	put16(&elf[18], 243);             /* RISC-V */
+	put32(&elf[20], 1);
+	put32(&elf[24], ELF_VADDR + ELF_ENTRY);
+	put32(&elf[28], 52);              /* program headers right after this */
+	put16(&elf[40], 52);
+	put16(&elf[42], 32);
+	put16(&elf[44], 2);
+
+	ph = &elf[52];
+	put32(&ph[0], 4);                 /* PT_NOTE */
+	put32(&ph[4], 0x200);
+	put32(&ph[16], 0x40);
+
+	ph += 32;
+	put32(&ph[0], 1);                 /* PT_LOAD */
+	put32(&ph[4], ELF_SEG_OFFSET);
+	put32(&ph[8], ELF_VADDR);
+	put32(&ph[12], GUEST_RAM_BASE);
+	put32(&ph[16], kernelSize - ELF_BSS);
+	put32(&ph[20], kernelSize);
+
+	memcpy(&elf[ELF_SEG_OFFSET], kernel, kernelSize - ELF_BSS);
+	writeFile(path, elf, ELF_SEG_OFFSET + kernelSize - ELF_BSS);
+	free(elf);
+}
+
+static void ckptPath(char *path) {
+	sprintf(path, CKPT_PATH, S_Chan + 1);
+}
+
+/* copy a file in or out of the fake SD card */
+static bool copyFile(const char *to, const char *from) {
+	FILE *in = fopen(from, "rb"), *out = in ? fopen(to, "wb") : NULL;
+	char buf[4096];
+	size_t n;
+	bool ok = in && out;
+
+	while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0)
+		ok = fwrite(buf, n, 1, out) == 1;
+	if (!ok)
+		fprintf(stderr, "can't copy %s to %s\n", from, to);
+	if (in)
+		fclose(in);
+	if (out && fclose(out))
+		ok = false;
+	return ok;
+}
+
+static void cleanupSD(void) {
+	char path[sizeof(CKPT_PATH) + 8];
+
+	ckptPath(path);
+	unlink(path);
+	unlink("apps/gba-linux-loader/linux-loader.gba");
+	unlink("apps/gba-linux-loader/linux-loader-stub.gba");
+	unlink("apps/gba-linux-loader/linux.elf");
+	unlink(DISK_PATH);
+	rmdir("apps/gba-linux-loader");
+	rmdir("apps");
+	if (chdir("/") == 0)
+		rmdir(sdRoot);
+}
+
+static void setupSD(void) {
+	u8 stub[STUB_SZ];
+	u32 i, x = 0xdeadbeef, dict[64];
+
+	if (!mkdtemp(sdRoot) || chdir(sdRoot)) {
+		perror(sdRoot);
+		exit(1);
+	}
+	atexit(cleanupSD);
+
+	if (mkdir("apps", 0755) || mkdir("apps/gba-linux-loader", 0755)) {
+		perror("mkdir");
+		exit(1);
+	}
+
+	/*
+	 * The BIOS stand-in never looks at what it gets, but the stub has to
+	 * hand over the loader intact; make that look like code, words out of
+	 * a small set, with the header byte the host would fix up anyway.
+	 */
+	for (i = 0; i < 64; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		dict[i] = x;
+	}
+	for (i = 0; i < sizeof(rom); i += 4) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		memcpy(&rom[i], &dict[x % 64], 4);
+	}
+	rom[0xB2] = 0x96;
+	writeFile("apps/gba-linux-loader/linux-loader.gba", rom, sizeof(rom));
+
+	if (twoStage) {
+		memset(stub, 0, sizeof(stub));
+		writeFile("apps/gba-linux-loader/linux-loader-stub.gba", stub, sizeof(stub));
+	}
+
+	/* something that won't CRC the same if a word lands in the wrong place */
+	kernel = malloc(kernelSize);
+	for (i = 0; i < kernelSize; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		kernel[i] = x;
+	}
+
+	/*
+	 * or closer to a real kernel: every fourth 4KB page zeroed, the rest
+	 * words out of a small set, like instructions
+	 */
+	if (compressible) {
+		for (i = 0; i < 64; i++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			dict[i] = x;
+		}
+		for (i = 0; i + 4 <= kernelSize; i += 4) {
+			if (!((i / 4096) % 4))
+				memset(&kernel[i], 0, 4);
+			else
+				memcpy(&kernel[i], &dict[kernel[i] % 64], 4);
+		}
+	}
+	if (elfKernel) {
+		memset(&kernel[kernelSize - ELF_BSS], 0, ELF_BSS);
+		writeElf("apps/gba-linux-loader/linux.elf");
+	}
+	else
+		writeFile("apps/gba-linux-loader/linux.elf", kernel, kernelSize);
+
+	/* the same kernel every run, so give it the same date; the host checks a checkpoint's for it by that */
+	if (utime("apps/gba-linux-loader/linux.elf", &(struct utimbuf){ 0, 0 })) {
+		perror("utime");
+		exit(1);
+	}
+
+	if (diskSize) {
+		disk = malloc(diskSize);
+		for (i = 0; i < diskSize; i++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			disk[i] = x;
+		}
+		writeFile(DISK_PATH, disk, diskSize);
+	}
+
+	if (ckptIn[0]) {
+		char path[sizeof(CKPT_PATH) + 8];
+
+		ckptPath(path);
+		if (!copyFile(path, ckptIn))
+			exit(1);
+	}
+}
+
+/*
+ * Random reads and writes of a few sectors at a time all over the disk,
+ * then one off the end that has to be refused, then check that the image
+ * ends up with everything that was written once the host writes it back
+ */
+static u32 diskTest(void) {
+	u32 i, sector, count, sectors = diskSize / BLK_SECTOR_SIZE, bad = 0, x = 0x5eed1e55;
+	u32 *buf = malloc(DISK_MAX_SECTORS * BLK_SECTOR_SIZE);
+	u64 start = S_Micros();
+	u8 *img = malloc(diskSize);
+	FILE *fp;
+
+	if (H_DiskSectors != sectors) {
+		fprintf(stderr, "disk is %u sectors, not %u\n", H_DiskSectors, sectors);
+		return 1;
+	}
+
+	for (i = 0; i < numReads; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		sector = x % sectors;
+		count = 1 + ((x >> 16) % DISK_MAX_SECTORS);
+		if (count > sectors - sector)
+			count = sectors - sector;
+
+		if (i % 2) {
+			memset(buf, i, count * BLK_SECTOR_SIZE);
+			memcpy(disk + (sector * BLK_SECTOR_SIZE), buf, count * BLK_SECTOR_SIZE);
+			if (!H_WriteBlocks(buf, sector, count)) {
+				fprintf(stderr, "disk write of %u sectors at %u refused\n", count, sector);
+				bad++;
+			}
+			continue;
+		}
+
+		if (!H_ReadBlocks(buf, sector, count) ||
+		    memcmp(buf, disk + (sector * BLK_SECTOR_SIZE), count * BLK_SECTOR_SIZE)) {
+			fprintf(stderr, "mismatch reading %u sectors at %u\n", count, sector);
+			bad++;
+		}
+	}
+
+	if (H_ReadBlocks(buf, sectors - 1, 2)) {
+		fputs("disk read off the end wasn't refused\n", stderr);
+		bad++;
+	}
+
+	/* the host writes changes back while we're quiet */
+	while (T_Dirty())
+		S_Delay(1000);
+	fp = fopen(DISK_PATH, "rb");
+	if (!fp || fread(img, diskSize, 1, fp) != 1 || memcmp(img, disk, diskSize)) {
+		fputs("disk image doesn't have what was written to it\n", stderr);
+		bad++;
+	}
+	if (fp)
+		fclose(fp);
+
+	printf("disk: %u accesses of up to %u sectors: %llu ms, %u bad\n", numReads, DISK_MAX_SECTORS,
+	       (unsigned long long)((S_Micros() - start) / 1000), bad);
+	free(img);
+	free(buf);
+	return bad;
+}
+
+/* ask the host for its stats over the link; they had better be what it has */
+static u32 statsTest(void) {
+	struct linkStats host;
+	u32 tries;
+
+	/* a flipped bit in the reply can lose it, then the GBA asks again */
+	for (tries = 0; !H_HostStats(&host); tries++) {
+		if (!S_Flips || tries == 3) {
+			fputs("stats ping failed\n", stderr);
+			return 1;
+		}
+	}
+
+	if (showStats) {
+		stats_dump(&H_Stats, "GBA");
+		stats_dump(&host, "Host (over the link)");
+	}
+
+	/*
+	 * the host's idle now, nothing should have moved since; unless bits are
+	 * being flipped, when sending the stats can take retries of its own
+	 */
+	if (S_Flips) {
+		host.crcFails = C_Stats[S_Chan].crcFails;
+		host.retries = C_Stats[S_Chan].retries;
+	}
+	if (memcmp(&host, &C_Stats[S_Chan], sizeof(host))) {
+		fputs("stats over the link don't match the host's\n", stderr);
+		return 1;
+	}
+	if (!host.bytesRead && !host.bytesWritten) {
+		fputs("host stats are empty\n", stderr);
+		return 1;
+	}
+
+	printf("link: GBA %u CRC failures, %u retries; host %u CRC failures, %u retries; %u bits flipped, %u fixed\n",
+	       H_Stats.crcFails, H_Stats.retries, host.crcFails, host.retries, S_Flips, H_FecFixed);
+	return 0;
+}
+
+/* both sides' trace rings, for gba-trace-dump */
+static u32 writeTraces(void) {
+	char path[PATH_MAX + 16];
+	FILE *fp;
+	u32 bad = 0;
+
+	snprintf(path, sizeof(path), "%s-host.bin", tracePrefix);
+	if (!C_DumpTrace(path))
+		bad++;
+
+	snprintf(path, sizeof(path), "%s-gba.bin", tracePrefix);
+	fp = fopen(path, "wb");
+	if (!fp || fwrite(&H_Trace, sizeof(H_Trace), 1, fp) != 1) {
+		perror(path);
+		bad++;
+	}
+	if (fp)
+		fclose(fp);
+	return bad;
+}
+
+/* what a core would have in its registers, near enough */
+static u32 simCore(u32 i) {
+	return 0xc0de0000 ^ (i * 0x9e3779b9);
+}
+
+/* with -R, the host has to have put the checkpoint back, and everything in it */
+static u32 resumeCheck(void) {
+	u32 i;
+
+	if (!ckptIn[0])
+		return 0;
+
+	if (H_ResumeWords != SIM_CORE_WORDS) {
+		fprintf(stderr, "resumed with %u words of core state, not %u\n", H_ResumeWords, SIM_CORE_WORDS);
+		return 1;
+	}
+	for (i = 0; i < SIM_CORE_WORDS; i++) {
+		if (H_ResumeCore[i] != simCore(i)) {
+			fprintf(stderr, "core state word %u is 0x%08x, not 0x%08x\n", i, H_ResumeCore[i], simCore(i));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* with -K, have the host save us, and take the checkpoint off the SD card */
+static u32 saveCheckpoint(void) {
+	char path[sizeof(CKPT_PATH) + 8];
+	u32 core[SIM_CORE_WORDS], i;
+
+	for (i = 0; i < SIM_CORE_WORDS; i++)
+		core[i] = simCore(i);
+	if (!H_Checkpoint(core, SIM_CORE_WORDS)) {
+		fputs("checkpoint failed\n", stderr);
+		return 1;
+	}
+
+	ckptPath(path);
+	return copyFile(ckptOut, path) ? 0 : 1;
+}
+
+/*
+ * Stand-in for uc-rv32ima-gba: read the kernel back and check it, or
+ * scribble over it and check that it all landed in host memory
+ */
+/* where access i goes */
+static u32 accessAddr(u32 i, u32 span, u32 *x) {
+	if (randomReads) {
+		*x ^= *x << 13;
+		*x ^= *x >> 17;
+		*x ^= *x << 5;
+		return (*x % (span - readSize)) & ~3;
+	}
+
+	return (i * readSize) % (span - readSize + 1);
+}
+
+void app_main(void) {
+	u32 i, j, addr, ready = 0, bad = 0, x = 0xcafef00d, session = 0;
+	u64 start, elapsed;
+	u32 span;
+	u8 *buf, *written = calloc(1, kernelSize / M_PAGE_SIZE + 1);
+
+	/* only touch the first workingSet bytes, so the page cache has something to hit */
+	span = (workingSet && workingSet < kernelSize) ? workingSet : kernelSize;
+	if (H_KernelEntry != GUEST_RAM_BASE + (elfKernel ? ELF_ENTRY : 0)) {
+		fprintf(stderr, "kernel entry at 0x%08x\n", H_KernelEntry);
+		bad++;
+	}
+	buf = malloc((readSize + 3) & ~3);
+	bad += resumeCheck();
+	start = S_Micros();
+
+	for (i = 0; i < numReads; i++) {
+		addr = accessAddr(i, span, &x);
+
+		/* the host had better still have everything when the GBA gets back to it */
+		if (unplugMs && i == numReads / 2) {
+			session = H_Session;
+			S_Unplug(unplugMs);
+		}
+
+		/* the guest knows what it wants next, and asks for it before getting on with things */
+		if (prefetch && !writes)
+			H_PrefetchMemBuf(addr, readSize);
+
+		/* the guest gets on with things between accesses, touching memory as it goes */
+		if (thinkTime) {
+			u64 end = S_Micros() + thinkTime;
+			while (S_Micros() < end) {
+				H_Poll();
+				S_Delay(10);
+			}
+		}
+
+		if (writes) {
+			/* every fourth page gets cleared, so a checkpoint has pages of zeroes in it too */
+			for (j = 0; j < readSize; j++)
+				buf[j] = ((addr / M_PAGE_SIZE) % 4 == 3) ? 0 : i + j;
+
+			/* keep our copy in step, it's what host memory should look like after; resumed, it already does */
+			memcpy(kernel + addr, buf, readSize);
+			for (j = addr / M_PAGE_SIZE; j <= (addr + readSize - 1) / M_PAGE_SIZE; j++)
+				written[j] = 1;
+			if (!H_ResumeWords)
+				H_WriteMemBuf(buf, addr, readSize);
+			continue;
+		}
+
+		if (prefetch && H_ReadReady(addr, readSize))
+			ready++;
+		H_ReadMemBuf(buf, addr, readSize);
+		if (memcmp(buf, kernel + addr, readSize)) {
+			fprintf(stderr, "mismatch reading %u bytes at 0x%08x\n", readSize, addr);
+			bad++;
+		}
+	}
+
+	/* the same session, or it got booted all over again */
+	if (unplugMs && (!session || H_Session != session)) {
+		fprintf(stderr, "session %08x before the cable came out, %08x after\n", session, H_Session);
+		bad++;
+	}
+
+	if (writes) {
+		H_SyncMemBuf();
+
+		/* we're about to look at all of it, give the host the quiet it needs to page the rest in */
+		while (D_Missing())
+			S_Delay(1000);
+		for (addr = 0; addr < kernelSize; addr += readSize) {
+			j = (kernelSize - addr < readSize) ? kernelSize - addr : readSize;
+			M_Read(buf, M_State.guests[S_Chan].base + addr, j);
+			if (memcmp(buf, kernel + addr, j)) {
+				fprintf(stderr, "host memory wrong in %u bytes at 0x%08x\n", j, addr);
+				bad++;
+			}
+
+			/* and what the guest sees of what it wrote before, after a resume */
+			if (!H_ResumeWords || !written[addr / M_PAGE_SIZE])
+				continue;
+			H_ReadMemBuf(buf, addr, j);
+			if (memcmp(buf, kernel + addr, j)) {
+				fprintf(stderr, "resumed guest memory wrong in %u bytes at 0x%08x\n", j, addr);
+				bad++;
+			}
+		}
+	}
+
+	elapsed = S_Micros() - start;
+	if (!elapsed)
+		elapsed = 1;
+
+	printf("%u %s of %u bytes (%s, %s): %llu ms, %llu words/s, %u bad\n",
+	       numReads, writes ? "writes" : "reads", readSize,
+	       randomReads ? "random" : "sequential",
+	       writes ? (P_Enabled() ? "write-back" : "direct") : (H_Features & FEAT_TAGGED) ? "tagged" : (H_Features & FEAT_BURST) ? "burst" : "paced",
+	       (unsigned long long)(elapsed / 1000),
+	       (unsigned long long)(((u64)numReads * ((readSize + 3) / 4) * 1000000) / elapsed),
+	       bad);
+	if (P_Enabled())
+		printf("page cache: %u hits, %u misses, %u evictions, %u write-backs\n",
+		       P_Stats.hits, P_Stats.misses, P_Stats.evictions, P_Stats.writeBacks);
+	if (prefetch)
+		printf("prefetch: %u lines, %u of %u reads there in time\n", P_Stats.prefetches, ready, numReads);
+	if (H_Features & FEAT_PUSH)
+		printf("read-ahead: %u pushes, %u used, %u cancelled, %u bad\n",
+		       R_Stats.pushes, R_Stats.hits, R_Stats.cancels, R_Stats.bad);
+	if (T_Stats.promotions)
+		printf("slow tier: %u hits, %u promotions, %u demotions, %u written back, %u pages in RAM\n",
+		       T_Stats.hits, T_Stats.promotions, T_Stats.demotions, T_Stats.writeBacks, T_Resident());
+	if (C_DemandPaging)
+		printf("pager: %u faults, %u pages on fault, %u while idle, %u left\n",
+		       D_Stats.faults, D_Stats.faultPages, D_Stats.idlePages, D_Missing());
+	printf("pool: %u of %u frames used, %u set aside, %u pages shared, %u reads of untouched pages\n",
+	       M_Stats.used, M_Stats.frames, M_Stats.reserved, M_Stats.shared, C_ZeroReplies);
+	if (H_Features & FEAT_LZ77)
+		printf("LZ77: %u replies compressed, %u raw, %u of them cached, %llu -> %llu bytes\n",
+		       Z_Stats.packed, Z_Stats.raw, Z_Stats.cached,
+		       (unsigned long long)Z_Stats.in, (unsigned long long)Z_Stats.out);
+
+	if (diskSize) {
+		bad += diskTest();
+		printf("slow tier: %u hits, %u promotions, %u demotions, %u written back, %u pages in RAM\n",
+		       T_Stats.hits, T_Stats.promotions, T_Stats.demotions, T_Stats.writeBacks, T_Resident());
+	}
+
+	bad += statsTest();
+	if (ckptOut[0])
+		bad += saveCheckpoint();
+	if (tracePrefix[0])
+		bad += writeTraces();
+	exit(bad ? 1 : 0);
+}
+
+/* the BIOS and the stub have their own ways of dealing with a bad link, -e is for the loader's */
+static double bitErrors;
+
+static void runLoader(void) {
+	S_LinkNoise(bitErrors);
+	gba_main();
+}
+
+/* the stub would jump into EWRAM here; make sure it's the loader, then run it */
+void S_Boot(u32 bytes) {
+	if (bytes != sizeof(rom) || memcmp(S_Ewram, rom, sizeof(rom))) {
+		fprintf(stderr, "stub booted the wrong loader (%u bytes)\n", bytes);
+		exit(1);
+	}
+
+	runLoader();
+}
+
+/* for crc_bench() */
+static u32 cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return S_Micros() * 1000; /* close enough to a 1GHz cycle counter */
+#endif
+}
+
+static void *gbaThread(void *arg) {
+	/* the host only multiboots the stub if the loader compresses, and the stub is much smaller */
+	if (S_WaitBoot() < sizeof(rom))
+		stub_main();
+	else
+		runLoader();
+	return NULL;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -l us     per-word link latency (default 100)\n"
+		"  -j us     extra random per-word latency, 0 to this (default 0)\n"
+		"  -g us     time the GBA takes to notice each word, so sending faster loses some (default 0)\n"
+		"  -e rate   bit error rate on words going to the loader, like 1e-4 (default 0)\n"
+		"  -k KB     kernel image size (default 1024)\n"
+		"  -z        make the kernel image compress like a real one\n"
+		"  -E        wrap the kernel image up in an ELF, with some BSS\n"
+		"  -n reads  number of reads or writes (default 64)\n"
+		"  -s bytes  size of each read or write (default 1024)\n"
+		"  -r        read from random addresses instead of sequentially\n"
+		"  -c us     time the guest spends between accesses (default 0)\n"
+		"  -A        prefetch each read before that time, and see if it made it\n"
+		"  -W        write instead of read, then check host memory\n"
+		"  -w KB     only read from the first KB of the kernel (default: all of it)\n"
+		"  -f mask   protocol features the host offers (default 0x%x)\n"
+		"  -1        multiboot the whole loader, no stub\n"
+		"  -m KB     split guest memory into two regions, this much in the first (default: one region)\n"
+		"  -a KB     make the second region a slow tier this big, in a file like ARAM\n"
+		"  -F KB     main RAM to keep the slow tier's hot pages in (default 256)\n"
+		"  -b KB     give the guest a disk this big (plus a bit), and test it after\n"
+		"  -P        read the whole kernel in before loading it, no demand paging\n"
+		"  -S        dump both sides' link stats at the end\n"
+		"  -T path   write both sides' protocol traces to path-host.bin and path-gba.bin\n"
+		"  -K path   have the host save a checkpoint at the end, and copy it to path\n"
+		"  -R path   resume from the checkpoint at path, checking it has everything -K saved\n"
+		"  -v        show both sides' console output\n"
+		"  -p port   SI port the GBA is on, 1-4 (default %d)\n"
+		"  -u ms     pull the cable out for this long halfway through; the GBA has to rejoin\n"
+		"  -C        time the CRC engines and exit\n",
+		argv0, C_OfferedFeatures, GBA_CHAN + 1);
+	exit(1);
+}
+
+/* we'll be off in the fake SD card by the time paths from the command line get used */
+static void absPath(char *dst, const char *arg) {
+	if (arg[0] == '/' || !getcwd(dst, PATH_MAX - strlen(arg) - 1))
+		snprintf(dst, PATH_MAX, "%s", arg);
+	else
+		snprintf(dst + strlen(dst), PATH_MAX - strlen(dst), "/%s", arg);
+}
+
+int main(int argc, char **argv) {
+	u32 latency = 100, jitter = 0, pickup = 0, mem1Size = MEM_SZ, aramSize = 0, frameSize = 256 * 1024;
+	pthread_t thread;
+	int opt, chan;
+
+	while ((opt = getopt(argc, argv, "l:j:g:e:k:zEn:s:rc:AWw:f:m:a:F:b:1PST:K:R:vp:u:C")) != -1) {
+		switch (opt) {
+		case 'l': latency = strtoul(optarg, NULL, 0); break;
+		case 'j': jitter = strtoul(optarg, NULL, 0); break;
+		case 'g': pickup = strtoul(optarg, NULL, 0); break;
+		case 'e': bitErrors = strtod(optarg, NULL); break;
+		case 'k': kernelSize = strtoul(optarg, NULL, 0) * 1024; break;
+		case 'z': compressible = true; break;
+		case 'E': elfKernel = true; break;
+		case 'n': numReads = strtoul(optarg, NULL, 0); break;
+		case 's': readSize = strtoul(optarg, NULL, 0); break;
+		case 'r': randomReads = true; break;
+		case 'c': thinkTime = strtoul(optarg, NULL, 0); break;
+		case 'A': prefetch = true; break;
+		case 'W': writes = true; break;
+		case 'w': workingSet = strtoul(optarg, NULL, 0) * 1024; break;
+		case 'f': C_OfferedFeatures = strtoul(optarg, NULL, 0); break;
+		case 'm': mem1Size = strtoul(optarg, NULL, 0) * 1024; break;
+		case 'a': aramSize = strtoul(optarg, NULL, 0) * 1024; break;
+		case 'F': frameSize = strtoul(optarg, NULL, 0) * 1024; break;
+		case 'b': diskSize = strtoul(optarg, NULL, 0) * 1024 + DISK_TAIL; break;
+		case '1': twoStage = false; break;
+		case 'P': C_DemandPaging = false; break;
+		case 'S': showStats = true; break;
+		case 'T': absPath(tracePrefix, optarg); break;
+		case 'K': absPath(ckptOut, optarg); break;
+		case 'R': absPath(ckptIn, optarg); break;
+		case 'v': S_Verbose = true; break;
+		case 'p': S_Chan = strtol(optarg, NULL, 0) - 1; break;
+		case 'u': unplugMs = strtoul(optarg, NULL, 0); break;
+		case 'C': crc_bench(cycles); return 0;
+		default: usage(argv[0]);
+		}
+	}
+
+	if (!readSize || readSize > 0xffff * 4 || kernelSize <= readSize ||
+	    (workingSet && workingSet <= readSize) ||
+	    kernelSize >= mem1Size + (aramSize ? aramSize : MEM_SZ - mem1Size) ||
+	    ((aramSize || diskSize) && frameSize < 2 * M_PAGE_SIZE) ||
+	    (elfKernel && kernelSize <= ELF_BSS) ||
+	    mem1Size < 2 * LOADER_MAX_BYTES || mem1Size > MEM_SZ || (mem1Size & (M_PAGE_SIZE - 1)) ||
+	    S_Chan < 0 || S_Chan >= C_MAX_GBAS)
+		usage(argv[0]);
+
+	setbuf(stdout, NULL);
+	setupSD();
+
+	/*
+	 * two separate allocations, like MEM1 and MEM2 on a Wii, or MEM1 and ARAM
+	 * on a GameCube; every port gets a window on the pool, like main.c does
+	 */
+	M_AddFrames(calloc(1, mem1Size), mem1Size);
+	if (!aramSize && mem1Size < MEM_SZ)
+		M_AddFrames(calloc(1, MEM_SZ - mem1Size), MEM_SZ - mem1Size);
+	if (aramSize || diskSize)
+		T_Init(memalign(M_PAGE_SIZE, frameSize), frameSize);
+	if (aramSize)
+		S_AramInit(aramSize);
+	for (chan = 0; chan < C_MAX_GBAS; chan++) {
+		M_AddGuest();
+		M_AddPoolRegion(chan == S_Chan ? "Pool (GBA)" : "Pool", M_Stats.frames << M_PAGE_SHIFT, 0);
+		if (aramSize && chan == S_Chan)
+			M_AddSlowRegion("ARAM", &S_AramBackend, aramSize, 0);
+	}
+
+	S_LinkInit(latency, jitter, pickup);
+	if (pthread_create(&thread, NULL, gbaThread, NULL)) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	/* app_main() exits for us once it's done */
+	while (1)
+		C_Process();
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * GBA Linux Loader - Link simulator
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include "sim-types.h"
+
+/* JOY bus model */
+extern void S_LinkInit(u32 latencyUs, u32 jitterUs, u32 pickupUs);
+extern u32  S_WaitBoot(void); /* returns about how many bytes were multibooted */
+/* flip bits in words going to the GBA from now on, at this rate per bit */
+extern void S_LinkNoise(double bitErrorRate);
+extern u32  S_Flips;
+/* the SI port the GBA's plugged into */
+extern s32  S_Chan;
+/* pull the cable out for ms, starting now */
+extern void S_Unplug(u32 ms);
+
+/* what the stub gets to use as EWRAM, and where it goes once it's done */
+extern u8 S_Ewram[];
+extern void S_Boot(u32 bytes);
+
+/* file standing in for ARAM, as the slow tier of guest memory */
+struct _tierBackend;
+extern const struct _tierBackend S_AramBackend;
+extern void S_AramInit(u32 size);
+
+/* timing */
+extern u64  S_Micros(void);
+extern void S_Delay(u32 us);
+
+extern bool S_Verbose;
+
+#endif /* _SIM_H */
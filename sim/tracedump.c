@@ -0,0 +1,280 @@
+/*
+ * GBA Linux Loader - Link simulator - Protocol trace decoder
+ *
+ * Turns the binary trace rings from trace.h back into a timeline.  Takes
+ * what the host's C_DumpTrace() writes, what the simulator's -T writes, or
+ * any memory dump with a ring in it somewhere (an emulator's EWRAM dump,
+ * say); the ring can be in either byte order.
+ *
+ * Given more than one, the records all go into one timeline, which only
+ * makes sense if the clocks started together, like they do in the
+ * simulator.  Lines for the host's requests come out the same as the
+ * console used to print them, so gba-cache-sim can replay the output.
+ *
+ * Copyright (C) 2025 Techflash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gba_types.h>
+#include "trace.h"
+
+struct event {
+	double us;
+	u32 seq, side;
+	struct traceRec rec;
+};
+
+static struct event *events;
+static u32 numEvents, capEvents;
+
+static inline u32 swap32(u32 x) {
+	return __builtin_bswap32(x);
+}
+
+static inline u16 swap16(u16 x) {
+	return __builtin_bswap16(x);
+}
+
+static void addEvent(double us, u32 side, const struct traceRec *rec) {
+	if (numEvents == capEvents) {
+		capEvents = capEvents ? capEvents * 2 : 4096;
+		events = realloc(events, capEvents * sizeof(*events));
+		if (!events) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	events[numEvents].us = us;
+	events[numEvents].seq = numEvents;
+	events[numEvents].side = side;
+	events[numEvents].rec = *rec;
+	numEvents++;
+}
+
+/* find a ring in buf, false if there isn't one */
+static bool loadRing(const char *path, const u8 *buf, size_t len) {
+	struct traceHdr hdr;
+	struct traceRec rec;
+	const struct traceRec *recs;
+	size_t off;
+	u32 i, n, first, prev = 0;
+	u64 wraps = 0;
+	bool swap = false;
+
+	for (off = 0; off + sizeof(hdr) <= len; off += 4) {
+		memcpy(&hdr, buf + off, sizeof(hdr));
+		if (hdr.magic == TRACE_MAGIC)
+			swap = false;
+		else if (hdr.magic == swap32(TRACE_MAGIC))
+			swap = true;
+		else
+			continue;
+
+		if (swap) {
+			hdr.side = swap32(hdr.side);
+			hdr.tickHz = swap32(hdr.tickHz);
+			hdr.size = swap32(hdr.size);
+			hdr.head = swap32(hdr.head);
+		}
+
+		/* something that happens to look like the magic? */
+		if (!hdr.size || (hdr.size & (hdr.size - 1)) || !hdr.tickHz || hdr.side > TRACE_GBA ||
+		    off + sizeof(hdr) + ((size_t)hdr.size * sizeof(rec)) > len)
+			continue;
+		goto found;
+	}
+
+	fprintf(stderr, "%s: no trace ring in it\n", path);
+	return false;
+
+found:
+	recs = (const struct traceRec *)(buf + off + sizeof(hdr));
+	n = (hdr.head < hdr.size) ? hdr.head : hdr.size;
+	first = hdr.head - n;
+
+	/* oldest first, counting the times the clock wrapped along the way */
+	for (i = 0; i < n; i++) {
+		memcpy(&rec, &recs[(first + i) & (hdr.size - 1)], sizeof(rec));
+		if (swap) {
+			rec.time = swap32(rec.time);
+			rec.event = swap16(rec.event);
+			rec.pkt = swap16(rec.pkt);
+			rec.a = swap32(rec.a);
+			rec.b = swap32(rec.b);
+		}
+
+		if (i && rec.time < prev)
+			wraps++;
+		prev = rec.time;
+		addEvent(((double)((wraps << 32) | rec.time) * 1000000.0) / hdr.tickHz, hdr.side, &rec);
+	}
+
+	fprintf(stderr, "%s: %s ring, %u of %u records%s\n", path, (hdr.side == TRACE_GBA) ? "GBA" : "host",
+	        n, hdr.head, (hdr.head > n) ? " (the rest were overwritten)" : "");
+	return true;
+}
+
+static bool loadFile(const char *path) {
+	FILE *fp = fopen(path, "rb");
+	size_t len, cap = 0;
+	u8 *buf = NULL;
+	bool ok;
+
+	if (!fp) {
+		perror(path);
+		return false;
+	}
+
+	for (len = 0; !feof(fp) && !ferror(fp); len += fread(buf + len, 1, cap - len, fp)) {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 65536;
+			buf = realloc(buf, cap);
+			if (!buf) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+	}
+	fclose(fp);
+
+	ok = loadRing(path, buf, len);
+	free(buf);
+	return ok;
+}
+
+static const char *pktName(u32 pkt, char *out) {
+	static const char *sys[8] = { "SYS_0", "ACK", "MW_TX_DONE", "PING", "PING_REPLY", "KERNEL_LOAD", "FEATURES", "LOADER" };
+	static const char *mem[8] = { "MEM_READ", "MEM_WRITE", "MEM_PUSH", "MEM_DATA" };
+	static const char *blk[8] = { "BLK_READ", "BLK_WRITE" };
+	u32 cls = pkt & PKT_CLASS, sub = (pkt & PKT_SUBCMD) >> SUBCMD_SHIFT;
+	const char *name = NULL;
+
+	if (cls == CLASS_SYS)
+		name = sys[sub];
+	else if (cls == CLASS_MEM)
+		name = mem[sub];
+	else if (cls == CLASS_BLK)
+		name = blk[sub];
+
+	if (name)
+		strcpy(out, name);
+	else
+		sprintf(out, "%u/%u", cls >> CLASS_SHIFT, sub);
+	return out;
+}
+
+static void printEvent(const struct event *e, double base) {
+	const struct traceRec *r = &e->rec;
+	u32 id = (r->pkt & PKT_CMD_ID) >> CMD_ID_SHIFT;
+	bool blk = (r->pkt & PKT_CLASS) == CLASS_BLK;
+	char name[32];
+
+	printf("%12.6f %-4s ", (e->us - base) / 1000000.0, (e->side == TRACE_GBA) ? "gba" : "host");
+	pktName(r->pkt, name);
+
+	switch (r->event) {
+	case TR_SEND:
+	case TR_RECV: {
+		printf("%s %s with ", (r->event == TR_SEND) ? "Sent" : "Got", name);
+		if (blk)
+			printf("sector=%u, count=%u", r->a, r->b);
+		else
+			printf("addr=0x%08x, length=%u", r->a, r->b);
+		printf(" (id %u)\n", id);
+		break;
+	}
+	case TR_ACK:
+		printf("%s ACKed: 0x%04x (id %u)\n", name, r->a, id);
+		break;
+	case TR_DATA:
+		if (r->b)
+			printf("%s: %u words, compressed to %u (id %u)\n", name, r->a, r->b, id);
+		else
+			printf("%s: %u words (id %u)\n", name, r->a, id);
+		break;
+	case TR_DONE:
+		printf("%s done: %u bytes in %u us (id %u)\n", name, r->a, r->b, id);
+		break;
+	case TR_REFUSED:
+		printf("%s refused: %s %u, %u (id %u)\n", name, blk ? "sector" : "addr", r->a, r->b, id);
+		break;
+	case TR_BAD:
+		printf("%s: bad packet or CRC, 0x%08x, wanted 0x%04x (id %u)\n", name, r->a, r->b, id);
+		break;
+	case TR_RETRY:
+		printf("%s: going again from block %u (id %u)\n", name, r->a, id);
+		break;
+	case TR_FETCH:
+		printf("Reading %uB from 0x%08x\n", r->b, r->a);
+		break;
+	case TR_STORE:
+		printf("Writing %uB to 0x%08x\n", r->b, r->a);
+		break;
+	case TR_PUSH:
+		printf("Pushing %u words at 0x%08x\n", r->b, r->a);
+		break;
+	case TR_PING:
+		printf("Ping, 0x%04x\n", r->a);
+		break;
+	case TR_PACE:
+		printf("Paced word gap now %u us (calibrated %u us)\n", r->a, r->b);
+		break;
+	default:
+		printf("event %u, %s, 0x%08x 0x%08x\n", r->event, name, r->a, r->b);
+		break;
+	}
+}
+
+static int byTime(const void *x, const void *y) {
+	const struct event *a = x, *b = y;
+
+	if (a->us != b->us)
+		return (a->us < b->us) ? -1 : 1;
+	return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [options] dump...\n"
+		"  -e        only what went wrong (bad packets, retries, refusals)\n",
+		argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	bool errorsOnly = false;
+	u32 i, ev;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e")) != -1) {
+		switch (opt) {
+		case 'e': errorsOnly = true; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	if (optind >= argc)
+		usage(argv[0]);
+
+	for (; optind < argc; optind++) {
+		if (!loadFile(argv[optind]))
+			return 1;
+	}
+
+	if (!numEvents) {
+		fprintf(stderr, "nothing in the trace\n");
+		return 1;
+	}
+
+	qsort(events, numEvents, sizeof(*events), byTime);
+	for (i = 0; i < numEvents; i++) {
+		ev = events[i].rec.event;
+		if (errorsOnly && ev != TR_REFUSED && ev != TR_BAD && ev != TR_RETRY)
+			continue;
+		printEvent(&events[i], events[0].us);
+	}
+	return 0;
+}